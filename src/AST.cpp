@@ -1,8 +1,40 @@
 #include "AST.h"
+#include "Heap.h"
 #include "Utils.h"
+#include <algorithm>
+#include <cstring>
 
 namespace Lox {
 
+void* AstArena::allocate(std::size_t size, std::size_t align)
+{
+    assert(align > 0 && (align & (align - 1)) == 0);
+    auto addr = reinterpret_cast<std::uintptr_t>(m_cur);
+    auto pad = (align - addr % align) % align;
+    if (!m_cur || pad + size > static_cast<std::size_t>(m_end - m_cur)) {
+        // blocks grow, so that a big program takes a handful of them
+        auto block_size = std::max(m_next_block_size, size + align);
+        m_next_block_size = std::min(m_next_block_size * 2, MAX_BLOCK_SIZE);
+        m_blocks.push_back(std::make_unique_for_overwrite<std::byte[]>(block_size));
+        m_cur = m_blocks.back().get();
+        m_end = m_cur + block_size;
+        addr = reinterpret_cast<std::uintptr_t>(m_cur);
+        pad = (align - addr % align) % align;
+    }
+    auto mem = m_cur + pad;
+    m_cur = mem + size;
+    return mem;
+}
+
+std::string_view AstArena::copy(std::string_view str)
+{
+    if (str.empty())
+        return {};
+    auto mem = static_cast<char*>(allocate(str.size(), 1));
+    std::memcpy(mem, str.data(), str.size());
+    return { mem, str.size() };
+}
+
 static std::string make_indent(std::size_t indent)
 {
     return std::string(indent * 2, ' ');
@@ -10,7 +42,7 @@ static std::string make_indent(std::size_t indent)
 
 std::string StringLiteral::dump(std::size_t indent) const
 {
-    return make_indent(indent).append(escape(m_value));
+    return make_indent(indent).append(escape(std::string(m_value)));
 }
 
 std::string NumberLiteral::dump(std::size_t indent) const
@@ -145,6 +177,46 @@ std::string CallExpr::dump(std::size_t indent) const
     return s;
 }
 
+std::string ListExpr::dump(std::size_t indent) const
+{
+    std::string s = make_indent(indent);
+    s += "(list";
+    for (auto& item : m_items) {
+        s += '\n';
+        s += item->dump(indent + 1);
+    }
+    s += ')';
+    return s;
+}
+
+std::string MapExpr::dump(std::size_t indent) const
+{
+    std::string s = make_indent(indent);
+    s += "(map";
+    for (std::size_t i = 0; i < m_entries.size(); i += 2) {
+        s += '\n';
+        s += make_indent(indent + 1);
+        s += "(entry\n";
+        s += m_entries[i]->dump(indent + 2);
+        s += '\n';
+        s += m_entries[i + 1]->dump(indent + 2);
+        s += ')';
+    }
+    s += ')';
+    return s;
+}
+
+std::string IndexExpr::dump(std::size_t indent) const
+{
+    std::string s = make_indent(indent);
+    s += "(index\n";
+    s += m_object->dump(indent + 1);
+    s += '\n';
+    s += m_index->dump(indent + 1);
+    s += ')';
+    return s;
+}
+
 std::string FunctionExpr::dump(std::size_t indent) const
 {
     std::string s = make_indent(indent);
@@ -306,4 +378,16 @@ std::string Program::dump(std::size_t indent) const
     return s;
 }
 
+Program::~Program()
+{
+    for (auto obj : m_constants)
+        heap().unpin(obj);
+}
+
+void Program::add_constant(Object* obj)
+{
+    heap().pin(obj);
+    m_constants.push_back(obj);
+}
+
 }
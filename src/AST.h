@@ -2,55 +2,131 @@
 
 #include <string>
 #include <memory>
+#include <new>
 #include <cassert>
 #include <vector>
-#include <optional>
+#include <span>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
 
 namespace Lox {
 
 class Checker;
+class Compiler;
+class SourceFile;
+class AstWriter;
+
+// Bump allocator for the nodes of a program's syntax tree. Nodes and lists
+// of children are allocated contiguously in big blocks, and are trivially
+// destructible, so the whole tree is freed at once with the arena without
+// visiting the nodes.
+class AstArena {
+public:
+    AstArena() = default;
+    AstArena(AstArena&&) = default;
+    AstArena& operator=(AstArena&&) = default;
+
+    template<typename T, typename... Args>
+    T* make(Args&&... args)
+    {
+        static_assert(std::is_trivially_destructible_v<T>);
+        ++m_object_count;
+        return new (allocate(sizeof(T), alignof(T)))
+            T(std::forward<Args>(args)...);
+    }
+
+    template<typename T>
+    std::span<const T> copy(std::span<const T> items)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if (items.empty())
+            return {};
+        auto mem = static_cast<T*>(allocate(items.size_bytes(), alignof(T)));
+        std::uninitialized_copy(items.begin(), items.end(), mem);
+        return { mem, items.size() };
+    }
+    std::string_view copy(std::string_view str);
+
+    std::size_t block_count() const { return m_blocks.size(); }
+    // number of objects made, i.e. syntax tree nodes
+    std::size_t object_count() const { return m_object_count; }
+
+private:
+    static constexpr std::size_t MIN_BLOCK_SIZE = 4 * 1024;
+    static constexpr std::size_t MAX_BLOCK_SIZE = 1024 * 1024;
+
+    void* allocate(std::size_t size, std::size_t align);
+
+    std::vector<std::unique_ptr<std::byte[]>> m_blocks;
+    std::byte* m_cur { nullptr };
+    std::byte* m_end { nullptr };
+    std::size_t m_next_block_size { MIN_BLOCK_SIZE };
+    std::size_t m_object_count { 0 };
+};
 
 class ASTNode {
 public:
-    virtual ~ASTNode() = default;
-
     explicit ASTNode(std::string_view text) : m_text(text)
     {}
 
     virtual bool check(Checker&) { return true; }
     std::string_view text() const { return m_text; }
     virtual std::string dump(std::size_t indent) const = 0;
+    // serialize the checked node, see ProgramCache
+    virtual void write(AstWriter&) const = 0;
 
 protected:
+    // nodes live in an arena and are never destroyed one by one, so the
+    // destructor is left trivial
+    ~ASTNode() = default;
+
     std::string_view m_text;
 };
 
+class Value;
 class Object;
 class Interpreter;
+class Scope;
+class NumberRange;
+enum class TypeTag : std::uint8_t;
 
 class Expr : public ASTNode {
 public:
-    virtual ~Expr() = default;
-
     explicit Expr(std::string_view text) : ASTNode(text)
     {}
 
-    virtual std::shared_ptr<Object> eval(Interpreter&) const = 0;
+    virtual Value eval(Interpreter&) const = 0;
+    virtual void compile(Compiler&) const = 0;
     virtual bool is_identifier() const { return false; }
+    virtual bool is_index() const { return false; }
+    // value of a literal or of an expression folded by the checker,
+    // empty if the value is only known at runtime
+    virtual Value constant() const;
 };
 
 class StringLiteral : public Expr {
 public:
-    StringLiteral(const std::string& value, std::string_view text)
+    // value must outlive the node, e.g. be allocated in the same arena
+    StringLiteral(std::string_view value, std::string_view text)
         : Expr(text)
         , m_value(value)
     {}
 
+    bool check(Checker&) override;
     std::string dump(std::size_t indent) const override;
-    std::shared_ptr<Object> eval(Interpreter&) const override;
+    void write(AstWriter&) const override;
+    Value eval(Interpreter&) const override;
+    void compile(Compiler&) const override;
+    Value constant() const override;
 
 private:
-    std::string m_value;
+    friend class AstReader;
+
+    std::string_view m_value;
+    // string object made once by the checker, so eval doesn't allocate
+    const Value* m_constant { nullptr };
 };
 
 class NumberLiteral : public Expr {
@@ -61,12 +137,35 @@ public:
     {}
 
     std::string dump(std::size_t indent) const override;
-    std::shared_ptr<Object> eval(Interpreter&) const override;
+    void write(AstWriter&) const override;
+    Value eval(Interpreter&) const override;
+    void compile(Compiler&) const override;
+    Value constant() const override;
 
 private:
     double m_value { 0.0 };
 };
 
+// How a variable is accessed, as resolved by the checker. Locals of a
+// function, including those of its nested blocks, live in slots of the
+// function's frame. A local captured by a nested function is boxed: its
+// slot references a heap box shared with the closures that captured it.
+enum class VarKind : std::uint8_t {
+    Global, // looked up by name in the global scope
+    Local, // in a slot of the current frame
+    BoxedLocal, // in a box referenced from a slot of the current frame
+    Captured, // in a box captured by the current function
+};
+
+struct VarRef {
+    VarKind kind { VarKind::Global };
+    // frame slot of a local, or index of a captured box in the function
+    std::uint32_t index { 0 };
+    // a declaration, that is not a redeclaration of a boxed local, puts
+    // a new box into the slot
+    bool new_box { false };
+};
+
 class Identifier : public Expr {
 public:
     Identifier(std::string_view name, std::string_view text)
@@ -76,15 +175,29 @@ public:
 
     bool check(Checker&) override;
     std::string dump(std::size_t indent) const override;
-    std::shared_ptr<Object> eval(Interpreter&) const override;
+    void write(AstWriter&) const override;
+    Value eval(Interpreter&) const override;
+    void compile(Compiler&) const override;
     bool is_identifier() const override { return true; }
+    // declare identifier as a variable in checker's current scope
+    void declare(Checker&);
 
     std::string_view name() const { return m_name; }
-    std::optional<std::size_t> hops() const { return m_hops; }
+    const VarRef& var() const { return m_var; }
+    // find global var, caching its location on success, so later lookups
+    // skip hashing the name
+    Value* find_global(Scope& globals) const;
 
 private:
+    // checker boxes the identifier's variable when it finds the variable
+    // captured, which may happen after the identifier was resolved
+    friend class Checker;
+    friend class AstReader;
+
     std::string_view m_name;
-    std::optional<std::size_t> m_hops;
+    VarRef m_var;
+    mutable Scope* m_cached_globals { nullptr };
+    mutable Value* m_cached_global { nullptr };
 };
 
 class BoolLiteral : public Expr {
@@ -95,7 +208,10 @@ public:
     {}
 
     std::string dump(std::size_t indent) const override;
-    std::shared_ptr<Object> eval(Interpreter&) const override;
+    void write(AstWriter&) const override;
+    Value eval(Interpreter&) const override;
+    void compile(Compiler&) const override;
+    Value constant() const override;
 
 private:
     bool m_value { false };
@@ -107,7 +223,10 @@ public:
     {}
 
     std::string dump(std::size_t indent) const override;
-    std::shared_ptr<Object> eval(Interpreter&) const override;
+    void write(AstWriter&) const override;
+    Value eval(Interpreter&) const override;
+    void compile(Compiler&) const override;
+    Value constant() const override;
 };
 
 enum class UnaryOp {
@@ -117,7 +236,7 @@ enum class UnaryOp {
 
 class UnaryExpr : public Expr {
 public:
-    UnaryExpr(UnaryOp op, std::shared_ptr<Expr> expr, std::string_view text)
+    UnaryExpr(UnaryOp op, Expr* expr, std::string_view text)
         : Expr(text)
         , m_op(op)
         , m_expr(expr)
@@ -127,16 +246,23 @@ public:
 
     bool check(Checker&) override;
     std::string dump(std::size_t indent) const override;
-    std::shared_ptr<Object> eval(Interpreter&) const override;
+    void write(AstWriter&) const override;
+    Value eval(Interpreter&) const override;
+    void compile(Compiler&) const override;
+    Value constant() const override;
 
 private:
+    friend class AstReader;
+
     const UnaryOp m_op;
-    std::shared_ptr<Expr> m_expr;
+    Expr* m_expr;
+    // value folded by the checker, if the operand is constant
+    const Value* m_constant { nullptr };
 };
 
 class GroupExpr : public Expr {
 public:
-    GroupExpr(std::shared_ptr<Expr> expr, std::string_view text)
+    GroupExpr(Expr* expr, std::string_view text)
         : Expr(text)
         , m_expr(expr)
     {
@@ -145,10 +271,13 @@ public:
 
     bool check(Checker&) override;
     std::string dump(std::size_t indent) const override;
-    std::shared_ptr<Object> eval(Interpreter&) const override;
+    void write(AstWriter&) const override;
+    Value eval(Interpreter&) const override;
+    void compile(Compiler&) const override;
+    Value constant() const override;
 
 private:
-    std::shared_ptr<Expr> m_expr;
+    Expr* m_expr;
 };
 
 enum class BinaryOp {
@@ -167,8 +296,8 @@ enum class BinaryOp {
 
 class BinaryExpr : public Expr {
 public:
-    BinaryExpr(BinaryOp op, std::shared_ptr<Expr> left,
-        std::shared_ptr<Expr> right, std::string_view text)
+    BinaryExpr(BinaryOp op, Expr* left,
+        Expr* right, std::string_view text)
         : Expr(text)
         , m_op(op)
         , m_left(left)
@@ -180,12 +309,34 @@ public:
 
     bool check(Checker&) override;
     std::string dump(std::size_t indent) const override;
-    std::shared_ptr<Object> eval(Interpreter&) const override;
+    void write(AstWriter&) const override;
+    Value eval(Interpreter&) const override;
+    void compile(Compiler&) const override;
+    Value constant() const override;
 
 private:
+    friend class AstReader;
+
     const BinaryOp m_op;
-    std::shared_ptr<Expr> m_left;
-    std::shared_ptr<Expr> m_right;
+    Expr* m_left;
+    Expr* m_right;
+    // value folded by the checker, if both operands are constant and the
+    // operator applies to them; otherwise errors are left to runtime
+    const Value* m_constant { nullptr };
+
+    // On first successful execution the node specializes itself to the
+    // operator's implementation for the operand types seen, e.g. number
+    // add. Later executions call it directly while the types match; once
+    // they don't, the node falls back to generic dispatch for good.
+    enum class Quickening : std::uint8_t {
+        Unspecialized,
+        Specialized,
+        Generic,
+    };
+    mutable Quickening m_quickening { Quickening::Unspecialized };
+    mutable TypeTag m_left_tag {};
+    mutable TypeTag m_right_tag {};
+    mutable Value (*m_specialized)(const Value&, const Value&) { nullptr };
 };
 
 enum class LogicalOp {
@@ -195,8 +346,8 @@ enum class LogicalOp {
 
 class LogicalExpr : public Expr {
 public:
-    LogicalExpr(LogicalOp op, std::shared_ptr<Expr> left,
-                std::shared_ptr<Expr> right, std::string_view text)
+    LogicalExpr(LogicalOp op, Expr* left,
+                Expr* right, std::string_view text)
         : Expr(text)
         , m_op(op)
         , m_left(left)
@@ -208,21 +359,29 @@ public:
 
     bool check(Checker&) override;
     std::string dump(std::size_t indent) const override;
-    std::shared_ptr<Object> eval(Interpreter&) const override;
+    void write(AstWriter&) const override;
+    Value eval(Interpreter&) const override;
+    void compile(Compiler&) const override;
+    Value constant() const override;
 
 private:
+    friend class AstReader;
+
     const LogicalOp m_op;
-    std::shared_ptr<Expr> m_left;
-    std::shared_ptr<Expr> m_right;
+    Expr* m_left;
+    Expr* m_right;
+    // value folded by the checker, if the left operand short-circuits or
+    // both operands are constant bools
+    const Value* m_constant { nullptr };
 };
 
 class CallExpr : public Expr {
 public:
-    CallExpr(std::shared_ptr<Expr> callee,
-        std::vector<std::shared_ptr<Expr>>&& args, std::string_view text)
+    CallExpr(Expr* callee,
+        std::span<Expr* const> args, std::string_view text)
         : Expr(text)
         , m_callee(callee)
-        , m_args(std::move(args))
+        , m_args(args)
     {
         assert(callee);
         for (auto& arg : args)
@@ -231,22 +390,101 @@ public:
 
     bool check(Checker&) override;
     std::string dump(std::size_t indent) const override;
-    std::shared_ptr<Object> eval(Interpreter&) const override;
+    void write(AstWriter&) const override;
+    Value eval(Interpreter&) const override;
+    void compile(Compiler&) const override;
+
+private:
+    Expr* m_callee;
+    std::span<Expr* const> m_args;
+};
+
+// [a, b, c]
+class ListExpr : public Expr {
+public:
+    ListExpr(std::span<Expr* const> items, std::string_view text)
+        : Expr(text)
+        , m_items(items)
+    {
+        for ([[maybe_unused]] auto& item : items)
+            assert(item);
+    }
+
+    bool check(Checker&) override;
+    std::string dump(std::size_t indent) const override;
+    void write(AstWriter&) const override;
+    Value eval(Interpreter&) const override;
+    void compile(Compiler&) const override;
+
+private:
+    std::span<Expr* const> m_items;
+};
+
+// {key: value, ...}
+class MapExpr : public Expr {
+public:
+    // keys and values alternate in entries
+    MapExpr(std::span<Expr* const> entries, std::string_view text)
+        : Expr(text)
+        , m_entries(entries)
+    {
+        assert(entries.size() % 2 == 0);
+        for ([[maybe_unused]] auto& expr : entries)
+            assert(expr);
+    }
+
+    bool check(Checker&) override;
+    std::string dump(std::size_t indent) const override;
+    void write(AstWriter&) const override;
+    Value eval(Interpreter&) const override;
+    void compile(Compiler&) const override;
+
+private:
+    std::span<Expr* const> m_entries;
+};
+
+// object[index], also the place of an assignment
+class IndexExpr : public Expr {
+public:
+    IndexExpr(Expr* object, Expr* index, std::string_view text)
+        : Expr(text)
+        , m_object(object)
+        , m_index(index)
+    {
+        assert(object);
+        assert(index);
+    }
+
+    bool check(Checker&) override;
+    std::string dump(std::size_t indent) const override;
+    void write(AstWriter&) const override;
+    Value eval(Interpreter&) const override;
+    void compile(Compiler&) const override;
+    bool is_index() const override { return true; }
+
+    const Expr& object() const { return *m_object; }
+    const Expr& index() const { return *m_index; }
 
 private:
-    std::shared_ptr<Expr> m_callee;
-    std::vector<std::shared_ptr<Expr>> m_args;
+    Expr* m_object;
+    Expr* m_index;
 };
 
 class BlockStmt;
 
-class FunctionExpr: public Expr
-    , public std::enable_shared_from_this<FunctionExpr> {
+// A box captured by a function when it's created: either a boxed local of
+// the enclosing function's frame or a box captured by that function.
+struct Capture {
+    bool is_local { false };
+    std::uint32_t index { 0 };
+};
+
+class FunctionExpr: public Expr {
 public:
-    FunctionExpr(std::vector<std::shared_ptr<Identifier>>&& params,
-        std::shared_ptr<BlockStmt> block, std::string_view text)
+    FunctionExpr(std::span<Identifier* const> params,
+        BlockStmt* block, std::string_view text)
         : Expr(text)
-        , m_params(std::move(params))
+        , m_params(params)
         , m_block(block)
     {
         for (auto& param : params)
@@ -256,17 +494,30 @@ public:
 
     bool check(Checker&) override;
     std::string dump(std::size_t indent) const override;
-    std::shared_ptr<Object> eval(Interpreter&) const override;
+    void write(AstWriter&) const override;
+    Value eval(Interpreter&) const override;
+    void compile(Compiler&) const override;
 
-    const std::vector<std::shared_ptr<Identifier>>& params() const
+    std::span<Identifier* const> params() const
     {
         return m_params;
     }
     const BlockStmt& block() const { return *m_block; }
+    std::size_t frame_size() const { return m_frame_size; }
+    std::span<const Capture> captures() const { return m_captures; }
+    // name of a declared function, empty for a function expression
+    std::string_view name() const { return m_name; }
+    void set_name(std::string_view name) { m_name = name; }
 
 private:
-    std::vector<std::shared_ptr<Identifier>> m_params;
-    std::shared_ptr<BlockStmt> m_block;
+    friend class AstReader;
+
+    std::span<Identifier* const> m_params;
+    BlockStmt* m_block;
+    // number of slots in function's frame, including params
+    std::size_t m_frame_size { 0 };
+    std::span<const Capture> m_captures;
+    std::string_view m_name;
 };
 
 class Stmt : public ASTNode {
@@ -275,12 +526,13 @@ public:
     {}
 
     virtual bool execute(Interpreter&) const = 0;
+    virtual void compile(Compiler&) const = 0;
     virtual bool is_var_statement() const { return false; }
 };
 
 class ExpressionStmt : public Stmt {
 public:
-    ExpressionStmt(std::shared_ptr<Expr> expr, std::string_view text)
+    ExpressionStmt(Expr* expr, std::string_view text)
         : Stmt(text)
         , m_expr(expr)
     {
@@ -289,15 +541,17 @@ public:
 
     bool check(Checker&) override;
     std::string dump(std::size_t indent) const override;
+    void write(AstWriter&) const override;
     bool execute(Interpreter&) const override;
+    void compile(Compiler&) const override;
 
 private:
-    std::shared_ptr<Expr> m_expr;
+    Expr* m_expr;
 };
 
 class AssertStmt : public Stmt {
 public:
-    AssertStmt(std::shared_ptr<Expr> expr, std::string_view text)
+    AssertStmt(Expr* expr, std::string_view text)
         : Stmt(text)
         , m_expr(expr)
     {
@@ -306,15 +560,17 @@ public:
 
     bool check(Checker&) override;
     std::string dump(std::size_t indent) const override;
+    void write(AstWriter&) const override;
     bool execute(Interpreter&) const override;
+    void compile(Compiler&) const override;
 
 private:
-    std::shared_ptr<Expr> m_expr;
+    Expr* m_expr;
 };
 
 class VarStmt : public Stmt {
 public:
-    VarStmt(std::shared_ptr<Identifier> ident, std::shared_ptr<Expr> init,
+    VarStmt(Identifier* ident, Expr* init,
         std::string_view text)
         : Stmt(text)
         , m_ident(ident)
@@ -326,42 +582,46 @@ public:
 
     bool check(Checker&) override;
     std::string dump(std::size_t indent) const override;
+    void write(AstWriter&) const override;
     bool execute(Interpreter&) const override;
+    void compile(Compiler&) const override;
     bool is_var_statement() const override { return true; }
     const Identifier& identifier() const { return *m_ident; }
 
 private:
-    std::shared_ptr<Identifier> m_ident;
-    std::shared_ptr<Expr> m_init;
+    Identifier* m_ident;
+    Expr* m_init;
 };
 
 class AssignStmt : public Stmt {
 public:
-    AssignStmt(std::shared_ptr<Expr> place, std::shared_ptr<Expr> value,
+    AssignStmt(Expr* place, Expr* value,
         std::string_view text)
         : Stmt(text)
         , m_place(place)
         , m_value(value)
     {
         assert(place);
-        assert(place->is_identifier());
+        assert(place->is_identifier() || place->is_index());
         assert(value);
     }
 
     bool check(Checker&) override;
     std::string dump(std::size_t indent) const override;
+    void write(AstWriter&) const override;
     bool execute(Interpreter&) const override;
+    void compile(Compiler&) const override;
 
 private:
-    std::shared_ptr<Expr> m_place;
-    std::shared_ptr<Expr> m_value;
+    Expr* m_place;
+    Expr* m_value;
 };
 
 class BlockStmt : public Stmt {
 public:
-    BlockStmt(std::vector<std::shared_ptr<Stmt>>&& stmts, std::string_view text)
+    BlockStmt(std::span<Stmt* const> stmts, std::string_view text)
         : Stmt(text)
-        , m_stmts(std::move(stmts))
+        , m_stmts(stmts)
     {
         for (auto& stmt : stmts)
             assert(stmt);
@@ -369,18 +629,20 @@ public:
 
     bool check(Checker&) override;
     std::string dump(std::size_t indent) const override;
+    void write(AstWriter&) const override;
     bool execute(Interpreter&) const override;
+    void compile(Compiler&) const override;
 
-    const std::vector<std::shared_ptr<Stmt>>& statements() const { return m_stmts;}
+    std::span<Stmt* const> statements() const { return m_stmts;}
 
 private:
-    std::vector<std::shared_ptr<Stmt>> m_stmts;
+    std::span<Stmt* const> m_stmts;
 };
 
 class IfStmt : public Stmt {
 public:
-    IfStmt(std::shared_ptr<Expr> test, std::shared_ptr<Stmt> then_block,
-        std::shared_ptr<Stmt> else_block, std::string_view text)
+    IfStmt(Expr* test, Stmt* then_block,
+        Stmt* else_block, std::string_view text)
         : Stmt(text)
         , m_test(test)
         , m_then_block(then_block)
@@ -393,17 +655,19 @@ public:
 
     bool check(Checker&) override;
     std::string dump(std::size_t indent) const override;
+    void write(AstWriter&) const override;
     bool execute(Interpreter&) const override;
+    void compile(Compiler&) const override;
 
 private:
-    std::shared_ptr<Expr> m_test;
-    std::shared_ptr<Stmt> m_then_block;
-    std::shared_ptr<Stmt> m_else_block;
+    Expr* m_test;
+    Stmt* m_then_block;
+    Stmt* m_else_block;
 };
 
 class WhileStmt : public Stmt {
 public:
-    WhileStmt(std::shared_ptr<Expr> test, std::shared_ptr<Stmt> block,
+    WhileStmt(Expr* test, Stmt* block,
         std::string_view text)
         : Stmt(text)
         , m_test(test)
@@ -415,17 +679,19 @@ public:
 
     bool check(Checker&) override;
     std::string dump(std::size_t indent) const override;
+    void write(AstWriter&) const override;
     bool execute(Interpreter&) const override;
+    void compile(Compiler&) const override;
 
 private:
-    std::shared_ptr<Expr> m_test;
-    std::shared_ptr<Stmt> m_block;
+    Expr* m_test;
+    Stmt* m_block;
 };
 
 class ForStmt : public Stmt {
 public:
-    ForStmt(std::shared_ptr<Identifier> ident, std::shared_ptr<Expr> expr,
-        std::shared_ptr<BlockStmt> block, std::string_view text)
+    ForStmt(Identifier* ident, Expr* expr,
+        BlockStmt* block, std::string_view text)
         : Stmt(text)
         , m_ident(ident)
         , m_expr(expr)
@@ -438,12 +704,19 @@ public:
 
     bool check(Checker&) override;
     std::string dump(std::size_t indent) const override;
+    void write(AstWriter&) const override;
     bool execute(Interpreter&) const override;
+    void compile(Compiler&) const override;
 
 private:
-    std::shared_ptr<Identifier> m_ident;
-    std::shared_ptr<Expr> m_expr;
-    std::shared_ptr<BlockStmt> m_block;
+    bool execute_range(const NumberRange&, Interpreter&) const;
+    // run the block with the loop variable set to next; return false if
+    // the loop must stop, by break or by error
+    bool execute_iteration(const Value& next, Interpreter&) const;
+
+    Identifier* m_ident;
+    Expr* m_expr;
+    BlockStmt* m_block;
 };
 
 class BreakStmt : public Stmt {
@@ -452,7 +725,9 @@ public:
     {}
 
     std::string dump(std::size_t indent) const override;
+    void write(AstWriter&) const override;
     bool execute(Interpreter&) const override;
+    void compile(Compiler&) const override;
 };
 
 class ContinueStmt : public Stmt {
@@ -461,13 +736,15 @@ public:
     {}
 
     std::string dump(std::size_t indent) const override;
+    void write(AstWriter&) const override;
     bool execute(Interpreter&) const override;
+    void compile(Compiler&) const override;
 };
 
 class FunctionDeclaration: public Stmt {
 public:
-    FunctionDeclaration(std::shared_ptr<Identifier> name,
-        std::shared_ptr<FunctionExpr> func, std::string_view text)
+    FunctionDeclaration(Identifier* name,
+        FunctionExpr* func, std::string_view text)
         : Stmt(text)
         , m_name(name)
         , m_func(func)
@@ -478,33 +755,43 @@ public:
 
     bool check(Checker&) override;
     std::string dump(std::size_t indent) const override;
+    void write(AstWriter&) const override;
     bool execute(Interpreter&) const override;
+    void compile(Compiler&) const override;
 
 private:
-    std::shared_ptr<Identifier> m_name;
-    std::shared_ptr<FunctionExpr> m_func;
+    Identifier* m_name;
+    FunctionExpr* m_func;
 };
 
 class ReturnStmt: public Stmt {
 public:
-    ReturnStmt(std::shared_ptr<Expr> expr, std::string_view text)
+    ReturnStmt(Expr* expr, std::string_view text)
         : Stmt(text)
         , m_expr(expr)
     {}
 
     bool check(Checker&) override;
     std::string dump(std::size_t indent) const override;
+    void write(AstWriter&) const override;
     bool execute(Interpreter&) const override;
+    void compile(Compiler&) const override;
 
 private:
-    std::shared_ptr<Expr> m_expr; // can be null
+    Expr* m_expr; // can be null
 };
 
-class Program : public Stmt {
+// Root of a syntax tree and owner of the arena all its nodes live in. It's
+// shared by functions defined in the program, so that they can be called
+// after the program itself finished, e.g. in a repl.
+class Program : public Stmt
+    , public std::enable_shared_from_this<Program> {
 public:
-    Program(std::vector<std::shared_ptr<Stmt>>&& stmts, std::string_view text)
+    Program(std::span<Stmt* const> stmts, std::string_view text,
+        AstArena&& arena)
         : Stmt(text)
-        , m_stmts(std::move(stmts))
+        , m_stmts(stmts)
+        , m_arena(std::move(arena))
     {
         for (auto& stmt : stmts)
             assert(stmt);
@@ -512,10 +799,33 @@ public:
 
     bool check(Checker&) override;
     std::string dump(std::size_t indent) const override;
+    void write(AstWriter&) const override;
     bool execute(Interpreter&) const override;
+    void compile(Compiler&) const override;
+
+    ~Program();
+
+    // number of slots in the frame of program's blocks
+    std::size_t frame_size() const { return m_frame_size; }
+    AstArena& arena() { return m_arena; }
+    // keep constant obj alive for as long as the program, e.g. a string
+    // made from a literal
+    void add_constant(Object* obj);
+    // keep file, that the program's text is in, alive for as long as the
+    // program
+    void set_source_file(std::shared_ptr<const SourceFile> file)
+    {
+        m_source_file = std::move(file);
+    }
 
 private:
-    std::vector<std::shared_ptr<Stmt>> m_stmts;
+    friend class AstReader;
+
+    std::span<Stmt* const> m_stmts;
+    std::size_t m_frame_size { 0 };
+    AstArena m_arena;
+    std::vector<Object*> m_constants;
+    std::shared_ptr<const SourceFile> m_source_file;
 };
 
 }
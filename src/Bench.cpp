@@ -0,0 +1,309 @@
+#include "Bench.h"
+#include "Utils.h"
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iterator>
+#include <variant>
+
+namespace Lox {
+
+// nearest-rank percentile
+static double percentile(std::vector<double> values, double p)
+{
+    assert(!values.empty());
+    std::sort(values.begin(), values.end());
+    auto rank = static_cast<std::size_t>(std::ceil(p * values.size()));
+    return values[std::max<std::size_t>(rank, 1) - 1];
+}
+
+double BenchResult::median_ms() const
+{
+    return percentile(wall_ms, 0.5);
+}
+
+double BenchResult::p95_ms() const
+{
+    return percentile(wall_ms, 0.95);
+}
+
+namespace {
+
+// Just enough of JSON to read back bench reports.
+struct JsonValue {
+    using Array = std::vector<JsonValue>;
+    using Object = std::vector<std::pair<std::string, JsonValue>>;
+
+    std::variant<std::nullptr_t, bool, double, std::string, Array, Object> value;
+
+    const JsonValue* get(std::string_view key) const
+    {
+        if (auto obj = std::get_if<Object>(&value)) {
+            for (auto& [name, val] : *obj) {
+                if (name == key)
+                    return &val;
+            }
+        }
+        return nullptr;
+    }
+};
+
+class JsonReader {
+public:
+    explicit JsonReader(std::string_view text) : m_text(text)
+    {}
+
+    std::optional<JsonValue> read()
+    {
+        auto val = read_value();
+        skip_space();
+        if (!val || m_pos != m_text.size())
+            return {};
+        return val;
+    }
+
+private:
+    void skip_space()
+    {
+        while (m_pos < m_text.size() && std::isspace(m_text[m_pos]))
+            ++m_pos;
+    }
+
+    bool match(char ch)
+    {
+        skip_space();
+        if (m_pos < m_text.size() && m_text[m_pos] == ch) {
+            ++m_pos;
+            return true;
+        }
+        return false;
+    }
+
+    bool match_word(std::string_view word)
+    {
+        if (m_text.substr(m_pos, word.size()) != word)
+            return false;
+        m_pos += word.size();
+        return true;
+    }
+
+    std::optional<std::string> read_string()
+    {
+        if (!match('"'))
+            return {};
+        std::string str;
+        while (m_pos < m_text.size()) {
+            auto ch = m_text[m_pos++];
+            if (ch == '"')
+                return str;
+            if (ch == '\\') {
+                if (m_pos == m_text.size())
+                    return {};
+                ch = m_text[m_pos++];
+                switch (ch) {
+                case 'n':
+                    ch = '\n';
+                    break;
+                case 't':
+                    ch = '\t';
+                    break;
+                case '"':
+                case '\\':
+                case '/':
+                    break;
+                default:
+                    return {}; // bench reports don't need the rest
+                }
+            }
+            str += ch;
+        }
+        return {};
+    }
+
+    std::optional<JsonValue> read_value()
+    {
+        skip_space();
+        if (m_pos == m_text.size())
+            return {};
+        auto ch = m_text[m_pos];
+        if (ch == '{') {
+            ++m_pos;
+            JsonValue::Object obj;
+            if (match('}'))
+                return JsonValue { std::move(obj) };
+            do {
+                auto key = read_string();
+                if (!key || !match(':'))
+                    return {};
+                auto val = read_value();
+                if (!val)
+                    return {};
+                obj.emplace_back(std::move(*key), std::move(*val));
+            } while (match(','));
+            if (!match('}'))
+                return {};
+            return JsonValue { std::move(obj) };
+        } else if (ch == '[') {
+            ++m_pos;
+            JsonValue::Array arr;
+            if (match(']'))
+                return JsonValue { std::move(arr) };
+            do {
+                auto val = read_value();
+                if (!val)
+                    return {};
+                arr.push_back(std::move(*val));
+            } while (match(','));
+            if (!match(']'))
+                return {};
+            return JsonValue { std::move(arr) };
+        } else if (ch == '"') {
+            if (auto str = read_string())
+                return JsonValue { std::move(*str) };
+            return {};
+        } else if (match_word("true"))
+            return JsonValue { true };
+        else if (match_word("false"))
+            return JsonValue { false };
+        else if (match_word("null"))
+            return JsonValue { nullptr };
+
+        auto start = m_text.data() + m_pos;
+        char* end = nullptr;
+        auto num = std::strtod(start, &end);
+        if (end == start)
+            return {};
+        m_pos += end - start;
+        return JsonValue { num };
+    }
+
+    std::string_view m_text;
+    std::size_t m_pos { 0 };
+};
+
+}
+
+std::optional<BenchBaseline> read_bench_baseline(std::istream& in)
+{
+    std::string text(std::istreambuf_iterator<char>(in), {});
+    auto report = JsonReader(text).read();
+    if (!report)
+        return {};
+    auto benchmarks = report->get("benchmarks");
+    if (!benchmarks)
+        return {};
+    auto arr = std::get_if<JsonValue::Array>(&benchmarks->value);
+    if (!arr)
+        return {};
+
+    BenchBaseline baseline;
+    if (auto engine = report->get("engine")) {
+        auto engine_str = std::get_if<std::string>(&engine->value);
+        if (!engine_str)
+            return {};
+        baseline.engine = *engine_str;
+    }
+    for (auto& bench : *arr) {
+        // failed benchmarks have no times
+        if (auto ok = bench.get("ok")) {
+            if (auto ok_bool = std::get_if<bool>(&ok->value); ok_bool && !*ok_bool)
+                continue;
+        }
+        auto name = bench.get("name");
+        auto median = bench.get("median_ms");
+        if (!name || !median)
+            return {};
+        auto name_str = std::get_if<std::string>(&name->value);
+        auto median_num = std::get_if<double>(&median->value);
+        if (!name_str || !median_num)
+            return {};
+        baseline.medians[*name_str] = *median_num;
+    }
+    return baseline;
+}
+
+bool BenchReport::compares_baseline() const
+{
+    return baseline && (baseline->engine.empty() || baseline->engine == engine);
+}
+
+bool BenchReport::is_regression(const BenchResult& result) const
+{
+    if (!compares_baseline() || !result.ok)
+        return false;
+    auto it = baseline->medians.find(result.name);
+    if (it == baseline->medians.end())
+        return false;
+    return result.median_ms() > it->second * (1 + threshold);
+}
+
+void BenchReport::write_json(std::ostream& out) const
+{
+    out << std::fixed << std::setprecision(3);
+    out << "{\n";
+    out << "  \"engine\": \"" << engine << "\",\n";
+    out << "  \"runs\": " << runs << ",\n";
+    out << "  \"benchmarks\": [";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        auto& result = results[i];
+        out << (i > 0 ? "," : "") << "\n    {\n";
+        out << "      \"name\": " << escape(result.name) << ",\n";
+        out << "      \"ok\": " << (result.ok ? "true" : "false");
+        if (result.ok) {
+            out << ",\n";
+            out << "      \"median_ms\": " << result.median_ms() << ",\n";
+            out << "      \"p95_ms\": " << result.p95_ms() << ",\n";
+            out << "      \"peak_rss_kb\": " << result.peak_rss_kb << ",\n";
+            out << "      \"allocated_objects\": " << result.allocated_objects << ",\n";
+            out << "      \"allocated_bytes\": " << result.allocated_bytes;
+            if (compares_baseline()) {
+                auto& medians = baseline->medians;
+                if (auto it = medians.find(result.name); it != medians.end()) {
+                    out << ",\n";
+                    out << "      \"baseline_median_ms\": " << it->second << ",\n";
+                    out << "      \"change\": " <<
+                        result.median_ms() / it->second - 1 << ",\n";
+                    out << "      \"regression\": " <<
+                        (is_regression(result) ? "true" : "false");
+                }
+            }
+        }
+        out << "\n    }";
+    }
+    out << (results.empty() ? "" : "\n  ") << "]\n";
+    out << "}\n";
+}
+
+void BenchReport::write_summary(std::ostream& out) const
+{
+    out << std::fixed << std::setprecision(1);
+    if (baseline && !compares_baseline()) {
+        out << "baseline is of the '" << baseline->engine << "' engine, not '"
+            << engine << "', so it is not compared with\n";
+    }
+    for (auto& result : results) {
+        out << result.name << ": ";
+        if (!result.ok) {
+            out << "FAILED\n";
+            continue;
+        }
+        out << result.median_ms() << " ms";
+        if (compares_baseline()) {
+            auto& medians = baseline->medians;
+            if (auto it = medians.find(result.name); it != medians.end()) {
+                auto change = (result.median_ms() / it->second - 1) * 100;
+                out << " (baseline " << it->second << " ms, " <<
+                    std::showpos << change << std::noshowpos << "%)";
+                if (is_regression(result))
+                    out << " REGRESSION";
+            } else
+                out << " (not in baseline)";
+        }
+        out << '\n';
+    }
+}
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Lox {
+
+// Measurements of one benchmark program over all of its runs.
+struct BenchResult {
+    std::string name;
+    bool ok { true };
+    std::vector<double> wall_ms;
+    // maxima over the runs
+    long peak_rss_kb { 0 };
+    std::size_t allocated_objects { 0 };
+    std::size_t allocated_bytes { 0 };
+
+    double median_ms() const;
+    double p95_ms() const;
+};
+
+// medians of a previous bench report, by benchmark name
+struct BenchBaseline {
+    // empty if the report didn't say
+    std::string engine;
+    std::unordered_map<std::string, double> medians;
+
+    bool operator==(const BenchBaseline&) const = default;
+};
+
+// return empty if input isn't a bench report
+std::optional<BenchBaseline> read_bench_baseline(std::istream&);
+
+struct BenchReport {
+    std::string engine;
+    std::size_t runs { 0 };
+    std::vector<BenchResult> results;
+    const BenchBaseline* baseline { nullptr };
+    // median slower than the baseline's by more than this is a regression
+    double threshold { 0.1 };
+
+    // times of one engine say nothing about another's, so a baseline of
+    // another engine is reported but not compared with
+    bool compares_baseline() const;
+    bool is_regression(const BenchResult&) const;
+    void write_json(std::ostream&) const;
+    // human-readable comparison against the baseline
+    void write_summary(std::ostream&) const;
+};
+
+}
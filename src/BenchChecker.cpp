@@ -0,0 +1,39 @@
+#include "BenchSources.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "Checker.h"
+#include <benchmark/benchmark.h>
+
+static void BM_Check(benchmark::State& state)
+{
+    auto source = synthetic_program(state.range(0));
+    std::size_t nodes = 0;
+    for (auto _ : state) {
+        // checker resolves variables in place, so check a fresh tree each time
+        state.PauseTiming();
+        Lox::Lexer lexer(source);
+        Lox::Parser parser(lexer);
+        auto program = parser.parse();
+        if (lexer.has_errors() || parser.has_errors()) {
+            state.SkipWithError("parser error");
+            break;
+        }
+        nodes = program->arena().object_count();
+        state.ResumeTiming();
+
+        Lox::Checker checker;
+        checker.check(program);
+        if (checker.has_errors())
+            state.SkipWithError("checker error");
+
+        state.PauseTiming();
+        program.reset();
+        state.ResumeTiming();
+    }
+    state.SetBytesProcessed(state.iterations() * source.size());
+    state.counters["nodes"] = benchmark::Counter(
+        state.iterations() * nodes, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_Check)->SYNTHETIC_SIZES;
+
+BENCHMARK_MAIN();
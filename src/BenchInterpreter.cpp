@@ -0,0 +1,47 @@
+#include "BenchSources.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "Checker.h"
+#include "Interpreter.h"
+#include <benchmark/benchmark.h>
+
+static void BM_Interpret(benchmark::State& state, Lox::Interpreter::Engine engine)
+{
+    auto source = synthetic_program(state.range(0));
+    std::size_t nodes = 0;
+    for (auto _ : state) {
+        // interpreter specializes nodes in place, so run a fresh tree each time
+        state.PauseTiming();
+        Lox::Lexer lexer(source);
+        Lox::Parser parser(lexer);
+        auto program = parser.parse();
+        Lox::Checker checker;
+        if (!lexer.has_errors() && !parser.has_errors())
+            checker.check(program);
+        if (lexer.has_errors() || parser.has_errors() || checker.has_errors()) {
+            state.SkipWithError("checker error");
+            break;
+        }
+        nodes = program->arena().object_count();
+        state.ResumeTiming();
+
+        Lox::Interpreter interp;
+        interp.set_engine(engine);
+        interp.interpret(program);
+        if (interp.has_errors())
+            state.SkipWithError("runtime error");
+
+        state.PauseTiming();
+        program.reset();
+        state.ResumeTiming();
+    }
+    state.SetBytesProcessed(state.iterations() * source.size());
+    state.counters["nodes"] = benchmark::Counter(
+        state.iterations() * nodes, benchmark::Counter::kIsRate);
+}
+BENCHMARK_CAPTURE(BM_Interpret, tree, Lox::Interpreter::Engine::Tree)
+    ->SYNTHETIC_SIZES;
+BENCHMARK_CAPTURE(BM_Interpret, vm, Lox::Interpreter::Engine::VM)
+    ->SYNTHETIC_SIZES;
+
+BENCHMARK_MAIN();
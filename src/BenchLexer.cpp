@@ -0,0 +1,23 @@
+#include "BenchSources.h"
+#include "Lexer.h"
+#include <benchmark/benchmark.h>
+
+static void BM_Lex(benchmark::State& state)
+{
+    auto source = synthetic_program(state.range(0));
+    std::size_t tokens = 0;
+    for (auto _ : state) {
+        Lox::Lexer lexer(source);
+        auto result = lexer.lex();
+        if (lexer.has_errors())
+            state.SkipWithError("lexer error");
+        tokens = result.size();
+        benchmark::DoNotOptimize(result.data());
+    }
+    state.SetBytesProcessed(state.iterations() * source.size());
+    state.counters["tokens"] = benchmark::Counter(
+        state.iterations() * tokens, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_Lex)->SYNTHETIC_SIZES;
+
+BENCHMARK_MAIN();
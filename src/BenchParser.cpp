@@ -0,0 +1,40 @@
+#include "BenchSources.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include <benchmark/benchmark.h>
+
+// the parser pulls its tokens from the lexer, so this includes lexing
+static void parse(benchmark::State& state, const std::string& source)
+{
+    std::size_t nodes = 0;
+    for (auto _ : state) {
+        Lox::Lexer lexer(source);
+        Lox::Parser parser(lexer);
+        auto program = parser.parse();
+        if (lexer.has_errors() || parser.has_errors()) {
+            state.SkipWithError("parser error");
+            break;
+        }
+        nodes = program->arena().object_count();
+        state.PauseTiming();
+        program.reset();
+        state.ResumeTiming();
+    }
+    state.SetBytesProcessed(state.iterations() * source.size());
+    state.counters["nodes"] = benchmark::Counter(
+        state.iterations() * nodes, benchmark::Counter::kIsRate);
+}
+
+static void BM_Parse(benchmark::State& state)
+{
+    parse(state, synthetic_program(state.range(0)));
+}
+BENCHMARK(BM_Parse)->SYNTHETIC_SIZES;
+
+static void BM_ParseExpressions(benchmark::State& state)
+{
+    parse(state, synthetic_expressions(state.range(0)));
+}
+BENCHMARK(BM_ParseExpressions)->SYNTHETIC_SIZES;
+
+BENCHMARK_MAIN();
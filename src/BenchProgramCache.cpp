@@ -0,0 +1,63 @@
+#include "BenchSources.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "Checker.h"
+#include "ProgramCache.h"
+#include <benchmark/benchmark.h>
+
+static std::shared_ptr<Lox::Program> check(std::string_view source)
+{
+    Lox::Lexer lexer(source);
+    Lox::Parser parser(lexer);
+    auto program = parser.parse();
+    if (lexer.has_errors() || parser.has_errors())
+        return {};
+    Lox::Checker checker;
+    checker.check(program);
+    if (checker.has_errors())
+        return {};
+    return program;
+}
+
+static void BM_WriteProgram(benchmark::State& state)
+{
+    auto source = synthetic_program(state.range(0));
+    auto program = check(source);
+    if (!program) {
+        state.SkipWithError("checker error");
+        return;
+    }
+    std::size_t size = 0;
+    for (auto _ : state) {
+        auto data = Lox::write_program(*program, source);
+        size = data.size();
+        benchmark::DoNotOptimize(data.data());
+    }
+    state.SetBytesProcessed(state.iterations() * source.size());
+    state.counters["cache_bytes"] = size;
+}
+BENCHMARK(BM_WriteProgram)->SYNTHETIC_SIZES;
+
+static void BM_ReadProgram(benchmark::State& state)
+{
+    auto source = synthetic_program(state.range(0));
+    auto program = check(source);
+    if (!program) {
+        state.SkipWithError("checker error");
+        return;
+    }
+    auto data = Lox::write_program(*program, source);
+    program.reset();
+    for (auto _ : state) {
+        auto loaded = Lox::read_program(data, source);
+        if (!loaded)
+            state.SkipWithError("read error");
+        state.PauseTiming();
+        loaded.reset();
+        state.ResumeTiming();
+    }
+    state.SetBytesProcessed(state.iterations() * source.size());
+}
+BENCHMARK(BM_ReadProgram)->SYNTHETIC_SIZES;
+
+BENCHMARK_MAIN();
@@ -0,0 +1,24 @@
+#include "BenchSources.h"
+#include "Lexer.h"
+#include "Utils.h"
+#include <benchmark/benchmark.h>
+
+// maps spans of all tokens to line/column ranges, like reporting an error
+// at every token does
+static void BM_SpanToRange(benchmark::State& state)
+{
+    auto source = synthetic_program(state.range(0));
+    Lox::Lexer lexer(source);
+    auto tokens = lexer.lex();
+    for (auto _ : state) {
+        Lox::SourceMap smap(source);
+        for (auto& token : tokens) {
+            if (!token.text(lexer.table()).empty())
+                benchmark::DoNotOptimize(smap.span_to_range(token.text(lexer.table())));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * tokens.size());
+}
+BENCHMARK(BM_SpanToRange)->SYNTHETIC_SIZES;
+
+BENCHMARK_MAIN();
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+
+// Synthetic programs for microbenchmarks. A program is made of units, each
+// declaring a function and a global that calls it, so every unit exercises
+// the lexer, parser, checker and interpreter in the same proportions, and
+// running time grows linearly with size.
+inline std::string synthetic_program(std::size_t size)
+{
+    std::string source;
+    source.reserve(size + 512);
+    for (std::size_t i = 0; source.size() < size; ++i) {
+        auto n = std::to_string(i);
+        source +=
+            "// unit " + n + "\n"
+            "fn f" + n + "(a, b) {\n"
+            "    var s = \"str\" + \"ing\";\n"
+            "    if a < b and s != \"\" {\n"
+            "        return a * 2 + b;\n"
+            "    } else {\n"
+            "        return a - b / 3;\n"
+            "    }\n"
+            "}\n"
+            "var v" + n + " = f" + n + "(" + n + ", 7.5);\n"
+            "while v" + n + " > 0 {\n"
+            "    v" + n + " = v" + n + " - 1000;\n"
+            "}\n"
+            "{\n"
+            "    var get = fn() { return v" + n + "; };\n"
+            "    for c in \"abc\" {\n"
+            "        v" + n + " = get();\n"
+            "    }\n"
+            "}\n";
+    }
+    return source;
+}
+
+// Expression-dense synthetic programs, mostly operands and operators of
+// all precedence levels.
+inline std::string synthetic_expressions(std::size_t size)
+{
+    std::string source;
+    source.reserve(size + 512);
+    for (std::size_t i = 0; source.size() < size; ++i) {
+        auto n = std::to_string(i);
+        source +=
+            "var e" + n + " = a + b * c - d / " + n + " % e < f and !g or h;\n"
+            "e" + n + " = (-(a + b) * f(c, d - 1, e) >= " + n + ") == true;\n"
+            "print(x or y and z, a * b + c * d, (a + (b + (c + d))));\n";
+    }
+    return source;
+}
+
+// sizes from 1KB to 100MB
+#define SYNTHETIC_SIZES RangeMultiplier(10)->Range(1 << 10, 100 << 20)
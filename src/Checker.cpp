@@ -1,8 +1,26 @@
 #include "Checker.h"
+#include "Interpreter.h"
+#include <algorithm>
 #include <cassert>
 
 namespace Lox {
 
+class FunctionPusher {
+public:
+    FunctionPusher(Checker& checker) : m_checker(checker)
+    {
+        m_checker.push_function();
+    }
+
+    ~FunctionPusher()
+    {
+        m_checker.pop_function();
+    }
+
+private:
+    Checker& m_checker;
+};
+
 class ScopePusher {
 public:
     ScopePusher(Checker& checker) : m_checker(checker)
@@ -19,7 +37,7 @@ private:
     Checker& m_checker;
 };
 
-static bool check_statements(const std::vector<std::shared_ptr<Stmt>>& stmts,
+static bool check_statements(std::span<Stmt* const> stmts,
     Checker& checker)
 {
     for (auto& stmt : stmts) {
@@ -31,13 +49,60 @@ static bool check_statements(const std::vector<std::shared_ptr<Stmt>>& stmts,
 
 bool Identifier::check(Checker& checker)
 {
-    m_hops = checker.hops_to_name(m_name);
+    checker.resolve(*this);
+    return true;
+}
+
+void Identifier::declare(Checker& checker)
+{
+    checker.declare(*this);
+}
+
+Value Expr::constant() const
+{
+    return {};
+}
+
+bool StringLiteral::check(Checker& checker)
+{
+    m_constant = checker.add_constant(make_string(m_value));
     return true;
 }
 
+Value StringLiteral::constant() const
+{
+    return m_constant ? *m_constant : Value();
+}
+
+Value NumberLiteral::constant() const
+{
+    return make_number(m_value);
+}
+
+Value BoolLiteral::constant() const
+{
+    return make_bool(m_value);
+}
+
+Value NilLiteral::constant() const
+{
+    return make_nil();
+}
+
 bool UnaryExpr::check(Checker& checker)
 {
-    return m_expr->check(checker);
+    if (!m_expr->check(checker))
+        return false;
+    if (auto operand = m_expr->constant()) {
+        if (auto val = fold_unary_op(m_op, operand))
+            m_constant = checker.add_constant(val);
+    }
+    return true;
+}
+
+Value UnaryExpr::constant() const
+{
+    return m_constant ? *m_constant : Value();
 }
 
 bool GroupExpr::check(Checker& checker)
@@ -45,14 +110,50 @@ bool GroupExpr::check(Checker& checker)
     return m_expr->check(checker);
 }
 
+Value GroupExpr::constant() const
+{
+    return m_expr->constant();
+}
+
 bool BinaryExpr::check(Checker& checker)
 {
-    return m_left->check(checker) && m_right->check(checker);
+    if (!m_left->check(checker) || !m_right->check(checker))
+        return false;
+    auto left = m_left->constant();
+    auto right = m_right->constant();
+    if (left && right) {
+        if (auto val = fold_binary_op(m_op, left, right))
+            m_constant = checker.add_constant(val);
+    }
+    return true;
+}
+
+Value BinaryExpr::constant() const
+{
+    return m_constant ? *m_constant : Value();
 }
 
 bool LogicalExpr::check(Checker& checker)
 {
-    return m_left->check(checker) && m_right->check(checker);
+    if (!m_left->check(checker) || !m_right->check(checker))
+        return false;
+    auto left = m_left->constant();
+    if (!left || !left.is_bool())
+        return true;
+    if (left.get_bool() == (m_op == LogicalOp::Or)) {
+        // right operand is never evaluated
+        m_constant = checker.add_constant(left);
+        return true;
+    }
+    auto right = m_right->constant();
+    if (right && right.is_bool())
+        m_constant = checker.add_constant(right);
+    return true;
+}
+
+Value LogicalExpr::constant() const
+{
+    return m_constant ? *m_constant : Value();
 }
 
 bool CallExpr::check(Checker& checker)
@@ -66,12 +167,39 @@ bool CallExpr::check(Checker& checker)
     return true;
 }
 
+bool ListExpr::check(Checker& checker)
+{
+    for (auto& item : m_items) {
+        if (!item->check(checker))
+            return false;
+    }
+    return true;
+}
+
+bool MapExpr::check(Checker& checker)
+{
+    for (auto& expr : m_entries) {
+        if (!expr->check(checker))
+            return false;
+    }
+    return true;
+}
+
+bool IndexExpr::check(Checker& checker)
+{
+    return m_object->check(checker) && m_index->check(checker);
+}
+
 bool FunctionExpr::check(Checker& checker)
 {
+    FunctionPusher new_function(checker);
     ScopePusher new_scope(checker);
     for (auto& param : m_params)
-        checker.declare(param->name());
-    return check_statements(m_block->statements(), checker);
+        param->declare(checker);
+    auto res = check_statements(m_block->statements(), checker);
+    m_frame_size = checker.frame_size();
+    m_captures = checker.arena().copy(std::span(checker.captures()));
+    return res;
 }
 
 bool ExpressionStmt::check(Checker& checker)
@@ -88,7 +216,7 @@ bool VarStmt::check(Checker& checker)
 {
     if (m_init && !m_init->check(checker))
         return false;
-    checker.declare(m_ident->name());
+    m_ident->declare(checker);
     return true;
 }
 
@@ -126,13 +254,16 @@ bool ForStmt::check(Checker& checker)
     if (!m_expr->check(checker))
         return false;
     ScopePusher new_scope(checker);
-    checker.declare(m_ident->name());
+    // the VM keeps the iterator, or range, and the count of steps taken
+    // over a range in the slots below the loop variable
+    checker.reserve_slots(2);
+    m_ident->declare(checker);
     return check_statements(m_block->statements(), checker);
 }
 
 bool FunctionDeclaration::check(Checker& checker)
 {
-    checker.declare(m_name->name()); 
+    m_name->declare(checker);
     return m_func->check(checker);
 }
 
@@ -145,36 +276,150 @@ bool ReturnStmt::check(Checker& checker)
 
 bool Program::check(Checker& checker)
 {
+    FunctionPusher new_function(checker);
     ScopePusher new_scope(checker);
-    return check_statements(m_stmts, checker);
+    auto res = check_statements(m_stmts, checker);
+    m_frame_size = checker.frame_size();
+    return res;
+}
+
+void Checker::push_function()
+{
+    m_functions.emplace_back();
+}
+
+void Checker::pop_function()
+{
+    assert(m_functions.size());
+    assert(m_functions.back().scopes.empty());
+    m_functions.pop_back();
+}
+
+std::size_t Checker::frame_size() const
+{
+    assert(m_functions.size());
+    return m_functions.back().frame_size;
+}
+
+const std::vector<Capture>& Checker::captures() const
+{
+    assert(m_functions.size());
+    return m_functions.back().captures;
 }
 
 void Checker::push_scope()
 {
-    m_scope_stack.emplace_front();
+    assert(m_functions.size());
+    m_functions.back().scopes.emplace_back();
+    ++m_scope_count;
 }
 
 void Checker::pop_scope()
 {
-    assert(m_scope_stack.size());
-    m_scope_stack.pop_front();
+    assert(m_functions.size());
+    auto& func = m_functions.back();
+    assert(func.scopes.size());
+    if (!is_program_scope()) {
+        auto& scope = func.scopes.back();
+        for (auto& [_, var] : scope.vars) {
+            if (var.captured) {
+                for (auto ident : var.refs)
+                    ident->m_var.kind = VarKind::BoxedLocal;
+            }
+        }
+        // slots of a finished scope are reused by the scopes that follow
+        func.used_slots -= scope.vars.size() + scope.hidden_slots;
+    }
+    func.scopes.pop_back();
+}
+
+void Checker::reserve_slots(std::size_t count)
+{
+    assert(m_functions.size());
+    auto& func = m_functions.back();
+    assert(func.scopes.size());
+    assert(!is_program_scope());
+    func.scopes.back().hidden_slots += count;
+    func.used_slots += count;
+    func.frame_size = std::max(func.frame_size, func.used_slots);
 }
 
-void Checker::declare(std::string_view name)
+bool Checker::is_program_scope() const
 {
-    assert(m_scope_stack.size());
-    m_scope_stack.front()[name] = true;
+    return m_functions.size() == 1 && m_functions.back().scopes.size() == 1;
 }
 
-std::optional<std::size_t> Checker::hops_to_name(std::string_view name)
+void Checker::declare(Identifier& ident)
 {
-    std::size_t hops = 0;
-    for (auto& scope : m_scope_stack) {
-        if (scope.contains(name))
-            return { hops };
-        ++hops;
+    assert(m_functions.size());
+    auto& func = m_functions.back();
+    assert(func.scopes.size());
+    auto [it, inserted] = func.scopes.back().vars.try_emplace(ident.name());
+    if (is_program_scope()) {
+        ident.m_var = {};
+        return;
     }
-    return {};
+    auto& var = it->second;
+    if (inserted) {
+        var.slot = func.used_slots++;
+        func.frame_size = std::max(func.frame_size, func.used_slots);
+    }
+    ident.m_var = { VarKind::Local, var.slot, inserted };
+    var.refs.push_back(&ident);
+}
+
+void Checker::resolve(Identifier& ident)
+{
+    for (auto f = m_functions.size(); f-- > 0;) {
+        auto& scopes = m_functions[f].scopes;
+        for (auto s = scopes.size(); s-- > 0;) {
+            auto it = scopes[s].vars.find(ident.name());
+            if (it == scopes[s].vars.end())
+                continue;
+            // variables of the program's scope are globals; those are
+            // looked up by name, b/c they can also be defined by other
+            // programs, e.g. in a repl, or by the prelude
+            if (f == 0 && s == 0) {
+                ident.m_var = {};
+                return;
+            }
+            auto& var = it->second;
+            if (f + 1 == m_functions.size()) {
+                ident.m_var = { VarKind::Local, var.slot };
+                var.refs.push_back(&ident);
+                return;
+            }
+            // variable of an enclosing function: box it and capture the
+            // box by every function in between
+            var.captured = true;
+            auto index = add_capture(m_functions[f + 1], true, var.slot);
+            for (auto g = f + 2; g < m_functions.size(); ++g)
+                index = add_capture(m_functions[g], false, index);
+            ident.m_var = { VarKind::Captured, index };
+            return;
+        }
+    }
+    ident.m_var = {};
+}
+
+std::uint32_t Checker::add_capture(Function& func, bool is_local,
+    std::uint32_t index)
+{
+    auto& captures = func.captures;
+    for (std::size_t i = 0; i < captures.size(); ++i) {
+        if (captures[i].is_local == is_local && captures[i].index == index)
+            return i;
+    }
+    captures.push_back({ is_local, index });
+    return captures.size() - 1;
+}
+
+const Value* Checker::add_constant(const Value& value)
+{
+    assert(m_program);
+    if (value.is_object())
+        m_program->add_constant(&value.get_object());
+    return arena().make<Value>(value);
 }
 
 void Checker::error(std::string msg, std::string_view span)
@@ -186,6 +431,8 @@ void Checker::check(const std::shared_ptr<Program>& program)
 {
     assert(program);
     TemporaryChange<std::string_view> new_source(m_source, program->text());
+    TemporaryChange<AstArena*> new_arena(m_arena, &program->arena());
+    TemporaryChange<Program*> new_program(m_program, program.get());
     program->check(*this);
 }
 
@@ -2,7 +2,6 @@
 
 #include "AST.h"
 #include "Utils.h"
-#include <list>
 #include <unordered_map>
 
 namespace Lox {
@@ -12,18 +11,70 @@ public:
     void check(const std::shared_ptr<Program>& program);
 
     void error(std::string msg, std::string_view span);
+    // arena of the program being checked
+    AstArena& arena()
+    {
+        assert(m_arena);
+        return *m_arena;
+    }
+    // keep value for the lifetime of the checked program, return pointer to
+    // store in its syntax tree
+    const Value* add_constant(const Value& value);
     bool has_errors() const { return m_errors.size() > 0; }
     const std::vector<Error>& errors() const { return m_errors; }
 
+    // locals of a function and of its nested blocks share the function's
+    // frame; the program's blocks share the program's frame
+    void push_function();
+    void pop_function();
+    // number of slots in the current function's frame
+    std::size_t frame_size() const;
+    // boxes captured by the current function
+    const std::vector<Capture>& captures() const;
+
     void push_scope();
     void pop_scope();
-    void declare(std::string_view name);
-    std::optional<std::size_t> hops_to_name(std::string_view name);
+    // number of scopes pushed over the checker's lifetime
+    std::size_t scope_count() const { return m_scope_count; }
+    // declare variable in the current scope; program-level variables are
+    // globals and get no slot, redeclaration reuses the variable's slot
+    void declare(Identifier&);
+    void resolve(Identifier&);
+    // reserve slots in the current scope for values no identifier refers to
+    void reserve_slots(std::size_t count);
 
 private:
+    struct Variable {
+        std::uint32_t slot { 0 };
+        bool captured { false };
+        // identifiers resolved to the variable in its own function, which
+        // are boxed if a nested function captures it
+        std::vector<Identifier*> refs;
+    };
+
+    struct Scope {
+        // maps variable names to variables
+        std::unordered_map<std::string_view, Variable> vars;
+        std::size_t hidden_slots { 0 };
+    };
+
+    struct Function {
+        // innermost scope last
+        std::vector<Scope> scopes;
+        std::size_t used_slots { 0 };
+        std::size_t frame_size { 0 };
+        std::vector<Capture> captures;
+    };
+
+    bool is_program_scope() const;
+    std::uint32_t add_capture(Function&, bool is_local, std::uint32_t index);
+
     std::vector<Error> m_errors;
-    std::list<std::unordered_map<std::string_view, bool>> m_scope_stack;
+    std::vector<Function> m_functions;
+    Program* m_program { nullptr };
+    std::size_t m_scope_count { 0 };
     std::string_view m_source;
+    AstArena* m_arena { nullptr };
 };
 
 }
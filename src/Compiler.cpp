@@ -0,0 +1,780 @@
+#include "Compiler.h"
+#include <cassert>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <format>
+
+namespace Lox {
+
+static constexpr std::size_t MAX_U16 = std::numeric_limits<std::uint16_t>::max();
+static constexpr std::size_t MAX_U32 = std::numeric_limits<std::uint32_t>::max();
+
+std::string_view Chunk::span_at(std::size_t offset) const
+{
+    auto it = std::lower_bound(spans.begin(), spans.end(), offset,
+        [](auto& pair, std::size_t offset) { return pair.first < offset; });
+    assert(it != spans.end());
+    assert(it->first == offset);
+    return it->second;
+}
+
+class ScopeBeginner {
+public:
+    ScopeBeginner(Compiler& compiler) : m_compiler(compiler)
+    {
+        m_compiler.begin_scope();
+    }
+
+    ~ScopeBeginner()
+    {
+        m_compiler.end_scope();
+    }
+
+private:
+    Compiler& m_compiler;
+};
+
+static void compile_statements(std::span<Stmt* const> stmts,
+    Compiler& compiler)
+{
+    for (auto& stmt : stmts)
+        stmt->compile(compiler);
+}
+
+// emit value of an expression folded by the checker, if it was
+static bool compile_constant(const Expr& expr, Compiler& compiler)
+{
+    auto val = expr.constant();
+    if (!val)
+        return false;
+    if (val.is_bool())
+        compiler.emit(val.get_bool() ? OpCode::True : OpCode::False);
+    else if (val.is_niltype())
+        compiler.emit(OpCode::Nil);
+    else
+        compiler.emit_constant(val);
+    return true;
+}
+
+void StringLiteral::compile(Compiler& compiler) const
+{
+    if (!compile_constant(*this, compiler))
+        compiler.emit_constant(make_string(m_value));
+}
+
+void NumberLiteral::compile(Compiler& compiler) const
+{
+    compiler.emit_constant(make_number(m_value));
+}
+
+void Identifier::compile(Compiler& compiler) const
+{
+    compiler.load_variable(*this);
+}
+
+void BoolLiteral::compile(Compiler& compiler) const
+{
+    compiler.emit(m_value ? OpCode::True : OpCode::False);
+}
+
+void NilLiteral::compile(Compiler& compiler) const
+{
+    compiler.emit(OpCode::Nil);
+}
+
+void UnaryExpr::compile(Compiler& compiler) const
+{
+    if (compile_constant(*this, compiler))
+        return;
+    m_expr->compile(compiler);
+    switch (m_op) {
+    case UnaryOp::Minus:
+        compiler.emit(OpCode::Negate, m_text);
+        return;
+    case UnaryOp::Not:
+        compiler.emit(OpCode::Not, m_text);
+        return;
+    }
+    assert(0);
+}
+
+void GroupExpr::compile(Compiler& compiler) const
+{
+    m_expr->compile(compiler);
+}
+
+void BinaryExpr::compile(Compiler& compiler) const
+{
+    if (compile_constant(*this, compiler))
+        return;
+    m_left->compile(compiler);
+    m_right->compile(compiler);
+    auto op = [this]() {
+        switch (m_op) {
+        case BinaryOp::Divide:
+            return OpCode::Divide;
+        case BinaryOp::Multiply:
+            return OpCode::Multiply;
+        case BinaryOp::Modulo:
+            return OpCode::Modulo;
+        case BinaryOp::Add:
+            return OpCode::Add;
+        case BinaryOp::Subtract:
+            return OpCode::Subtract;
+        case BinaryOp::Equal:
+            return OpCode::Equal;
+        case BinaryOp::NotEqual:
+            return OpCode::NotEqual;
+        case BinaryOp::Less:
+            return OpCode::Less;
+        case BinaryOp::LessOrEqual:
+            return OpCode::LessOrEqual;
+        case BinaryOp::Greater:
+            return OpCode::Greater;
+        case BinaryOp::GreaterOrEqual:
+            return OpCode::GreaterOrEqual;
+        }
+        assert(0);
+    }();
+    compiler.emit(op, m_text);
+}
+
+void LogicalExpr::compile(Compiler& compiler) const
+{
+    if (compile_constant(*this, compiler))
+        return;
+    m_left->compile(compiler);
+    auto stack_size = compiler.stack_size();
+    switch (m_op) {
+    case LogicalOp::And: {
+        auto if_false = compiler.emit_jump(OpCode::JumpIfFalse, m_left->text());
+        m_right->compile(compiler);
+        compiler.emit(OpCode::CheckBool, m_right->text());
+        auto end = compiler.emit_jump(OpCode::Jump);
+        compiler.patch_jump(if_false);
+        compiler.set_stack_size(stack_size - 1);
+        compiler.emit(OpCode::False);
+        compiler.patch_jump(end);
+        break;
+    }
+    case LogicalOp::Or: {
+        auto if_false = compiler.emit_jump(OpCode::JumpIfFalse, m_left->text());
+        compiler.emit(OpCode::True);
+        auto end = compiler.emit_jump(OpCode::Jump);
+        compiler.patch_jump(if_false);
+        compiler.set_stack_size(stack_size - 1);
+        m_right->compile(compiler);
+        compiler.emit(OpCode::CheckBool, m_right->text());
+        compiler.patch_jump(end);
+        break;
+    }
+    default:
+        assert(0);
+    }
+}
+
+void CallExpr::compile(Compiler& compiler) const
+{
+    m_callee->compile(compiler);
+    // like the interpreter, check the callee before evaluating the args
+    compiler.emit(OpCode::CheckCallable, m_callee->text());
+    for (auto& arg : m_args)
+        arg->compile(compiler);
+    compiler.emit(OpCode::Call, m_text);
+    compiler.emit_u16(m_args.size(), m_text);
+    compiler.emit_span_index(m_text);
+    compiler.adjust_stack(-static_cast<std::ptrdiff_t>(m_args.size()));
+}
+
+void ListExpr::compile(Compiler& compiler) const
+{
+    for (auto& item : m_items)
+        item->compile(compiler);
+    compiler.emit(OpCode::BuildList);
+    compiler.emit_u32(m_items.size(), m_text);
+    compiler.adjust_stack(1 - static_cast<std::ptrdiff_t>(m_items.size()));
+}
+
+void MapExpr::compile(Compiler& compiler) const
+{
+    for (auto& expr : m_entries)
+        expr->compile(compiler);
+    compiler.emit(OpCode::BuildMap, m_text);
+    compiler.emit_u32(m_entries.size() / 2, m_text);
+    compiler.adjust_stack(1 - static_cast<std::ptrdiff_t>(m_entries.size()));
+}
+
+void IndexExpr::compile(Compiler& compiler) const
+{
+    m_object->compile(compiler);
+    m_index->compile(compiler);
+    compiler.emit(OpCode::GetIndex, m_text);
+}
+
+void FunctionExpr::compile(Compiler& compiler) const
+{
+    compiler.begin_function(m_text);
+    for (auto& param : m_params) {
+        compiler.adjust_stack(1); // args are pushed by the caller
+        compiler.define_variable(*param);
+    }
+    compile_statements(m_block->statements(), compiler);
+    compiler.emit(OpCode::Nil); // implicit return
+    compiler.emit(OpCode::Return);
+    auto proto = compiler.end_function(m_captures);
+    proto->arity = m_params.size();
+    compiler.emit_closure(std::move(proto), m_text);
+}
+
+void ExpressionStmt::compile(Compiler& compiler) const
+{
+    m_expr->compile(compiler);
+    compiler.emit(compiler.is_print_expr_statements_mode() ?
+        OpCode::PrintExpr : OpCode::Pop);
+}
+
+void AssertStmt::compile(Compiler& compiler) const
+{
+    m_expr->compile(compiler);
+    compiler.emit(OpCode::CheckBool, m_expr->text());
+    compiler.emit(OpCode::Assert, m_text);
+}
+
+void VarStmt::compile(Compiler& compiler) const
+{
+    if (m_init)
+        m_init->compile(compiler);
+    else
+        compiler.emit(OpCode::Nil);
+    compiler.define_variable(*m_ident);
+}
+
+void AssignStmt::compile(Compiler& compiler) const
+{
+    m_value->compile(compiler);
+    if (m_place->is_identifier()) {
+        compiler.store_variable(static_cast<Identifier&>(*m_place));
+        return;
+    }
+
+    assert(m_place->is_index());
+    auto& place = static_cast<IndexExpr&>(*m_place);
+    place.object().compile(compiler);
+    place.index().compile(compiler);
+    compiler.emit(OpCode::SetIndex, place.text());
+}
+
+void BlockStmt::compile(Compiler& compiler) const
+{
+    ScopeBeginner new_scope(compiler);
+    compile_statements(m_stmts, compiler);
+}
+
+void IfStmt::compile(Compiler& compiler) const
+{
+    m_test->compile(compiler);
+    auto if_false = compiler.emit_jump(OpCode::JumpIfFalse, m_test->text());
+    m_then_block->compile(compiler);
+    if (!m_else_block) {
+        compiler.patch_jump(if_false);
+        return;
+    }
+    auto end = compiler.emit_jump(OpCode::Jump);
+    compiler.patch_jump(if_false);
+    m_else_block->compile(compiler);
+    compiler.patch_jump(end);
+}
+
+void WhileStmt::compile(Compiler& compiler) const
+{
+    auto start = compiler.code_size();
+    compiler.emit(OpCode::CheckInterrupt);
+    m_test->compile(compiler);
+    auto exit = compiler.emit_jump(OpCode::JumpIfFalse, m_test->text());
+    compiler.begin_loop(start);
+    m_block->compile(compiler);
+    compiler.emit_loop(start);
+    compiler.patch_jump(exit);
+    compiler.end_loop();
+}
+
+void ForStmt::compile(Compiler& compiler) const
+{
+    m_expr->compile(compiler);
+    compiler.emit(OpCode::GetIter, m_expr->text());
+
+    ScopeBeginner iter_scope(compiler);
+    // iterator, or range, and the count of steps taken over a range are
+    // kept in the locals the checker reserved below the loop variable
+    auto iter_slot = compiler.local_count();
+    compiler.declare_hidden_local(m_expr->text());
+    compiler.declare_hidden_local(m_expr->text());
+
+    auto start = compiler.code_size();
+    // a safe point, as iterations may allocate, e.g. lines of a file
+    compiler.emit(OpCode::CheckInterrupt);
+    compiler.emit(OpCode::ForNext, m_expr->text());
+    compiler.emit_u16(iter_slot, m_text);
+    auto exit = compiler.emit_jump_operand();
+    compiler.adjust_stack(1); // next value
+    compiler.begin_loop(start);
+    {
+        ScopeBeginner iteration_scope(compiler);
+        compiler.define_variable(*m_ident);
+        compile_statements(m_block->statements(), compiler);
+    }
+    compiler.emit_loop(start);
+    compiler.patch_jump(exit);
+    compiler.end_loop();
+}
+
+void BreakStmt::compile(Compiler& compiler) const
+{
+    compiler.emit_break();
+}
+
+void ContinueStmt::compile(Compiler& compiler) const
+{
+    compiler.emit_continue();
+}
+
+void FunctionDeclaration::compile(Compiler& compiler) const
+{
+    // like the checker, declare the name before compiling the body, so
+    // that the function can refer to itself
+    if (compiler.reserve_local(*m_name)) {
+        m_func->compile(compiler);
+        compiler.adjust_stack(-1); // closure got pushed into reserved slot
+        return;
+    }
+    m_func->compile(compiler);
+    compiler.define_variable(*m_name);
+}
+
+void ReturnStmt::compile(Compiler& compiler) const
+{
+    if (m_expr)
+        m_expr->compile(compiler);
+    else
+        compiler.emit(OpCode::Nil);
+    compiler.emit(OpCode::Return);
+}
+
+void Program::compile(Compiler& compiler) const
+{
+    for (auto& stmt : m_stmts) {
+        compiler.emit(OpCode::CheckInterrupt);
+        stmt->compile(compiler);
+    }
+    compiler.emit(OpCode::Nil);
+    compiler.emit(OpCode::Return);
+}
+
+void Compiler::error(std::string msg, std::string_view span)
+{
+    m_errors.push_back({ std::move(msg), m_source, span });
+}
+
+std::size_t Compiler::code_size() const
+{
+    return function().proto->chunk.code.size();
+}
+
+void Compiler::update_max_slots()
+{
+    auto& func = function();
+    func.proto->max_slots = std::max(func.proto->max_slots,
+        func.locals + func.temporaries);
+}
+
+void Compiler::adjust_stack(std::ptrdiff_t delta)
+{
+    auto& func = function();
+    assert(delta >= 0 || func.temporaries >= static_cast<std::size_t>(-delta));
+    func.temporaries += delta;
+    update_max_slots();
+}
+
+std::size_t Compiler::stack_size() const
+{
+    return function().temporaries;
+}
+
+void Compiler::set_stack_size(std::size_t size)
+{
+    function().temporaries = size;
+    update_max_slots();
+}
+
+std::size_t Compiler::local_count() const
+{
+    return function().locals;
+}
+
+void Compiler::emit(OpCode op, std::string_view span)
+{
+    auto& chunk = this->chunk();
+    if (!span.empty())
+        chunk.spans.push_back({ chunk.code.size(), span });
+    chunk.code.push_back(static_cast<std::uint8_t>(op));
+
+    switch (op) {
+    case OpCode::Constant:
+    case OpCode::Nil:
+    case OpCode::True:
+    case OpCode::False:
+    case OpCode::GetLocal:
+    case OpCode::GetUpvalue:
+    case OpCode::GetGlobal:
+    case OpCode::Closure:
+    case OpCode::GetIter:
+        adjust_stack(1);
+        break;
+    case OpCode::Pop:
+    case OpCode::SetLocal:
+    case OpCode::SetUpvalue:
+    case OpCode::SetGlobal:
+    case OpCode::DefineGlobal:
+    case OpCode::Divide:
+    case OpCode::Multiply:
+    case OpCode::Modulo:
+    case OpCode::Add:
+    case OpCode::Subtract:
+    case OpCode::Equal:
+    case OpCode::NotEqual:
+    case OpCode::Less:
+    case OpCode::LessOrEqual:
+    case OpCode::Greater:
+    case OpCode::GreaterOrEqual:
+    case OpCode::GetIndex:
+    case OpCode::JumpIfFalse:
+    case OpCode::Return:
+    case OpCode::Assert:
+    case OpCode::PrintExpr:
+        adjust_stack(-1);
+        break;
+    case OpCode::SetIndex:
+        adjust_stack(-3);
+        break;
+    default:
+        // others either leave the stack as is or are adjusted by the caller
+        break;
+    }
+}
+
+void Compiler::emit_u16(std::size_t operand, std::string_view span)
+{
+    if (operand > MAX_U16) {
+        error(std::format("operand exceeds limit of {}", MAX_U16), span);
+        operand = 0;
+    }
+    auto val = static_cast<std::uint16_t>(operand);
+    auto& code = chunk().code;
+    auto size = code.size();
+    code.resize(size + sizeof(val));
+    std::memcpy(code.data() + size, &val, sizeof(val));
+}
+
+void Compiler::emit_u32(std::size_t operand, std::string_view span)
+{
+    if (operand > MAX_U32) {
+        error(std::format("operand exceeds limit of {}", MAX_U32), span);
+        operand = 0;
+    }
+    auto val = static_cast<std::uint32_t>(operand);
+    auto& code = chunk().code;
+    auto size = code.size();
+    code.resize(size + sizeof(val));
+    std::memcpy(code.data() + size, &val, sizeof(val));
+}
+
+void Compiler::emit_span_index(std::string_view span)
+{
+    auto& spans = chunk().spans;
+    assert(spans.size() && spans.back().second == span);
+    emit_u32(spans.size() - 1, span);
+}
+
+void Compiler::emit_constant(Value value)
+{
+    auto& constants = chunk().constants;
+    emit(OpCode::Constant);
+    emit_u32(constants.size(), function().span);
+    constants.push_back(std::move(value));
+}
+
+void Compiler::emit_pops(std::size_t count)
+{
+    if (count > 0) {
+        emit(OpCode::PopN);
+        emit_u16(count, function().span);
+    }
+}
+
+std::size_t Compiler::emit_jump(OpCode op, std::string_view span)
+{
+    emit(op, span);
+    return emit_jump_operand();
+}
+
+std::size_t Compiler::emit_jump_operand()
+{
+    auto offset = code_size();
+    emit_u32(0, {});
+    return offset;
+}
+
+void Compiler::patch_jump(std::size_t operand_offset)
+{
+    auto& code = chunk().code;
+    auto jump_end = operand_offset + sizeof(std::uint32_t);
+    assert(jump_end <= code.size());
+    auto distance = code.size() - jump_end;
+    if (distance > MAX_U32) {
+        error("too much code to jump over", function().span);
+        distance = 0;
+    }
+    auto val = static_cast<std::uint32_t>(distance);
+    std::memcpy(code.data() + operand_offset, &val, sizeof(val));
+}
+
+void Compiler::emit_loop(std::size_t loop_start)
+{
+    emit(OpCode::Loop);
+    auto distance = code_size() + sizeof(std::uint32_t) - loop_start;
+    emit_u32(distance, function().span);
+}
+
+void Compiler::begin_scope()
+{
+    auto& func = function();
+    func.scopes.push_back(func.locals);
+}
+
+void Compiler::end_scope()
+{
+    auto& func = function();
+    assert(!func.scopes.empty());
+    auto count = func.locals - func.scopes.back();
+    func.locals = func.scopes.back();
+    func.scopes.pop_back();
+    emit_pops(count);
+}
+
+// slot 0 of a frame holds the callee, the checker's slots follow it
+static std::size_t frame_slot(std::uint32_t checker_slot)
+{
+    return std::size_t(checker_slot) + 1;
+}
+
+void Compiler::push_local(std::string_view span)
+{
+    auto& func = function();
+    assert(func.temporaries > 0);
+    --func.temporaries;
+    ++func.locals;
+    update_max_slots();
+    if (func.locals > MAX_U16 + 1)
+        error("too many local variables in function", span);
+}
+
+void Compiler::declare_hidden_local(std::string_view span)
+{
+    push_local(span);
+}
+
+void Compiler::define_variable(const Identifier& ident)
+{
+    auto& var = ident.var();
+    switch (var.kind) {
+    case VarKind::Global:
+        emit(OpCode::DefineGlobal);
+        emit_u32(add_name(ident.name()), ident.text());
+        return;
+    case VarKind::Local:
+    case VarKind::BoxedLocal:
+        if (!var.new_box) {
+            // redeclaration reuses the var, as it does in the interpreter
+            emit(OpCode::SetLocal);
+            emit_u16(frame_slot(var.index), ident.text());
+            return;
+        }
+        assert(frame_slot(var.index) == function().locals);
+        push_local(ident.text());
+        return;
+    case VarKind::Captured:
+        break;
+    }
+    assert(0);
+}
+
+bool Compiler::reserve_local(const Identifier& ident)
+{
+    auto& var = ident.var();
+    if (var.kind == VarKind::Global || !var.new_box)
+        return false;
+    auto& func = function();
+    assert(frame_slot(var.index) == func.locals);
+    ++func.locals;
+    update_max_slots();
+    if (func.locals > MAX_U16 + 1)
+        error("too many local variables in function", ident.text());
+    return true;
+}
+
+std::size_t Compiler::add_name(std::string_view name)
+{
+    auto& names = chunk().names;
+    auto [it, inserted] = function().name_indices.try_emplace(name, names.size());
+    if (inserted) {
+        names.push_back(name);
+        chunk().m_cached_globals.emplace_back();
+    }
+    return it->second;
+}
+
+void Compiler::load_variable(const Identifier& ident)
+{
+    auto& var = ident.var();
+    switch (var.kind) {
+    case VarKind::Local:
+    case VarKind::BoxedLocal:
+        emit(OpCode::GetLocal);
+        emit_u16(frame_slot(var.index), ident.text());
+        return;
+    case VarKind::Captured:
+        emit(OpCode::GetUpvalue);
+        emit_u16(var.index, ident.text());
+        return;
+    case VarKind::Global:
+        emit(OpCode::GetGlobal, ident.text());
+        emit_u32(add_name(ident.name()), ident.text());
+        return;
+    }
+    assert(0);
+}
+
+void Compiler::store_variable(const Identifier& ident)
+{
+    auto& var = ident.var();
+    switch (var.kind) {
+    case VarKind::Local:
+    case VarKind::BoxedLocal:
+        emit(OpCode::SetLocal);
+        emit_u16(frame_slot(var.index), ident.text());
+        return;
+    case VarKind::Captured:
+        emit(OpCode::SetUpvalue);
+        emit_u16(var.index, ident.text());
+        return;
+    case VarKind::Global:
+        emit(OpCode::SetGlobal, ident.text());
+        emit_u32(add_name(ident.name()), ident.text());
+        return;
+    }
+    assert(0);
+}
+
+void Compiler::begin_function(std::string_view span)
+{
+    FunctionState func;
+    func.proto = std::make_shared<FunctionProto>();
+    func.proto->program_source = m_source;
+    func.scopes.push_back(1); // params and body share the function's scope
+    func.span = span;
+    m_functions.push_back(std::move(func));
+    update_max_slots();
+}
+
+std::shared_ptr<FunctionProto> Compiler::end_function(
+    std::span<const Capture> captures)
+{
+    assert(m_functions.size() > 1);
+    auto func = std::move(m_functions.back());
+    m_functions.pop_back();
+    auto& upvalues = func.proto->upvalues;
+    upvalues.reserve(captures.size());
+    for (auto& capture : captures) {
+        auto index = capture.is_local ? frame_slot(capture.index) :
+            capture.index;
+        if (index > MAX_U16 || upvalues.size() > MAX_U16) {
+            error("too many captured variables in function", func.span);
+            break;
+        }
+        upvalues.push_back({ capture.is_local,
+            static_cast<std::uint16_t>(index) });
+    }
+    return func.proto;
+}
+
+void Compiler::emit_closure(std::shared_ptr<FunctionProto> proto,
+    std::string_view span)
+{
+    auto& functions = chunk().functions;
+    emit(OpCode::Closure);
+    emit_u32(functions.size(), span);
+    for (auto& upvalue : proto->upvalues) {
+        chunk().code.push_back(upvalue.is_local);
+        emit_u16(upvalue.index, span);
+    }
+    functions.push_back(std::move(proto));
+}
+
+void Compiler::begin_loop(std::size_t start)
+{
+    auto& func = function();
+    func.loops.push_back({ start, func.locals, {} });
+}
+
+void Compiler::end_loop()
+{
+    auto& func = function();
+    assert(!func.loops.empty());
+    for (auto offset : func.loops.back().breaks)
+        patch_jump(offset);
+    func.loops.pop_back();
+}
+
+void Compiler::emit_break()
+{
+    auto& func = function();
+    assert(!func.loops.empty()); // parser checks break is inside loop
+    auto& loop = func.loops.back();
+    assert(func.locals >= loop.first_slot);
+    emit_pops(func.locals - loop.first_slot);
+    loop.breaks.push_back(emit_jump(OpCode::Jump));
+}
+
+void Compiler::emit_continue()
+{
+    auto& func = function();
+    assert(!func.loops.empty()); // parser checks continue is inside loop
+    auto& loop = func.loops.back();
+    assert(func.locals >= loop.first_slot);
+    emit_pops(func.locals - loop.first_slot);
+    emit_loop(loop.start);
+}
+
+std::shared_ptr<const FunctionProto> Compiler::compile(const Program& program,
+    bool print_expr_statements)
+{
+    TemporaryChange<std::string_view> new_source(m_source, program.text());
+    TemporaryChange<bool> new_mode(m_print_expr_statements, print_expr_statements);
+
+    FunctionState script;
+    script.proto = std::make_shared<FunctionProto>();
+    script.proto->program_source = m_source;
+    script.span = program.text();
+    m_functions.push_back(std::move(script)); // slot 0 holds the script's closure
+    update_max_slots();
+
+    program.compile(*this);
+
+    assert(m_functions.size() == 1);
+    auto proto = std::move(m_functions.back().proto);
+    m_functions.pop_back();
+    return proto;
+}
+
+}
@@ -0,0 +1,225 @@
+#pragma once
+
+#include "AST.h"
+#include "Interpreter.h"
+#include "Utils.h"
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <utility>
+
+namespace Lox {
+
+#define FOR_EACH_OPCODE         \
+    __OPCODE(Constant)          \
+    __OPCODE(Nil)               \
+    __OPCODE(True)              \
+    __OPCODE(False)             \
+    __OPCODE(Pop)               \
+    __OPCODE(PopN)              \
+    __OPCODE(GetLocal)          \
+    __OPCODE(SetLocal)          \
+    __OPCODE(GetUpvalue)        \
+    __OPCODE(SetUpvalue)        \
+    __OPCODE(GetGlobal)         \
+    __OPCODE(SetGlobal)         \
+    __OPCODE(DefineGlobal)      \
+    __OPCODE(Negate)            \
+    __OPCODE(Not)               \
+    __OPCODE(Divide)            \
+    __OPCODE(Multiply)          \
+    __OPCODE(Modulo)            \
+    __OPCODE(Add)               \
+    __OPCODE(Subtract)          \
+    __OPCODE(Equal)             \
+    __OPCODE(NotEqual)          \
+    __OPCODE(Less)              \
+    __OPCODE(LessOrEqual)       \
+    __OPCODE(Greater)           \
+    __OPCODE(GreaterOrEqual)    \
+    __OPCODE(CheckBool)         \
+    __OPCODE(Jump)              \
+    __OPCODE(JumpIfFalse)       \
+    __OPCODE(Loop)              \
+    __OPCODE(CheckInterrupt)    \
+    __OPCODE(CheckCallable)     \
+    __OPCODE(Call)              \
+    __OPCODE(Closure)           \
+    __OPCODE(BuildList)         \
+    __OPCODE(BuildMap)          \
+    __OPCODE(GetIndex)          \
+    __OPCODE(SetIndex)          \
+    __OPCODE(Return)            \
+    __OPCODE(GetIter)           \
+    __OPCODE(ForNext)           \
+    __OPCODE(Assert)            \
+    __OPCODE(PrintExpr)
+
+// Operands follow the opcode byte in native byte order: local slots,
+// upvalue indices and argument counts are 16-bit, constant indices, jump
+// offsets and list and map sizes are 32-bit. Jump offsets are relative to the end of the
+// jump instruction; Loop jumps backwards, all others forward. Call is
+// followed by the index of its span in the chunk's spans too, since every
+// call needs its span and searching for it would slow down all calls.
+enum class OpCode : std::uint8_t {
+#define __OPCODE(x) x,
+    FOR_EACH_OPCODE
+#undef __OPCODE
+};
+
+#undef FOR_EACH_OPCODE
+
+struct FunctionProto;
+
+struct Chunk {
+    std::vector<std::uint8_t> code;
+    std::vector<Value> constants;
+    // names of globals
+    std::vector<std::string_view> names;
+    std::vector<std::shared_ptr<const FunctionProto>> functions;
+    // spans of instructions that may fail, sorted by instruction offset
+    std::vector<std::pair<std::size_t, std::string_view>> spans;
+
+    std::string_view span_at(std::size_t offset) const;
+    // find global var by the index of its name, caching its location on
+    // success like Identifier::find_global, so later lookups skip hashing
+    // the name
+    Value* find_global(std::size_t name_index, Scope& globals) const
+    {
+        auto& cached = m_cached_globals[name_index];
+        if (cached.globals != &globals) {
+            auto var = globals.find(names[name_index]);
+            if (!var)
+                return nullptr;
+            cached = { &globals, var };
+        }
+        return cached.value;
+    }
+
+private:
+    friend class Compiler;
+
+    struct CachedGlobal {
+        Scope* globals { nullptr };
+        Value* value { nullptr };
+    };
+    // by name index
+    mutable std::vector<CachedGlobal> m_cached_globals;
+};
+
+struct UpvalueInfo {
+    // true if upvalue captures a local of the immediately enclosing
+    // function, false if it refers to an upvalue of that function
+    bool is_local { false };
+    std::uint16_t index { 0 };
+};
+
+struct FunctionProto {
+    std::size_t arity { 0 };
+    // max number of stack slots used by a call, including callee and args
+    std::size_t max_slots { 0 };
+    Chunk chunk;
+    std::vector<UpvalueInfo> upvalues;
+    // source of the program where function was defined, for error reporting
+    std::string_view program_source;
+};
+
+// Compiles a checked program into bytecode for the VM, which takes
+// variables as the Checker resolved them: locals of functions and blocks
+// live in the stack slots the Checker assigned, shifted by one as slot 0
+// of a frame holds the callee, variables of enclosing functions are the
+// upvalues of the function's captures, and the rest are globals looked up
+// by name. Locals are pushed in the order of their slots, so a scope pops
+// the locals declared since it began.
+class Compiler {
+public:
+    std::shared_ptr<const FunctionProto> compile(const Program& program,
+        bool print_expr_statements);
+
+    void error(std::string msg, std::string_view span);
+    bool has_errors() const { return m_errors.size() > 0; }
+    const std::vector<Error>& errors() const { return m_errors; }
+
+    void emit(OpCode op, std::string_view span = {});
+    void emit_u16(std::size_t operand, std::string_view span);
+    void emit_u32(std::size_t operand, std::string_view span);
+    // index of the span of the last instruction in the chunk's spans
+    void emit_span_index(std::string_view span);
+    void emit_constant(Value value);
+    // pop locals of a scope, closing the upvalues that captured them
+    void emit_pops(std::size_t count);
+    std::size_t emit_jump(OpCode op, std::string_view span = {});
+    std::size_t emit_jump_operand();
+    void patch_jump(std::size_t operand_offset);
+    void emit_loop(std::size_t loop_start);
+    std::size_t code_size() const;
+
+    // the number of temporaries on the stack above locals
+    void adjust_stack(std::ptrdiff_t delta);
+    std::size_t stack_size() const;
+    void set_stack_size(std::size_t size);
+
+    void begin_scope();
+    void end_scope();
+    std::size_t local_count() const;
+    // make the value on top of the stack a local that no identifier
+    // refers to, in the slot the Checker reserved for it
+    void declare_hidden_local(std::string_view span);
+    // define the variable declared by ident as the value on top of the
+    // stack; a redeclaration in the same scope stores into the variable
+    void define_variable(const Identifier& ident);
+    // reserve the local slot of a function that's going to be pushed into
+    // it, so that the function body can capture it; returns false if
+    // the function is going to be a global or stored into an existing var
+    bool reserve_local(const Identifier& ident);
+    void load_variable(const Identifier& ident);
+    void store_variable(const Identifier& ident);
+
+    void begin_function(std::string_view span);
+    std::shared_ptr<FunctionProto> end_function(
+        std::span<const Capture> captures);
+    void emit_closure(std::shared_ptr<FunctionProto> proto,
+        std::string_view span);
+
+    void begin_loop(std::size_t start);
+    void end_loop();
+    void emit_break();
+    void emit_continue();
+
+    bool is_print_expr_statements_mode() const { return m_print_expr_statements; }
+
+private:
+    struct Loop {
+        std::size_t start { 0 };
+        // locals at or above this slot are popped by break and continue
+        std::size_t first_slot { 0 };
+        std::vector<std::size_t> breaks;
+    };
+
+    struct FunctionState {
+        std::shared_ptr<FunctionProto> proto;
+        // the callee and the locals of the scopes being compiled
+        std::size_t locals { 1 };
+        // the number of locals when each scope began, innermost last
+        std::vector<std::size_t> scopes;
+        std::vector<Loop> loops;
+        // indices of chunk's names, so big programs don't search them
+        std::unordered_map<std::string_view, std::size_t> name_indices;
+        std::size_t temporaries { 0 };
+        std::string_view span;
+    };
+
+    FunctionState& function() { return m_functions.back(); }
+    const FunctionState& function() const { return m_functions.back(); }
+    Chunk& chunk() { return function().proto->chunk; }
+    void update_max_slots();
+    void push_local(std::string_view span);
+    std::size_t add_name(std::string_view name);
+
+    std::vector<FunctionState> m_functions;
+    std::vector<Error> m_errors;
+    std::string_view m_source;
+    bool m_print_expr_statements { false };
+};
+
+}
@@ -0,0 +1,124 @@
+#include "Heap.h"
+#include "Interpreter.h"
+#include <algorithm>
+#include <cassert>
+
+namespace Lox {
+
+Heap& heap()
+{
+    // never destroyed, so that objects and interpreters with static storage
+    // duration can still use the heap during program exit
+    static Heap* heap = new Heap;
+    return *heap;
+}
+
+void Heap::add(Object* obj, std::size_t size)
+{
+    assert(obj);
+    assert(!obj->m_next);
+    size += obj->external_size();
+    obj->m_size = size;
+    obj->m_next = m_objects;
+    m_objects = obj;
+    m_bytes += size;
+    ++m_stats.allocated_objects;
+    m_stats.allocated_bytes += size;
+    if (m_count_types)
+        ++m_stats.allocated_by_type[obj->type_name()];
+}
+
+void Heap::grow(Object& obj, std::size_t bytes)
+{
+    obj.m_size += bytes;
+    m_bytes += bytes;
+    m_stats.allocated_bytes += bytes;
+}
+
+void Heap::add_root(Interpreter& interp)
+{
+    m_roots.push_back(&interp);
+}
+
+void Heap::remove_root(Interpreter& interp)
+{
+    auto it = std::find(m_roots.begin(), m_roots.end(), &interp);
+    assert(it != m_roots.end());
+    m_roots.erase(it);
+}
+
+void Heap::pin(Object* obj)
+{
+    assert(obj);
+    ++m_pinned[obj];
+}
+
+void Heap::unpin(Object* obj)
+{
+    auto it = m_pinned.find(obj);
+    assert(it != m_pinned.end());
+    if (--it->second == 0)
+        m_pinned.erase(it);
+}
+
+void Heap::mark(Object* obj)
+{
+    assert(obj);
+    if (obj->m_marked)
+        return;
+    obj->m_marked = true;
+    m_gray.push_back(obj);
+}
+
+void Heap::mark(const Value& value)
+{
+    if (value.is_object())
+        mark(&value.get_object());
+}
+
+void Heap::collect()
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (auto interp : m_roots)
+        interp->trace_roots(*this);
+    for (auto& [obj, _] : m_pinned)
+        mark(obj);
+    // trace iteratively, so that long chains of objects, e.g. scopes,
+    // don't overflow the C++ stack
+    while (!m_gray.empty()) {
+        auto obj = m_gray.back();
+        m_gray.pop_back();
+        obj->trace(*this);
+    }
+    sweep();
+    m_next_collection = std::max(m_bytes * HEAP_GROWTH_FACTOR,
+        MIN_COLLECTION_THRESHOLD);
+
+    auto pause = std::chrono::steady_clock::now() - start;
+    ++m_stats.collections;
+    m_stats.total_pause += pause;
+    m_stats.max_pause = std::max(m_stats.max_pause,
+        std::chrono::duration_cast<std::chrono::nanoseconds>(pause));
+}
+
+void Heap::sweep()
+{
+    std::size_t live_objects = 0;
+    auto link = &m_objects;
+    while (auto obj = *link) {
+        if (obj->m_marked) {
+            obj->m_marked = false;
+            ++live_objects;
+            link = &obj->m_next;
+        } else {
+            *link = obj->m_next;
+            m_bytes -= obj->m_size;
+            delete obj;
+        }
+    }
+    m_stats.live_objects = live_objects;
+    m_stats.live_bytes = m_bytes;
+}
+
+}
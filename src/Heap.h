@@ -0,0 +1,101 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <string_view>
+#include <chrono>
+#include <cstddef>
+#include <utility>
+
+namespace Lox {
+
+class Object;
+class Value;
+class Interpreter;
+
+// Owner of all objects. Objects are freed by a mark-and-sweep collector,
+// whose roots are the registered interpreters. Collection only happens at
+// safe points - places, where every live value is reachable from roots
+// rather than only held in a C++ local.
+class Heap {
+public:
+    struct Stats {
+        std::size_t collections { 0 };
+        std::chrono::nanoseconds total_pause { 0 };
+        std::chrono::nanoseconds max_pause { 0 };
+        // objects and bytes that survived the last collection
+        std::size_t live_objects { 0 };
+        std::size_t live_bytes { 0 };
+        // allocated over the heap's lifetime
+        std::size_t allocated_objects { 0 };
+        std::size_t allocated_bytes { 0 };
+        // allocated objects by type name, if counting types
+        std::map<std::string_view, std::size_t> allocated_by_type;
+    };
+
+    Heap() = default;
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+
+    template<typename T, typename... Args>
+    T* make(Args&&... args)
+    {
+        auto obj = new T(std::forward<Args>(args)...);
+        add(obj, sizeof(T));
+        return obj;
+    }
+
+    // account for memory an object acquired after creation
+    void grow(Object& obj, std::size_t bytes);
+
+    void add_root(Interpreter& interp);
+    void remove_root(Interpreter& interp);
+    // a pinned object is a root until unpinned as many times as pinned,
+    // e.g. a constant referenced from a syntax tree
+    void pin(Object* obj);
+    void unpin(Object* obj);
+
+    // safe point: collect if enough was allocated since the last collection
+    void collect_if_needed()
+    {
+        if (m_bytes >= m_next_collection)
+            collect();
+    }
+    void collect();
+
+    // called by objects' trace methods and roots to mark what they reference
+    void mark(Object* obj);
+    void mark(const Value& value);
+
+    const Stats& stats() const { return m_stats; }
+    // counting allocations by type costs a virtual call per allocation,
+    // so it's off by default
+    void count_types(bool on) { m_count_types = on; }
+
+private:
+    static constexpr std::size_t MIN_COLLECTION_THRESHOLD = 1 << 20;
+    // the heap may grow this many times the live size before next collection
+    static constexpr std::size_t HEAP_GROWTH_FACTOR = 2;
+
+    void add(Object* obj, std::size_t size);
+    void sweep();
+
+    // all objects in an intrusive singly-linked list
+    Object* m_objects { nullptr };
+    // marked objects whose references are not yet marked
+    std::vector<Object*> m_gray;
+    std::vector<Interpreter*> m_roots;
+    // pinned objects and their pin counts
+    std::unordered_map<Object*, std::size_t> m_pinned;
+    // bytes in all objects, live or not
+    std::size_t m_bytes { 0 };
+    std::size_t m_next_collection { MIN_COLLECTION_THRESHOLD };
+    Stats m_stats;
+    bool m_count_types { false };
+};
+
+// heap shared by all interpreters
+Heap& heap();
+
+}
@@ -1,74 +1,308 @@
 #include "Interpreter.h"
+#include "Compiler.h"
+#include "VM.h"
 #include <format>
 #include <iostream>
 #include <cmath>
 
 namespace Lox {
 
-class Iterator {
+class StringIterator : public Iterator {
 public:
-    virtual bool done() const = 0;
-    virtual std::shared_ptr<Object> next() = 0;
+    explicit StringIterator(const String& str)
+        : m_str(const_cast<String*>(&str))
+    {}
+
+    void trace(Heap& heap) const override { heap.mark(m_str); }
+
+    bool done() const override { return m_pos >= str().size(); }
+
+    Value next() override
+    {
+        assert(!done());
+        return make_string(str().get_char(m_pos++));
+    }
+
+private:
+    const String& str() const
+    {
+        return static_cast<const String&>(m_str.get_object());
+    }
+
+    Value m_str;
+    std::size_t m_pos { 0 };
 };
 
-class StringIterator : public Iterator {
+class ListIterator : public Iterator {
 public:
-    explicit StringIterator(std::shared_ptr<const String> str) : m_str(str)
+    explicit ListIterator(const List& list)
+        : m_list(const_cast<List*>(&list))
+    {}
+
+    void trace(Heap& heap) const override { heap.mark(m_list); }
+
+    // the list may be pushed to or popped from while iterated
+    bool done() const override { return m_pos >= list().size(); }
+
+    Value next() override
     {
-        assert(str);
+        assert(!done());
+        return list().at(m_pos++);
     }
 
-    bool done() const override { return m_pos >= m_str->size(); }
+private:
+    List& list() const
+    {
+        return static_cast<List&>(m_list.get_object());
+    }
 
-    std::shared_ptr<Object> next() override
+    Value m_list;
+    std::size_t m_pos { 0 };
+};
+
+// only used where a range is iterated generically; loops count over
+// a range directly
+class RangeIterator : public Iterator {
+public:
+    explicit RangeIterator(const NumberRange& range)
+        : m_range(const_cast<NumberRange*>(&range))
+    {}
+
+    void trace(Heap& heap) const override { heap.mark(m_range); }
+
+    bool done() const override { return range().is_past_end(range().at(m_count)); }
+
+    Value next() override
     {
         assert(!done());
-        return std::make_shared<String>(m_str->get_char(m_pos++));
+        return make_number(range().at(m_count++));
     }
 
 private:
-    std::shared_ptr<const String> m_str;
-    std::size_t m_pos { 0 };
+    const NumberRange& range() const
+    {
+        return static_cast<const NumberRange&>(m_range.get_object());
+    }
+
+    Value m_range;
+    double m_count { 0 };
 };
 
-std::shared_ptr<Iterator> String::__iter__() const
+// shorter strings are concatenated eagerly, as a rope node would
+// cost more than copying them
+static constexpr std::size_t MIN_ROPE_LENGTH = 256;
+
+Value concat_strings(const String& left, const String& right)
+{
+    if (left.size() + right.size() < MIN_ROPE_LENGTH)
+        return make_string(std::string(left.get_string())
+            .append(right.get_string()));
+    return Value(heap().make<String>(left, right));
+}
+
+void String::flatten() const
+{
+    assert(m_left);
+    std::string value;
+    value.reserve(m_length);
+    // ropes built by appending in a loop are deep, so walk the tree
+    // iteratively in order
+    std::vector<const String*> stack { this };
+    while (!stack.empty()) {
+        auto str = stack.back();
+        stack.pop_back();
+        if (str->m_left) {
+            stack.push_back(str->m_right);
+            stack.push_back(str->m_left);
+        } else
+            value.append(str->m_value);
+    }
+    assert(value.size() == m_length);
+    m_value = std::move(value);
+    // children may now be collected
+    m_left = nullptr;
+    m_right = nullptr;
+    heap().grow(const_cast<String&>(*this), m_value.capacity());
+}
+
+void String::trace(Heap& heap) const
+{
+    if (m_left) {
+        heap.mark(const_cast<String*>(m_left));
+        heap.mark(const_cast<String*>(m_right));
+    }
+}
+
+Value String::__iter__() const
+{
+    return Value(heap().make<StringIterator>(*this));
+}
+
+void List::push(const Value& value)
+{
+    auto capacity = m_items.capacity();
+    m_items.push_back(value);
+    if (m_items.capacity() != capacity)
+        heap().grow(*this, (m_items.capacity() - capacity) * sizeof(Value));
+}
+
+Value List::pop()
+{
+    assert(!m_items.empty());
+    auto value = m_items.back();
+    m_items.pop_back();
+    return value;
+}
+
+bool List::__eq__(const Object& rhs) const
+{
+    assert(rhs.tag() == TypeTag::List);
+    auto& list = static_cast<const List&>(rhs);
+    if (&list == this)
+        return true;
+    if (list.size() != size())
+        return false;
+    for (std::size_t i = 0; i < size(); ++i) {
+        auto& left = m_items[i];
+        auto& right = list.m_items[i];
+        // unlike ==, items of different types are just unequal
+        if (left.tag() != right.tag() || !left.__eq__(right))
+            return false;
+    }
+    return true;
+}
+
+std::string List::__str__() const
+{
+    if (m_printing)
+        return "[...]";
+    TemporaryChange<bool> printing(m_printing, true);
+    std::string s = "[";
+    for (std::size_t i = 0; i < m_items.size(); ++i) {
+        if (i > 0)
+            s += ", ";
+        auto& item = m_items[i];
+        s += item.is_string() ? escape(item.__str__()) : item.__str__();
+    }
+    s += ']';
+    return s;
+}
+
+Value List::__iter__() const
+{
+    return Value(heap().make<ListIterator>(*this));
+}
+
+void List::trace(Heap& heap) const
 {
-    return std::make_shared<StringIterator>(shared_from_this());
+    for (auto& item : m_items)
+        heap.mark(item);
 }
 
-std::string Number::__str__() const
+Value Iterator::__iter__() const
 {
-    return number_to_string(m_value);
+    return Value(const_cast<Iterator*>(this));
 }
 
-static bool execute_statements(const std::vector<std::shared_ptr<Stmt>>& stmts,
+bool NumberRange::__eq__(const Object& rhs) const
+{
+    assert(rhs.tag() == TypeTag::Range);
+    auto& range = static_cast<const NumberRange&>(rhs);
+    return m_start == range.m_start && m_stop == range.m_stop
+        && m_step == range.m_step;
+}
+
+std::string NumberRange::__str__() const
+{
+    return std::format("range({}, {}, {})", number_to_string(m_start),
+        number_to_string(m_stop), number_to_string(m_step));
+}
+
+Value NumberRange::__iter__() const
+{
+    return Value(heap().make<RangeIterator>(*this));
+}
+
+std::string_view Value::type_name() const
+{
+    if (is_number())
+        return "Number";
+    else if (is_bool())
+        return "Bool";
+    else if (is_niltype())
+        return "NilType";
+    assert(is_object());
+    return get_object().type_name();
+}
+
+bool Value::__eq__(const Value& rhs) const
+{
+    assert(tag() == rhs.tag());
+    if (is_number())
+        return get_number() == rhs.get_number();
+    else if (is_object())
+        return get_object().__eq__(rhs.get_object());
+    return m_bits == rhs.m_bits; // bool or nil
+}
+
+std::string Value::__str__() const
+{
+    if (is_number())
+        return number_to_string(get_number());
+    else if (is_bool())
+        return get_bool() ? "true" : "false";
+    else if (is_niltype())
+        return "nil";
+    assert(is_object());
+    return get_object().__str__();
+}
+
+Value Value::__iter__() const
+{
+    return get_object().__iter__();
+}
+
+// room left above a frame for temporary roots, e.g. operands and callees,
+// which are pushed without a check; args of calls are checked as pushed
+static constexpr std::size_t STACK_HEADROOM = 256;
+
+static bool execute_statements(std::span<Stmt* const> stmts,
                                Interpreter& interp)
 {
+    auto profiler = interp.profiler();
     for (auto& stmt : stmts) {
+        heap().collect_if_needed();
+        if (profiler)
+            profiler->set_position(stmt->text().data());
         if (!stmt->execute(interp))
             return false;
     }
     return true;
 }
 
-std::shared_ptr<Object> Function::__call__(
-    const std::vector<std::shared_ptr<Object>>& args,
-    Interpreter& interp)
+Value Function::__call__(std::span<const Value> args, Interpreter& interp)
 {
     // in a repl, function could be defined by some previous code chunk,
     // that is different from the one currently executed; temporarily set
     // that chunk's program source as interpreter's current source, so that
     // if error happens, error's source field points to the correct source
     // TemporaryChange object will restore original source on destruction
-    auto source_change = interp.push_source(m_program_source);
+    auto source_change = interp.push_source(m_program->text());
+    auto program_change = interp.push_program(*m_program);
 
     assert(!interp.is_return());
 
-    auto scope_change = interp.new_scope(m_parent_scope);
-    auto& params = m_func->params();
+    if (!interp.has_stack_room(m_func->frame_size(), STACK_HEADROOM)) {
+        interp.error("stack overflow", m_func->text());
+        return {};
+    }
+    Interpreter::FrameChange frame_change(interp, this, m_func->frame_size());
+    Profiler::FramePusher profiler_frame(interp.profiler(), m_func,
+        m_program->text());
+    auto params = m_func->params();
     assert(params.size() == args.size());
     for (std::size_t i = 0; i < args.size(); ++i)
-        interp.define_var(params[i]->name(), args[i]);
+        interp.define_var(*params[i], args[i]);
     auto res = execute_statements(m_func->block().statements(), interp);
 
     if (!res) {
@@ -79,181 +313,437 @@ std::shared_ptr<Object> Function::__call__(
     return make_nil(); // implicit return
 }
 
-std::shared_ptr<Object> StringLiteral::eval(Interpreter&) const
+void Function::trace(Heap& heap) const
+{
+    for (auto& box : m_captures)
+        heap.mark(box);
+}
+
+Value StringLiteral::eval(Interpreter&) const
 {
+    if (m_constant)
+        return *m_constant;
     return make_string(m_value);
 }
 
-std::shared_ptr<Object> NumberLiteral::eval(Interpreter&) const
+Value NumberLiteral::eval(Interpreter&) const
 {
     return make_number(m_value);
 }
 
-std::shared_ptr<Object> Identifier::eval(Interpreter& interp) const
+Value Identifier::eval(Interpreter& interp) const
 {
     return interp.get_var(*this);
 }
 
-std::shared_ptr<Object> BoolLiteral::eval(Interpreter&) const
+Value* Identifier::find_global(Scope& globals) const
+{
+    if (m_cached_globals != &globals) {
+        auto var = globals.find(m_name);
+        if (!var)
+            return nullptr;
+        m_cached_globals = &globals;
+        m_cached_global = var;
+    }
+    return m_cached_global;
+}
+
+Value BoolLiteral::eval(Interpreter&) const
 {
     return make_bool(m_value);
 }
 
-std::shared_ptr<Object> NilLiteral::eval(Interpreter&) const
+Value NilLiteral::eval(Interpreter&) const
 {
     return make_nil();
 }
 
-std::shared_ptr<Object> UnaryExpr::eval(Interpreter& interp) const
+using UnaryOpFunction = Value (*)(const Value&);
+
+static constexpr std::size_t UNARY_OP_COUNT =
+    static_cast<std::size_t>(UnaryOp::Not) + 1;
+
+// Implementations of unary operators indexed by operator and operand's type
+// tag. Null entries mean the operator doesn't apply to the type.
+class UnaryOpTable {
+public:
+    constexpr UnaryOpTable()
+    {
+        set(UnaryOp::Minus, TypeTag::Number, [](const Value& val) {
+            return make_number(-val.get_number());
+        });
+        set(UnaryOp::Not, TypeTag::Bool, [](const Value& val) {
+            return make_bool(!val.get_bool());
+        });
+    }
+
+    constexpr UnaryOpFunction get(UnaryOp op, TypeTag tag) const
+    {
+        return m_funcs[static_cast<std::size_t>(op)][static_cast<std::size_t>(tag)];
+    }
+
+private:
+    constexpr void set(UnaryOp op, TypeTag tag, UnaryOpFunction func)
+    {
+        m_funcs[static_cast<std::size_t>(op)][static_cast<std::size_t>(tag)] = func;
+    }
+
+    UnaryOpFunction m_funcs[UNARY_OP_COUNT][TYPE_TAG_COUNT] {};
+};
+
+static constexpr UnaryOpTable unary_ops;
+
+Value unary_op(UnaryOp op, const Value& obj, Interpreter& interp,
+    std::string_view span)
 {
-    auto obj = m_expr->eval(interp);
-    if (!obj)
-        return {};
+    if (auto func = unary_ops.get(op, obj.tag()))
+        return func(obj);
 
-    switch (m_op) {
+    switch (op) {
     case UnaryOp::Minus:
-        if (!obj->is_number()) {
-            interp.error(std::format("cannot apply unary operator '-' to type '{}'",
-                obj->type_name()), m_text);
-            return {};
-        }
-        return make_number(-obj->get_number());
-
+        interp.error(std::format("cannot apply unary operator '-' to type '{}'",
+            obj.type_name()), span);
+        return {};
     case UnaryOp::Not:
-        if (!obj->is_bool()) {
-            interp.error(std::format("cannot apply unary operator '!' to type '{}'",
-                obj->type_name()), m_text);
-            return {};
-        }
-        return make_bool(!obj->get_bool());
+        interp.error(std::format("cannot apply unary operator '!' to type '{}'",
+            obj.type_name()), span);
+        return {};
     }
     assert(0);
 }
 
-std::shared_ptr<Object> GroupExpr::eval(Interpreter& interp) const
+Value fold_unary_op(UnaryOp op, const Value& obj)
 {
-    return m_expr->eval(interp);
+    if (auto func = unary_ops.get(op, obj.tag()))
+        return func(obj);
+    return {};
 }
 
-std::shared_ptr<Object> BinaryExpr::eval(Interpreter& interp) const
+Value UnaryExpr::eval(Interpreter& interp) const
 {
-    auto left = m_left->eval(interp);
-    if (!left)
-        return {};
-    auto right = m_right->eval(interp);
-    if (!right)
+    if (m_constant)
+        return *m_constant;
+    auto obj = m_expr->eval(interp);
+    if (!obj)
         return {};
+    return unary_op(m_op, obj, interp, m_text);
+}
 
-    switch (m_op) {
+Value GroupExpr::eval(Interpreter& interp) const
+{
+    return m_expr->eval(interp);
+}
+
+using BinaryOpFunction = Value (*)(const Value&, const Value&);
+
+static constexpr std::size_t BINARY_OP_COUNT =
+    static_cast<std::size_t>(BinaryOp::GreaterOrEqual) + 1;
+
+static const String& as_string(const Value& val)
+{
+    return static_cast<const String&>(val.get_object());
+}
+
+// Implementations of binary operators indexed by operator and type tags of
+// the left and right operands. Null entries mean the operator doesn't apply
+// to the types.
+class BinaryOpTable {
+public:
+    constexpr BinaryOpTable()
+    {
+        constexpr auto Number = TypeTag::Number;
+        constexpr auto String = TypeTag::String;
+
+        set(BinaryOp::Divide, Number, Number, [](const Value& l, const Value& r) {
+            return make_number(l.get_number() / r.get_number());
+        });
+        set(BinaryOp::Multiply, Number, Number, [](const Value& l, const Value& r) {
+            return make_number(l.get_number() * r.get_number());
+        });
+        set(BinaryOp::Modulo, Number, Number, [](const Value& l, const Value& r) {
+            return make_number(std::fmod(l.get_number(), r.get_number()));
+        });
+        set(BinaryOp::Add, Number, Number, [](const Value& l, const Value& r) {
+            return make_number(l.get_number() + r.get_number());
+        });
+        set(BinaryOp::Add, String, String, [](const Value& l, const Value& r) {
+            return concat_strings(as_string(l), as_string(r));
+        });
+        set(BinaryOp::Subtract, Number, Number, [](const Value& l, const Value& r) {
+            return make_number(l.get_number() - r.get_number());
+        });
+
+        // values of the same type can always be compared for equality
+        for (std::size_t i = 0; i < TYPE_TAG_COUNT; ++i) {
+            auto tag = static_cast<TypeTag>(i);
+            set(BinaryOp::Equal, tag, tag, [](const Value& l, const Value& r) {
+                return make_bool(l.__eq__(r));
+            });
+            set(BinaryOp::NotEqual, tag, tag, [](const Value& l, const Value& r) {
+                return make_bool(!l.__eq__(r));
+            });
+        }
+        set(BinaryOp::Equal, Number, Number, [](const Value& l, const Value& r) {
+            return make_bool(l.get_number() == r.get_number());
+        });
+        set(BinaryOp::NotEqual, Number, Number, [](const Value& l, const Value& r) {
+            return make_bool(l.get_number() != r.get_number());
+        });
+
+        set(BinaryOp::Less, Number, Number, [](const Value& l, const Value& r) {
+            return make_bool(l.get_number() < r.get_number());
+        });
+        set(BinaryOp::Less, String, String, [](const Value& l, const Value& r) {
+            return make_bool(l.get_string() < r.get_string());
+        });
+        set(BinaryOp::LessOrEqual, Number, Number, [](const Value& l, const Value& r) {
+            return make_bool(l.get_number() <= r.get_number());
+        });
+        set(BinaryOp::LessOrEqual, String, String, [](const Value& l, const Value& r) {
+            return make_bool(l.get_string() <= r.get_string());
+        });
+        set(BinaryOp::Greater, Number, Number, [](const Value& l, const Value& r) {
+            return make_bool(l.get_number() > r.get_number());
+        });
+        set(BinaryOp::Greater, String, String, [](const Value& l, const Value& r) {
+            return make_bool(l.get_string() > r.get_string());
+        });
+        set(BinaryOp::GreaterOrEqual, Number, Number, [](const Value& l, const Value& r) {
+            return make_bool(l.get_number() >= r.get_number());
+        });
+        set(BinaryOp::GreaterOrEqual, String, String, [](const Value& l, const Value& r) {
+            return make_bool(l.get_string() >= r.get_string());
+        });
+    }
+
+    constexpr BinaryOpFunction get(BinaryOp op, TypeTag left, TypeTag right) const
+    {
+        return m_funcs[static_cast<std::size_t>(op)]
+            [static_cast<std::size_t>(left)][static_cast<std::size_t>(right)];
+    }
+
+private:
+    constexpr void set(BinaryOp op, TypeTag left, TypeTag right,
+        BinaryOpFunction func)
+    {
+        m_funcs[static_cast<std::size_t>(op)]
+            [static_cast<std::size_t>(left)][static_cast<std::size_t>(right)] = func;
+    }
+
+    BinaryOpFunction m_funcs[BINARY_OP_COUNT][TYPE_TAG_COUNT][TYPE_TAG_COUNT] {};
+};
+
+static constexpr BinaryOpTable binary_ops;
+
+Value binary_op(BinaryOp op, const Value& left, const Value& right,
+    Interpreter& interp, std::string_view span)
+{
+    if (auto func = binary_ops.get(op, left.tag(), right.tag()))
+        return func(left, right);
+
+    switch (op) {
     case BinaryOp::Divide:
-        if (left->is_number() && right->is_number())
-            return make_number(left->get_number() / right->get_number());
+    case BinaryOp::Modulo:
         interp.error(std::format("cannot divide '{}' by '{}'",
-            left->type_name(), right->type_name()), m_text);
+            left.type_name(), right.type_name()), span);
         return {};
-
     case BinaryOp::Multiply:
-        if (left->is_number() && right->is_number())
-            return make_number(left->get_number() * right->get_number());
         interp.error(std::format("cannot multiply '{}' by '{}'",
-            left->type_name(), right->type_name()), m_text);
-        return {};
-
-    case BinaryOp::Modulo:
-        if (left->is_number() && right->is_number())
-            return make_number(std::fmod(left->get_number(), right->get_number()));
-        interp.error(std::format("cannot divide '{}' by '{}'",
-            left->type_name(), right->type_name()), m_text);
+            left.type_name(), right.type_name()), span);
         return {};
-
     case BinaryOp::Add:
-        if (left->is_number() && right->is_number())
-            return make_number(left->get_number() + right->get_number());
-        else if (left->is_string() && right->is_string())
-            return make_string(std::string(left->get_string())
-                .append(right->get_string()));
         interp.error(std::format("cannot add '{}' to '{}'",
-            left->type_name(), right->type_name()), m_text);
+            left.type_name(), right.type_name()), span);
         return {};
-
     case BinaryOp::Subtract:
-        if (left->is_number() && right->is_number())
-            return make_number(left->get_number() - right->get_number());
         interp.error(std::format("cannot subtract '{}' from '{}'",
-            right->type_name(), left->type_name()), m_text);
+            right.type_name(), left.type_name()), span);
         return {};
-
     case BinaryOp::Equal:
-        if (left->type_name() == right->type_name())
-            return make_bool(left->__eq__(*right));
-        interp.error(std::format("cannot compare '{}' with '{}'",
-            left->type_name(), right->type_name()), m_text);
-        return {};
-
     case BinaryOp::NotEqual:
-        if (left->type_name() == right->type_name())
-            return make_bool(!left->__eq__(*right));
-        interp.error(std::format("cannot compare '{}' with '{}'",
-            left->type_name(), right->type_name()), m_text);
-        return {};
-
     case BinaryOp::Less:
-        if (left->is_number() && right->is_number())
-            return make_bool(left->get_number() < right->get_number());
-        else if (left->is_string() && right->is_string())
-            return make_bool(left->get_string() < right->get_string());
+    case BinaryOp::LessOrEqual:
+    case BinaryOp::Greater:
+    case BinaryOp::GreaterOrEqual:
         interp.error(std::format("cannot compare '{}' with '{}'",
-            left->type_name(), right->type_name()), m_text);
+            left.type_name(), right.type_name()), span);
         return {};
+    };
+    assert(0);
+}
 
-    case BinaryOp::LessOrEqual:
-        if (left->is_number() && right->is_number())
-            return make_bool(left->get_number() <= right->get_number());
-        else if (left->is_string() && right->is_string())
-            return make_bool(left->get_string() <= right->get_string());
-        interp.error(std::format("cannot compare '{}' with '{}'",
-            left->type_name(), right->type_name()), m_text);
+Value fold_binary_op(BinaryOp op, const Value& left, const Value& right)
+{
+    if (auto func = binary_ops.get(op, left.tag(), right.tag()))
+        return func(left, right);
+    return {};
+}
+
+// position in list that index refers to; on error, report it at span
+static std::optional<std::size_t> list_position(const List& list,
+    const Value& index, Interpreter& interp, std::string_view span)
+{
+    if (auto pos = list.position(index))
+        return pos;
+    if (!index.is_number())
+        interp.error(std::format("expected 'Number' index, got '{}'",
+            index.type_name()), span);
+    else if (auto num = index.get_number(); std::trunc(num) != num)
+        interp.error(std::format("index {} is not an integer",
+            index.__str__()), span);
+    else
+        interp.error(std::format("index {} is out of range for list of size {}",
+            index.__str__(), list.size()), span);
+    return {};
+}
+
+static std::string key_to_string(const Value& key)
+{
+    return key.is_string() ? escape(key.__str__()) : key.__str__();
+}
+
+static bool check_hashable(const Value& key, Interpreter& interp,
+    std::string_view span)
+{
+    if (is_hashable(key))
+        return true;
+    interp.error(not_hashable_message(key), span);
+    return false;
+}
+
+Value get_item(const Value& object, const Value& index, Interpreter& interp,
+    std::string_view span)
+{
+    if (object.tag() == TypeTag::Map) {
+        if (!check_hashable(index, interp, span))
+            return {};
+        auto& map = static_cast<Map&>(object.get_object());
+        if (auto val = map.get(index))
+            return val;
+        interp.error(std::format("key {} not found in map",
+            key_to_string(index)), span);
+        return {};
+    }
+    if (object.tag() != TypeTag::List) {
+        interp.error(std::format("'{}' object is not indexable",
+            object.type_name()), span);
         return {};
+    }
+    auto& list = static_cast<List&>(object.get_object());
+    if (auto pos = list_position(list, index, interp, span))
+        return list.at(*pos);
+    return {};
+}
 
-    case BinaryOp::Greater:
-        if (left->is_number() && right->is_number())
-            return make_bool(left->get_number() > right->get_number());
-        else if (left->is_string() && right->is_string())
-            return make_bool(left->get_string() > right->get_string());
-        interp.error(std::format("cannot compare '{}' with '{}'",
-            left->type_name(), right->type_name()), m_text);
+bool set_item(const Value& object, const Value& index, const Value& value,
+    Interpreter& interp, std::string_view span)
+{
+    assert(value);
+    if (object.tag() == TypeTag::Map) {
+        if (!check_hashable(index, interp, span))
+            return false;
+        static_cast<Map&>(object.get_object()).set(index, value);
+        return true;
+    }
+    if (object.tag() != TypeTag::List) {
+        interp.error(std::format("'{}' object is not indexable",
+            object.type_name()), span);
+        return false;
+    }
+    auto& list = static_cast<List&>(object.get_object());
+    if (auto pos = list_position(list, index, interp, span)) {
+        list.at(*pos) = value;
+        return true;
+    }
+    return false;
+}
+
+std::string arity_error(const Callable& callable, std::size_t argc)
+{
+    auto min = callable.arity();
+    auto max = callable.max_arity();
+    if (argc >= min && argc <= max)
         return {};
+    if (min == max)
+        return std::format("expected {} arguments, got {}", min, argc);
+    if (max == Callable::ANY_ARITY)
+        return std::format("expected at least {} arguments, got {}", min, argc);
+    return std::format("expected {} to {} arguments, got {}", min, max, argc);
+}
 
-    case BinaryOp::GreaterOrEqual:
-        if (left->is_number() && right->is_number())
-            return make_bool(left->get_number() >= right->get_number());
-        else if (left->is_string() && right->is_string())
-            return make_bool(left->get_string() >= right->get_string());
-        interp.error(std::format("cannot compare '{}' with '{}'",
-            left->type_name(), right->type_name()), m_text);
+Value make_map(std::span<const Value> entries, Interpreter& interp,
+    std::string_view span)
+{
+    assert(entries.size() % 2 == 0);
+    auto map = heap().make<Map>();
+    for (std::size_t i = 0; i < entries.size(); i += 2) {
+        if (!check_hashable(entries[i], interp, span))
+            return {};
+        map->set(entries[i], entries[i + 1]);
+    }
+    return Value(map);
+}
+
+Value BinaryExpr::eval(Interpreter& interp) const
+{
+    if (m_constant)
+        return *m_constant;
+    auto left = m_left->eval(interp);
+    if (!left)
         return {};
-    };
-    assert(0);
+    Value right;
+    if (left.is_object()) {
+        Interpreter::TempRoots roots(interp);
+        roots.push(left);
+        right = m_right->eval(interp);
+    } else
+        right = m_right->eval(interp);
+    if (!right)
+        return {};
+
+    auto left_tag = left.tag();
+    auto right_tag = right.tag();
+    switch (m_quickening) {
+    case Quickening::Specialized:
+        if (left_tag == m_left_tag && right_tag == m_right_tag)
+            return m_specialized(left, right);
+        m_quickening = Quickening::Generic;
+        break;
+    case Quickening::Unspecialized:
+        if (auto func = binary_ops.get(m_op, left_tag, right_tag)) {
+            m_quickening = Quickening::Specialized;
+            m_left_tag = left_tag;
+            m_right_tag = right_tag;
+            m_specialized = func;
+            return func(left, right);
+        }
+        break;
+    case Quickening::Generic:
+        break;
+    }
+    return binary_op(m_op, left, right, interp, m_text);
 }
 
-std::shared_ptr<Object> LogicalExpr::eval(Interpreter& interp) const
+Value LogicalExpr::eval(Interpreter& interp) const
 {
+    if (m_constant)
+        return *m_constant;
     auto left = m_left->eval(interp);
     if (!left)
         return {};
-    if (!left->is_bool()) {
-        interp.error(std::format("expected 'Bool', got '{}'", left->type_name()),
+    if (!left.is_bool()) {
+        interp.error(std::format("expected 'Bool', got '{}'", left.type_name()),
             m_left->text());
         return {};
     }
 
     switch (m_op) {
     case LogicalOp::And:
-        if (!left->get_bool())
+        if (!left.get_bool())
             return make_bool(false);
         break;
     case LogicalOp::Or:
-        if (left->get_bool())
+        if (left.get_bool())
             return make_bool(true);
         break;
     default:
@@ -263,25 +753,27 @@ std::shared_ptr<Object> LogicalExpr::eval(Interpreter& interp) const
     auto right = m_right->eval(interp);
     if (!right)
         return {};
-    if (!right->is_bool()) {
-        interp.error(std::format("expected 'Bool', got '{}'", right->type_name()),
+    if (!right.is_bool()) {
+        interp.error(std::format("expected 'Bool', got '{}'", right.type_name()),
             m_right->text());
         return {};
     }
-    return make_bool(right->get_bool());
+    return make_bool(right.get_bool());
 }
 
-std::shared_ptr<Object> CallExpr::eval(Interpreter& interp) const
+Value CallExpr::eval(Interpreter& interp) const
 {
     auto callee = m_callee->eval(interp);
     if (!callee)
         return {};
-    if (!callee->is_callable()) {
+    if (!callee.is_callable()) {
         interp.error(std::format("'{}' object is not callable",
-            callee->type_name()), m_callee->text());
+            callee.type_name()), m_callee->text());
         return {};
     }
-    auto& callable = static_cast<Callable&>(*callee);
+    auto& callable = static_cast<Callable&>(callee.get_object());
+    Interpreter::TempRoots roots(interp);
+    roots.push(callee);
 
     // if arity were to be checked before eval'ing the args, then an arity
     // error message with the invalid arguments supplied would look like the
@@ -295,26 +787,94 @@ std::shared_ptr<Object> CallExpr::eval(Interpreter& interp) const
     // so 1) eval args, and only then 2) check arity; python does the same
     // rust shows both errors, but invalid args first, arity error second
 
-    std::vector<std::shared_ptr<Object>> arg_vals; 
+    // args are evaluated onto the stack, so a call doesn't allocate
     for (auto& arg : m_args) {
         auto arg_val = arg->eval(interp);
         if (!arg_val)
             return {};
-        arg_vals.push_back(arg_val);
+        if (!interp.has_stack_room(1)) {
+            interp.error("stack overflow", m_text);
+            return {};
+        }
+        roots.push(arg_val);
     }
 
-    if (callable.arity() != m_args.size()) {
-        interp.error(std::format("expected {} arguments, got {}",
-            callable.arity(), m_args.size()), m_text);
+    if (auto msg = arity_error(callable, m_args.size()); !msg.empty()) {
+        interp.error(std::move(msg), m_text);
+        return {};
+    }
+    interp.count_call();
+    auto call_span = interp.push_call_span(m_text);
+    return callable.__call__(roots.values().subspan(1), interp);
+}
+
+Value ListExpr::eval(Interpreter& interp) const
+{
+    // items are evaluated onto the stack, like args of a call, so that
+    // the list is allocated once at its final size
+    Interpreter::TempRoots roots(interp);
+    for (auto& item : m_items) {
+        auto val = item->eval(interp);
+        if (!val)
+            return {};
+        if (!interp.has_stack_room(1)) {
+            interp.error("stack overflow", m_text);
+            return {};
+        }
+        roots.push(val);
+    }
+    return make_list(roots.values());
+}
+
+Value MapExpr::eval(Interpreter& interp) const
+{
+    // keys and values are rooted on the stack until they're in the map
+    Interpreter::TempRoots roots(interp);
+    for (auto& expr : m_entries) {
+        auto val = expr->eval(interp);
+        if (!val)
+            return {};
+        if (!interp.has_stack_room(1)) {
+            interp.error("stack overflow", m_text);
+            return {};
+        }
+        roots.push(val);
+    }
+    return make_map(roots.values(), interp, m_text);
+}
+
+Value IndexExpr::eval(Interpreter& interp) const
+{
+    auto object = m_object->eval(interp);
+    if (!object)
+        return {};
+    Value index;
+    if (object.is_object()) {
+        Interpreter::TempRoots roots(interp);
+        roots.push(object);
+        index = m_index->eval(interp);
+    } else
+        index = m_index->eval(interp);
+    if (!index)
         return {};
+
+    if (object.tag() == TypeTag::List) {
+        auto& list = static_cast<List&>(object.get_object());
+        if (auto pos = list.position(index))
+            return list.at(*pos);
+    } else if (object.tag() == TypeTag::Map) {
+        if (auto val = static_cast<Map&>(object.get_object()).get(index))
+            return val;
     }
-    return callable.__call__(arg_vals, interp);
+    return get_item(object, index, interp, m_text);
 }
 
-std::shared_ptr<Object> FunctionExpr::eval(Interpreter& interp) const
+Value FunctionExpr::eval(Interpreter& interp) const
 {
-    return std::make_shared<Function>(shared_from_this(), interp.scope_ptr(),
-        interp.source());
+    auto func = heap().make<Function>(interp.program().shared_from_this(), *this);
+    for (auto& capture : m_captures)
+        func->add_capture(interp.capture(capture));
+    return Value(func);
 }
 
 bool AssertStmt::execute(Interpreter& interp) const
@@ -322,12 +882,12 @@ bool AssertStmt::execute(Interpreter& interp) const
     auto val = m_expr->eval(interp);
     if (!val)
         return false;
-    if (!val->is_bool()) {
-        interp.error(std::format("expected 'Bool', got '{}'", val->type_name()),
+    if (!val.is_bool()) {
+        interp.error(std::format("expected 'Bool', got '{}'", val.type_name()),
             m_expr->text());
         return false;
     }
-    if (!val->get_bool()) {
+    if (!val.get_bool()) {
         interp.error("assertion failed", m_text);
         return false;
     }
@@ -337,12 +897,8 @@ bool AssertStmt::execute(Interpreter& interp) const
 bool ExpressionStmt::execute(Interpreter& interp) const
 {
     if (auto val = m_expr->eval(interp)) {
-        if (interp.is_print_expr_statements_mode()) {
-            auto str = val->__str__();
-            if (val->is_string())
-                str = escape(str);
-            std::cout << str << '\n';
-        }
+        if (interp.is_print_expr_statements_mode())
+            interp.echo(val);
         return true;
     }
     return false;
@@ -350,7 +906,7 @@ bool ExpressionStmt::execute(Interpreter& interp) const
 
 bool VarStmt::execute(Interpreter& interp) const
 {
-    std::shared_ptr<Object> val;
+    Value val;
     if (m_init) {
         val = m_init->eval(interp);
         if (!val)
@@ -358,7 +914,7 @@ bool VarStmt::execute(Interpreter& interp) const
     } else
         val = make_nil();
     assert(val);
-    interp.define_var(m_ident->name(), val);
+    interp.define_var(*m_ident, val);
     return true;
 }
 
@@ -372,14 +928,24 @@ bool AssignStmt::execute(Interpreter& interp) const
         auto& ident = static_cast<Identifier&>(*m_place);
         return interp.set_var(ident, val);
     }
-    assert(0);
+
+    assert(m_place->is_index());
+    auto& place = static_cast<IndexExpr&>(*m_place);
+    Interpreter::TempRoots roots(interp);
+    roots.push(val);
+    auto object = place.object().eval(interp);
+    if (!object)
+        return false;
+    roots.push(object);
+    auto index = place.index().eval(interp);
+    if (!index)
+        return false;
+    return set_item(object, index, val, interp, place.text());
 }
 
 bool BlockStmt::execute(Interpreter& interp) const
 {
-    auto scope_change = interp.push_scope();
-    auto res = execute_statements(m_stmts, interp);
-    return res;
+    return execute_statements(m_stmts, interp);
 }
 
 bool IfStmt::execute(Interpreter& interp) const
@@ -387,13 +953,13 @@ bool IfStmt::execute(Interpreter& interp) const
     auto val = m_test->eval(interp);
     if (!val)
         return false;
-    if (!val->is_bool()) {
-        interp.error(std::format("expected 'Bool', got '{}'", val->type_name()),
+    if (!val.is_bool()) {
+        interp.error(std::format("expected 'Bool', got '{}'", val.type_name()),
             m_test->text());
         return false;
     }
 
-    if (val->get_bool())
+    if (val.get_bool())
         return m_then_block->execute(interp);
     if (m_else_block)
         return m_else_block->execute(interp);
@@ -405,16 +971,17 @@ bool WhileStmt::execute(Interpreter& interp) const
     for (;;) {
         if (interp.check_interrupt())
             return false;
+        heap().collect_if_needed();
 
         auto val = m_test->eval(interp);
         if (!val)
             return false;
-        if (!val->is_bool()) {
+        if (!val.is_bool()) {
             interp.error(std::format("expected 'Bool', got '{}'",
-                val->type_name()), m_test->text());
+                val.type_name()), m_test->text());
             return false;
         }
-        if (!val->get_bool())
+        if (!val.get_bool())
             break;
 
         assert(!interp.is_break());
@@ -434,48 +1001,83 @@ bool WhileStmt::execute(Interpreter& interp) const
     return true;
 }
 
+// on leaving a loop early, either by break, which the loop consumes,
+// or by an error, which it passes on
+static bool stop_loop(Interpreter& interp)
+{
+    if (!interp.is_break())
+        return false;
+    interp.set_break(false);
+    return true;
+}
+
 bool ForStmt::execute(Interpreter& interp) const
 {
     auto val = m_expr->eval(interp);
     if (!val)
         return false;
 
-    if (!val->is_iterable()) {
-        interp.error(std::format("'{}' is not iterable", val->type_name()),
+    if (val.tag() == TypeTag::Range)
+        return execute_range(static_cast<const NumberRange&>(val.get_object()), interp);
+
+    if (!val.is_iterable()) {
+        interp.error(std::format("'{}' is not iterable", val.type_name()),
                      m_expr->text());
         return false;
     }
 
-    auto iter = val->__iter__();
-    assert(iter);
+    auto iter_val = val.__iter__();
+    assert(iter_val);
+    auto& iter = static_cast<Iterator&>(iter_val.get_object());
+    Interpreter::TempRoots roots(interp);
+    roots.push(iter_val);
 
-    while (!iter->done()) {
-        auto next = iter->next();
-        if (!next)
+    while (!iter.done()) {
+        if (interp.check_interrupt())
             return false;
+        auto next = iter.next();
+        if (!next) {
+            interp.error(iter.error(), m_expr->text());
+            return false;
+        }
+        if (!execute_iteration(next, interp))
+            return stop_loop(interp);
+    }
+    return true;
+}
 
-        assert(!interp.is_break());
-        assert(!interp.is_continue());
-
-        auto scope_change = interp.push_scope();
-        interp.define_var(m_ident->name(), next);
-        auto res = execute_statements(m_block->statements(), interp);
+bool ForStmt::execute_range(const NumberRange& range, Interpreter& interp) const
+{
+    Interpreter::TempRoots roots(interp);
+    roots.push(Value(const_cast<NumberRange*>(&range)));
 
-        if (!res) {
-            if (interp.is_break()) {
-                interp.set_break(false);
-                break;
-            }
-            if (interp.is_continue()) {
-                interp.set_continue(false);
-                continue;
-            }
+    for (double count = 0;; ++count) {
+        auto num = range.at(count);
+        if (range.is_past_end(num))
+            break;
+        if (interp.check_interrupt())
             return false;
-        }
+        if (!execute_iteration(make_number(num), interp))
+            return stop_loop(interp);
     }
     return true;
 }
 
+bool ForStmt::execute_iteration(const Value& next, Interpreter& interp) const
+{
+    assert(!interp.is_break());
+    assert(!interp.is_continue());
+
+    interp.define_var(*m_ident, next);
+    if (execute_statements(m_block->statements(), interp))
+        return true;
+    if (interp.is_continue()) {
+        interp.set_continue(false);
+        return true;
+    }
+    return false;
+}
+
 bool BreakStmt::execute(Interpreter& interp) const
 {
     interp.set_break(true);
@@ -490,16 +1092,24 @@ bool ContinueStmt::execute(Interpreter& interp) const
 
 bool FunctionDeclaration::execute(Interpreter& interp) const
 {
+    // a local function that captures itself needs its box before creation
+    auto& var = m_name->var();
+    if (var.kind == VarKind::BoxedLocal && var.new_box) {
+        interp.define_var(*m_name, make_nil());
+        auto func = m_func->eval(interp);
+        assert(func);
+        return interp.set_var(*m_name, func);
+    }
     auto func = m_func->eval(interp);
     if (!func)
         return false;
-    interp.define_var(m_name->name(), func);
+    interp.define_var(*m_name, func);
     return true;
 }
 
 bool ReturnStmt::execute(Interpreter& interp) const
 {
-    std::shared_ptr<Object> val;
+    Value val;
     if (m_expr) {
         val = m_expr->eval(interp);
         if (!val)
@@ -514,67 +1124,55 @@ bool ReturnStmt::execute(Interpreter& interp) const
 
 bool Program::execute(Interpreter& interp) const
 {
+    auto profiler = interp.profiler();
     for (auto& stmt : m_stmts) {
         if (interp.check_interrupt())
             return false;
+        heap().collect_if_needed();
+        if (profiler)
+            profiler->set_position(stmt->text().data());
         if (!stmt->execute(interp))
             return false;
     }
     return true;
 }
 
-void Scope::define(std::string_view name, const std::shared_ptr<Object>& value)
+void Scope::trace(Heap& heap) const
 {
-    assert(!name.empty());
-    assert(value);
-    m_vars[name] = value;
+    for (auto& [_, val] : m_vars)
+        heap.mark(val);
 }
 
-const std::shared_ptr<Object>& Scope::find_resolved(std::string_view name,
-    std::size_t hops) const
+void Scope::define(std::string_view name, const Value& value)
 {
     assert(!name.empty());
-    auto scope = this;
-    for (; hops > 0 && scope != nullptr; --hops)
-        scope = scope->m_parent.get();
-    assert(scope != nullptr);
-
-    auto pair = scope->m_vars.find(name);
-    assert(pair != scope->m_vars.end());
-    return pair->second;
+    assert(value);
+    m_vars[name] = value;
 }
 
-// here var was resolved by checker and must exist
-std::shared_ptr<Object> Scope::get_resolved(std::string_view name,
-    std::size_t hops) const
+Value* Scope::find(std::string_view name)
 {
-    return find_resolved(name, hops);
+    assert(!name.empty());
+    if (auto pair = m_vars.find(name); pair != m_vars.end())
+        return &pair->second;
+    return nullptr;
 }
 
-// here var is a global, that couldn't be resolved by checker, either b/c
-// it's defined after the function that uses it or it's just error
-std::shared_ptr<Object> Scope::get_unresolved(std::string_view name) const
+// here var is a global: it's either defined at the program level or it
+// couldn't be resolved by checker, b/c it's defined after the function
+// that uses it, by another program or it's just error
+Value Scope::get_unresolved(std::string_view name) const
 {
     assert(!name.empty());
-    assert(is_global());
     if (auto pair = m_vars.find(name); pair != m_vars.end())
         return pair->second;
     return {};
 }
 
-void Scope::set_resolved(std::string_view name, std::size_t hops,
-    const std::shared_ptr<Object>& value)
-{
-    assert(value);
-    // since this method is non-const, casting away constness is fine
-    const_cast<std::shared_ptr<Object>&>(find_resolved(name, hops)) = value;
-}
-
-bool Scope::set_unresolved(std::string_view name, const std::shared_ptr<Object>& value)
+bool Scope::set_unresolved(std::string_view name, const Value& value)
 {
     assert(!name.empty());
     assert(value);
-    assert(is_global());
     if (auto pair = m_vars.find(name); pair != m_vars.end()) {
         pair->second = value;
         return true;
@@ -582,45 +1180,162 @@ bool Scope::set_unresolved(std::string_view name, const std::shared_ptr<Object>&
     return false;
 }
 
-std::shared_ptr<Object> Interpreter::get_var(const Identifier& ident)
+void Interpreter::define_var(const Identifier& ident, const Value& value)
 {
-    if (auto hops = ident.hops())
-        return m_scope->get_resolved(ident.name(), hops.value());
-    if (auto val = m_globals->get_unresolved(ident.name()))
-        return val;
+    assert(value);
+    auto& var = ident.var();
+    switch (var.kind) {
+    case VarKind::Global:
+        m_globals->define(ident.name(), value);
+        return;
+    case VarKind::Local:
+        local(var.index) = value;
+        return;
+    case VarKind::BoxedLocal:
+        if (var.new_box)
+            local(var.index) = Value(heap().make<Box>(value));
+        else
+            boxed_local(var.index).get() = value;
+        return;
+    case VarKind::Captured:
+        break;
+    }
+    assert(0);
+}
+
+Value Interpreter::get_var(const Identifier& ident)
+{
+    // here local var was resolved by checker and must exist
+    auto& var = ident.var();
+    switch (var.kind) {
+    case VarKind::Local:
+        assert(local(var.index));
+        return local(var.index);
+    case VarKind::BoxedLocal:
+        return boxed_local(var.index).get();
+    case VarKind::Captured:
+        return captured(var.index).get();
+    case VarKind::Global:
+        break;
+    }
+    if (auto val = ident.find_global(*m_globals))
+        return *val;
     error(std::format("identifier '{}' is not defined", ident.name()),
         ident.text());
     return {};
 }
 
-bool Interpreter::set_var(const Identifier& ident, const std::shared_ptr<Object>& value)
+bool Interpreter::set_var(const Identifier& ident, const Value& value)
 {
     assert(value);
-    if (auto hops = ident.hops()) {
-        m_scope->set_resolved(ident.name(), hops.value(), value);
+    auto& var = ident.var();
+    switch (var.kind) {
+    case VarKind::Local:
+        local(var.index) = value;
+        return true;
+    case VarKind::BoxedLocal:
+        boxed_local(var.index).get() = value;
+        return true;
+    case VarKind::Captured:
+        captured(var.index).get() = value;
         return true;
+    case VarKind::Global:
+        break;
     }
-    if (m_globals->set_unresolved(ident.name(), value))
+    if (auto var = ident.find_global(*m_globals)) {
+        *var = value;
         return true;
+    }
     error(std::format("identifier '{}' is not defined", ident.name()),
         ident.text());
     return false;
 }
 
+Value Interpreter::capture(const Capture& capture)
+{
+    if (capture.is_local) {
+        assert(m_frame[capture.index].is_object());
+        return m_frame[capture.index];
+    }
+    assert(m_function);
+    return Value(&m_function->capture(capture.index));
+}
+
 void Interpreter::error(std::string msg, std::string_view span)
 {
     m_errors.push_back({ std::move(msg), m_source, span });
 }
 
+Interpreter::Interpreter()
+    : m_globals(heap().make<Scope>())
+    , m_stack(static_cast<Value*>(::operator new(Interpreter::STACK_SLOTS * sizeof(Value))))
+    , m_stack_top(m_stack)
+    , m_stack_end(m_stack + Interpreter::STACK_SLOTS)
+{
+    heap().add_root(*this);
+}
+
+Interpreter::~Interpreter()
+{
+    heap().remove_root(*this);
+    ::operator delete(m_stack);
+}
+
+void Interpreter::trace_roots(Heap& heap) const
+{
+    heap.mark(m_globals);
+    for (auto val = m_stack; val != m_stack_top; ++val)
+        heap.mark(*val);
+    heap.mark(m_return_value);
+    if (m_vm)
+        m_vm->trace_roots(heap);
+}
+
+VM& Interpreter::vm()
+{
+    if (!m_vm)
+        m_vm = std::make_unique<VM>(*this);
+    return *m_vm;
+}
+
+void Interpreter::echo(const Value& value)
+{
+    auto str = value.__str__();
+    if (value.is_string())
+        str = escape(str);
+    str += '\n';
+    m_output.write(str);
+}
+
 void Interpreter::interpret(std::shared_ptr<Program> program)
 {
     assert(program);
 
     m_errors.clear();
     m_source = program->text();
-    assert(m_scope->is_global());
-    program->execute(*this);
-    assert(m_scope->is_global());
+    assert(!m_function);
+    if (m_engine == Engine::VM) {
+        Compiler compiler;
+        auto script = compiler.compile(*program, m_print_expr_statements_mode);
+        if (compiler.has_errors()) {
+            m_errors = compiler.errors();
+            return;
+        }
+        vm().run(std::move(script));
+    } else {
+        if (!has_stack_room(program->frame_size(), STACK_HEADROOM)) {
+            error("stack overflow", program->text());
+            return;
+        }
+        auto program_change = push_program(*program);
+        FrameChange frame_change(*this, nullptr, program->frame_size());
+        Profiler::FramePusher profiler_frame(m_profiler, nullptr,
+            program->text());
+        program->execute(*this);
+    }
+    assert(m_stack_top == m_stack);
+    // output is complete, and comes before any errors reported
+    m_output.flush();
 }
 
 volatile std::sig_atomic_t g_interrupt;
@@ -629,10 +1344,8 @@ bool Interpreter::check_interrupt()
 {
     if (g_interrupt) {
         g_interrupt = 0;
+        m_output.flush();
         std::cerr << "interrupt\n";
-        // when infinite loop does output to tty std::cout and SIGINT is
-        // issued to stop that, failbit and badbit get set; clear those
-        std::cout.clear();
         return true;
     }
     return false;
@@ -2,32 +2,140 @@
 
 #include "AST.h"
 #include "Utils.h"
+#include "Heap.h"
+#include "Output.h"
+#include "Profiler.h"
 #include <cassert>
 #include <vector>
 #include <unordered_map>
 #include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <new>
+#include <optional>
+#include <span>
+#include <utility>
 
 namespace Lox {
 
 class Interpreter;
-class Iterator;
+class Object;
+class VM;
+
+// Every user-visible type has its own tag, so that operators can dispatch
+// on tags of their operands. Objects internal to the interpreter, that are
+// never seen by user code, are tagged Internal.
+enum class TypeTag : std::uint8_t {
+    Number,
+    Bool,
+    Nil,
+    String,
+    Function,
+    BuiltinFunction,
+    Iterator,
+    List,
+    Map,
+    Range,
+    Internal,
+};
+
+static constexpr std::size_t TYPE_TAG_COUNT =
+    static_cast<std::size_t>(TypeTag::Internal) + 1;
+
+// A Lox value. Numbers, bools and nil are stored inline, everything else
+// is a pointer to an Object owned by the garbage-collected heap. The 64 bits are
+// NaN-boxed: a value that isn't a quiet NaN with the QNAN bits set is a
+// number; otherwise the low bits hold a tag or, with the sign bit also
+// set, an Object pointer. NaNs produced by arithmetic never have all the
+// QNAN bits set, so they can't be confused with a boxed value.
+//
+// A default-constructed value is empty. It isn't a valid Lox value and is
+// returned to signal an error, similar to a null pointer.
+class Value {
+public:
+    Value() = default;
+    explicit Value(Object* obj);
+
+    static Value number(double num)
+    {
+        Value val;
+        std::memcpy(&val.m_bits, &num, sizeof(num));
+        return val;
+    }
+    static Value boolean(bool b) { return from_bits(b ? TRUE : FALSE); }
+    static Value nil() { return from_bits(NIL); }
+
+    explicit operator bool() const { return m_bits != EMPTY; }
+
+    bool is_number() const { return (m_bits & QNAN) != QNAN; }
+    bool is_bool() const { return (m_bits | 1) == TRUE; }
+    bool is_niltype() const { return m_bits == NIL; }
+    bool is_object() const { return (m_bits & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT); }
+    TypeTag tag() const;
+    bool is_string() const;
+    bool is_callable() const;
+    bool is_iterable() const;
+
+    double get_number() const
+    {
+        assert(is_number());
+        double num;
+        std::memcpy(&num, &m_bits, sizeof(num));
+        return num;
+    }
+    bool get_bool() const
+    {
+        assert(is_bool());
+        return m_bits == TRUE;
+    }
+    std::string_view get_string() const;
+    Object& get_object() const
+    {
+        assert(is_object());
+        return *reinterpret_cast<Object*>(m_bits & ~(QNAN | SIGN_BIT));
+    }
+
+    std::string_view type_name() const;
+    bool __eq__(const Value& rhs) const;
+    std::string __str__() const;
+    Value __iter__() const;
+
+private:
+    static constexpr std::uint64_t SIGN_BIT = 0x8000000000000000;
+    static constexpr std::uint64_t QNAN = 0x7ffc000000000000;
+    static constexpr std::uint64_t EMPTY = QNAN;
+    static constexpr std::uint64_t NIL = QNAN | 1;
+    static constexpr std::uint64_t FALSE = QNAN | 2;
+    static constexpr std::uint64_t TRUE = QNAN | 3;
+
+    static Value from_bits(std::uint64_t bits)
+    {
+        Value val;
+        val.m_bits = bits;
+        return val;
+    }
+
+    std::uint64_t m_bits { EMPTY };
+};
 
 class Object {
 public:
+    explicit Object(TypeTag tag = TypeTag::Internal) : m_tag(tag)
+    {}
     virtual ~Object() = default;
 
+    TypeTag tag() const { return m_tag; }
     virtual std::string_view type_name() const { return "Object"; }
 
-    bool is_string() const { return type_name() == "String"; }
-    bool is_number() const { return type_name() == "Number"; }
-    bool is_bool() const { return type_name() == "Bool"; }
-    bool is_niltype() const { return type_name() == "NilType"; }
-
-    virtual bool is_callable() const { return false; }
+    bool is_string() const { return m_tag == TypeTag::String; }
+    bool is_callable() const
+    {
+        return m_tag == TypeTag::Function || m_tag == TypeTag::BuiltinFunction;
+    }
 
     virtual std::string_view get_string() const { assert(0); }
-    virtual double get_number() const { assert(0); }
-    virtual bool get_bool() const { assert(0); }
 
     virtual bool __eq__(const Object&) const { return false; }
     virtual std::string __str__() const
@@ -36,203 +144,551 @@ public:
     }
 
     virtual bool is_iterable() const { return false; }
-    virtual std::shared_ptr<Iterator> __iter__() const { assert(0); }
+    virtual Value __iter__() const { assert(0); }
+
+    // bytes owned by the object outside of its own allocation
+    virtual std::size_t external_size() const { return 0; }
+    // mark objects referenced by this one
+    virtual void trace(Heap&) const {}
+
+private:
+    friend class Heap;
+
+    // objects are created with Heap::make, which links them in the
+    // heap's list of all objects
+    Object* m_next { nullptr };
+    std::size_t m_size { 0 };
+    bool m_marked { false };
+    const TypeTag m_tag;
+};
+
+class Iterator : public Object {
+public:
+    Iterator() : Object(TypeTag::Iterator)
+    {}
+
+    std::string_view type_name() const override { return "Iterator"; }
+
+    // an iterator returned by a builtin, e.g. lines(), can be looped over
+    bool is_iterable() const override { return true; }
+    Value __iter__() const override;
+
+    virtual bool done() const = 0;
+    // return empty on an error, e.g. of reading a file, which error()
+    // then describes
+    virtual Value next() = 0;
+    virtual std::string error() const { return "iteration failed"; }
 };
 
-class String : public Object
-    , public std::enable_shared_from_this<String> {
+inline Value::Value(Object* obj)
+{
+    assert(obj);
+    auto ptr = reinterpret_cast<std::uint64_t>(obj);
+    assert((ptr & (QNAN | SIGN_BIT)) == 0);
+    m_bits = ptr | QNAN | SIGN_BIT;
+}
+
+inline TypeTag Value::tag() const
+{
+    if (is_number())
+        return TypeTag::Number;
+    if (is_object())
+        return get_object().tag();
+    assert(m_bits != EMPTY);
+    return m_bits == NIL ? TypeTag::Nil : TypeTag::Bool;
+}
+
+inline bool Value::is_string() const
+{
+    return is_object() && get_object().is_string();
+}
+
+inline bool Value::is_callable() const
+{
+    return is_object() && get_object().is_callable();
+}
+
+inline bool Value::is_iterable() const
+{
+    return is_object() && get_object().is_iterable();
+}
+
+inline std::string_view Value::get_string() const
+{
+    return get_object().get_string();
+}
+
+// A string is either flat, i.e. holds its bytes, or a rope - a lazily
+// evaluated concatenation of two other strings. Concatenating long strings
+// makes a rope in O(1), so that building a string by repeated appends is
+// linear. A rope is flattened in place once contiguous bytes are needed.
+class String : public Object {
 public:
-    String(std::string_view value) : m_value(value)
+    String(std::string_view value)
+        : Object(TypeTag::String)
+        , m_value(value)
+        , m_length(m_value.size())
+    {}
+    String(std::string&& value)
+        : Object(TypeTag::String)
+        , m_value(std::move(value))
+        , m_length(m_value.size())
     {}
-    String(std::string&& value) : m_value(std::move(value))
+    String(const String& left, const String& right)
+        : Object(TypeTag::String)
+        , m_left(&left)
+        , m_right(&right)
+        , m_length(left.size() + right.size())
     {}
 
     std::string_view type_name() const override { return "String"; }
-    std::string_view get_string() const override { return m_value; }
+    std::string_view get_string() const override
+    {
+        if (m_left)
+            flatten();
+        return m_value;
+    }
 
-    std::size_t size() const { return m_value.size(); }
+    std::size_t size() const { return m_length; }
     std::string get_char(std::size_t pos) const
     {
-        assert(pos < m_value.size());
-        return std::string(1, m_value[pos]);
+        assert(pos < m_length);
+        return std::string(1, get_string()[pos]);
     }
 
     bool __eq__(const Object& rhs) const override
     {
         assert(rhs.is_string());
-        return rhs.get_string() == m_value;
+        auto& str = static_cast<const String&>(rhs);
+        return str.size() == m_length && str.get_string() == get_string();
     }
 
-    std::string __str__() const override { return m_value; }
+    std::string __str__() const override { return std::string(get_string()); }
+
+    // hash of the chars, computed once, as strings are immutable
+    std::size_t hash() const
+    {
+        if (m_hash == 0)
+            m_hash = std::hash<std::string_view>()(get_string()) | 1;
+        return m_hash;
+    }
 
     bool is_iterable() const override { return true; }
-    std::shared_ptr<Iterator> __iter__() const override;
+    Value __iter__() const override;
+
+    std::size_t external_size() const override { return m_value.capacity(); }
+    void trace(Heap& heap) const override;
 
 private:
-    std::string m_value;
+    void flatten() const;
+
+    mutable std::string m_value;
+    // children of an unflattened rope
+    mutable const String* m_left { nullptr };
+    mutable const String* m_right { nullptr };
+    std::size_t m_length { 0 };
+    // 0 until computed
+    mutable std::size_t m_hash { 0 };
 };
 
-inline std::shared_ptr<String> make_string(std::string_view val)
+inline Value make_string(std::string_view val)
+{
+    return Value(heap().make<String>(val));
+}
+
+inline Value make_string(std::string&& val)
 {
-    return std::make_shared<String>(val);
+    return Value(heap().make<String>(std::move(val)));
 }
 
-class Number : public Object {
+Value concat_strings(const String& left, const String& right);
+
+// A growable array of values. Items are stored contiguously, so indexing
+// is O(1), appending is amortized O(1) and scans are cache friendly.
+class List : public Object {
 public:
-    Number(double value) : m_value(value)
+    List() : Object(TypeTag::List)
+    {}
+    explicit List(std::span<const Value> items)
+        : Object(TypeTag::List)
+        , m_items(items.begin(), items.end())
     {}
 
-    std::string_view type_name() const override { return "Number"; }
-    double get_number() const override { return m_value; }
+    std::string_view type_name() const override { return "List"; }
 
-    bool __eq__(const Object& rhs) const override
+    std::size_t size() const { return m_items.size(); }
+    Value& at(std::size_t pos)
     {
-        assert(rhs.is_number());
-        return rhs.get_number() == m_value;
+        assert(pos < m_items.size());
+        return m_items[pos];
     }
+    // position that index refers to, if it's an integer within the list
+    std::optional<std::size_t> position(const Value& index) const
+    {
+        if (!index.is_number())
+            return {};
+        auto num = index.get_number();
+        // also false for NaN
+        if (!(num >= 0 && num < static_cast<double>(m_items.size())))
+            return {};
+        auto pos = static_cast<std::size_t>(num);
+        if (static_cast<double>(pos) != num)
+            return {};
+        return pos;
+    }
+    void push(const Value& value);
+    Value pop();
 
+    bool __eq__(const Object& rhs) const override;
     std::string __str__() const override;
 
+    bool is_iterable() const override { return true; }
+    Value __iter__() const override;
+
+    std::size_t external_size() const override
+    {
+        return m_items.capacity() * sizeof(Value);
+    }
+    void trace(Heap& heap) const override;
+
 private:
-    double m_value;
+    std::vector<Value> m_items;
+    // set while printing, so that a list containing itself prints as [...]
+    mutable bool m_printing { false };
 };
 
-inline std::shared_ptr<Number> make_number(double val)
+inline Value make_list(std::span<const Value> items)
 {
-    return std::make_shared<Number>(val);
+    return Value(heap().make<List>(items));
 }
 
-class Bool : public Object {
+// strings, numbers except NaN, bools and nil can be keys of a map
+bool is_hashable(const Value&);
+// error for a value that isn't hashable
+std::string not_hashable_message(const Value&);
+
+// A hash map with open addressing, laid out like a Swiss table: a control
+// byte per slot holds 7 bits of its key's hash, and lookups compare the
+// control bytes of 16 slots at once, so that keys are only compared on
+// a likely match. Keys are equal if they have the same type and are equal
+// by __eq__.
+class Map : public Object {
 public:
-    Bool(bool value) : m_value(value)
+    Map() : Object(TypeTag::Map)
     {}
 
-    std::string_view type_name() const override { return "Bool"; }
-    bool get_bool() const override { return m_value; }
+    std::string_view type_name() const override { return "Map"; }
 
-    bool __eq__(const Object& rhs) const override
-    {
-        assert(rhs.is_bool());
-        return rhs.get_bool() == m_value;
-    }
+    std::size_t size() const { return m_size; }
+    // return empty if key isn't in the map or isn't hashable
+    Value get(const Value& key) const;
+    bool contains(const Value& key) const { return static_cast<bool>(get(key)); }
+    // key must be hashable
+    void set(const Value& key, const Value& value);
+    // return false if key wasn't in the map
+    bool remove(const Value& key);
+
+    // entries are iterated over by slot, in no particular order; the
+    // first full slot at or after slot, or capacity() if there's none
+    std::size_t next_slot(std::size_t slot) const;
+    std::size_t capacity() const { return m_capacity; }
+    const Value& key_at(std::size_t slot) const;
+
+    bool __eq__(const Object& rhs) const override;
+    std::string __str__() const override;
 
-    std::string __str__() const override { return m_value ? "true" : "false"; }
+    bool is_iterable() const override { return true; }
+    Value __iter__() const override;
+
+    std::size_t external_size() const override;
+    void trace(Heap& heap) const override;
 
 private:
-    bool m_value;
+    struct Entry {
+        Value key;
+        Value value;
+    };
+
+    std::size_t find(const Value& key, std::size_t hash) const;
+    std::size_t find_free_slot(std::size_t hash) const;
+    void rehash(std::size_t capacity);
+
+    // capacity control bytes, followed by capacity entries
+    std::unique_ptr<std::int8_t[]> m_ctrl;
+    std::unique_ptr<Entry[]> m_entries;
+    std::size_t m_capacity { 0 };
+    std::size_t m_size { 0 };
+    std::size_t m_deleted { 0 };
+    // set while printing, so that a map containing itself prints as {...}
+    mutable bool m_printing { false };
 };
 
-inline std::shared_ptr<Bool> make_bool(bool val)
-{
-    return std::make_shared<Bool>(val);
-}
-
-class NilType : public Object {
+// range(start, stop, step): the numbers from start up to, but not
+// including, stop. Unlike other iterables, loops over a range count with
+// a plain number instead of going through an iterator.
+class NumberRange : public Object {
 public:
-    std::string_view type_name() const override { return "NilType"; }
+    NumberRange(double start, double stop, double step)
+        : Object(TypeTag::Range)
+        , m_start(start)
+        , m_stop(stop)
+        , m_step(step)
+    {
+        assert(step != 0);
+    }
 
-    bool __eq__(const Object& rhs) const override
+    std::string_view type_name() const override { return "Range"; }
+
+    // number of the range at count steps from start; computed from
+    // start, so that fractional steps don't accumulate rounding errors
+    double at(double count) const { return m_start + count * m_step; }
+    // whether num is at or past stop; true for NaN, so that a range with
+    // a NaN bound is empty
+    bool is_past_end(double num) const
     {
-        assert(rhs.is_niltype());
-        return true;
+        return m_step > 0 ? !(num < m_stop) : !(num > m_stop);
     }
 
-    std::string __str__() const override { return "nil"; }
+    bool __eq__(const Object& rhs) const override;
+    std::string __str__() const override;
+
+    bool is_iterable() const override { return true; }
+    Value __iter__() const override;
+
+private:
+    double m_start;
+    double m_stop;
+    double m_step;
 };
 
-inline std::shared_ptr<NilType> make_nil()
+inline Value make_number(double val)
+{
+    return Value::number(val);
+}
+
+inline Value make_bool(bool val)
 {
-    return std::make_shared<NilType>();
+    return Value::boolean(val);
 }
 
-class Scope {
+inline Value make_nil()
+{
+    return Value::nil();
+}
+
+// Global variables. Globals are looked up by name, because they can be
+// defined by any program run in the same interpreter, e.g. in a repl.
+// Locals live in slots of frames on the interpreter's stack.
+class Scope : public Object {
 public:
-    using MapType = std::unordered_map<std::string_view, std::shared_ptr<Object>>;
+    using MapType = std::unordered_map<std::string_view, Value>;
 
-    Scope() = default;
-    explicit Scope(std::shared_ptr<Scope> parent) : m_parent(parent)
-    {
-        assert(parent);
-    }
+    std::string_view type_name() const override { return "Scope"; }
+    void trace(Heap&) const override;
 
-    bool is_global() const { return m_parent == nullptr; }
-    void define(std::string_view name, const std::shared_ptr<Object>& value);
-    std::shared_ptr<Object> get_resolved(std::string_view name, std::size_t hops) const;
-    std::shared_ptr<Object> get_unresolved(std::string_view name) const;
-    void set_resolved(std::string_view name, std::size_t hops,
-        const std::shared_ptr<Object>& value);
-    bool set_unresolved(std::string_view name, const std::shared_ptr<Object>& value);
+    void define(std::string_view name, const Value& value);
+    // location of a global var stays valid as long as the scope lives
+    Value* find(std::string_view name);
+    Value get_unresolved(std::string_view name) const;
+    bool set_unresolved(std::string_view name, const Value& value);
 
     const MapType& vars() const { return m_vars; }
 
 private:
-    const std::shared_ptr<Object>& find_resolved(std::string_view name,
-        std::size_t hops) const;
-
-    std::shared_ptr<Scope> m_parent;
     MapType m_vars;
 };
 
+// A local variable captured by a nested function. It's shared by the frame
+// that declared the variable and by the functions that captured it, so it
+// outlives the frame.
+class Box : public Object {
+public:
+    explicit Box(const Value& value) : m_value(value)
+    {}
+
+    std::string_view type_name() const override { return "Box"; }
+    void trace(Heap& heap) const override { heap.mark(m_value); }
+
+    Value& get() { return m_value; }
+
+private:
+    Value m_value;
+};
+
 class Callable : public Object {
 public:
-    bool is_callable() const override { return true; }
-    virtual std::shared_ptr<Object> __call__(
-        const std::vector<std::shared_ptr<Object>>&, Interpreter&) = 0;
+    explicit Callable(TypeTag tag) : Object(tag)
+    {
+        assert(tag == TypeTag::Function || tag == TypeTag::BuiltinFunction);
+    }
+
+    virtual Value __call__(std::span<const Value> args, Interpreter&) = 0;
+    static constexpr std::size_t ANY_ARITY =
+        std::numeric_limits<std::size_t>::max();
+
+    // least number of args
     virtual std::size_t arity() const = 0;
+    // most number of args, for builtins with optional args; ANY_ARITY for
+    // variadic ones
+    virtual std::size_t max_arity() const { return arity(); }
+    // closures are called by the VM directly, without going through __call__
+    virtual bool is_closure() const { return false; }
 };
 
 class Function : public Callable {
 public:
-    Function(std::shared_ptr<const FunctionExpr> func,
-        std::shared_ptr<Scope> parent_scope, std::string_view program_source)
-        : m_func(func)
-        , m_parent_scope(parent_scope)
-        , m_program_source(program_source)
+    // function keeps the program it's defined in alive, b/c its syntax
+    // tree lives in the program's arena
+    Function(std::shared_ptr<const Program> program, const FunctionExpr& func)
+        : Callable(TypeTag::Function)
+        , m_program(std::move(program))
+        , m_func(&func)
     {
-        assert(func);
-        assert(parent_scope);
-        assert(!program_source.empty());
+        assert(m_program);
+        m_captures.reserve(m_func->captures().size());
     }
 
     std::string_view type_name() const override { return "Function"; }
-    std::shared_ptr<Object> __call__(
-        const std::vector<std::shared_ptr<Object>>&, Interpreter&) override;
+    Value __call__(std::span<const Value> args, Interpreter&) override;
     std::size_t arity() const override { return m_func->params().size(); }
     const FunctionExpr& ast() const { return *m_func; }
+    void trace(Heap& heap) const override;
+
+    Box& capture(std::size_t i)
+    {
+        assert(i < m_captures.size());
+        return static_cast<Box&>(m_captures[i].get_object());
+    }
+    void add_capture(Value box) { m_captures.push_back(box); }
 
 private:
-    std::shared_ptr<const FunctionExpr> m_func;
-    std::shared_ptr<Scope> m_parent_scope;
-    // source of the program where function was defined, for error reporting
-    std::string_view m_program_source;
+    // program where function was defined, also for error reporting
+    std::shared_ptr<const Program> m_program;
+    const FunctionExpr* m_func { nullptr };
+    std::vector<Value> m_captures;
 };
 
 class Interpreter {
 public:
-    Interpreter()
-        : m_scope(std::make_shared<Scope>())
-        , m_globals(m_scope)
-    {}
+    enum class Engine {
+        Tree, // walk the AST
+        VM, // compile to bytecode and run it on the VM
+    };
+
+    // size of the stack of frames, and so the most slots a frame can have
+    static constexpr std::size_t STACK_SLOTS = 1 << 20;
+
+    Interpreter();
+    ~Interpreter();
+
+    Interpreter(const Interpreter&) = delete;
+    Interpreter& operator=(const Interpreter&) = delete;
 
     void interpret(std::shared_ptr<Program> program);
 
-    Scope& scope() { return *m_scope; }
-    std::shared_ptr<Scope> scope_ptr() const { return m_scope; }
-    TemporaryChange<std::shared_ptr<Scope>> new_scope(std::shared_ptr<Scope> parent)
+    Engine engine() const { return m_engine; }
+    void set_engine(Engine engine) { m_engine = engine; }
+    VM& vm();
+    Scope& globals() { return *m_globals; }
+    // where print and echo write; flushed after every program
+    Output& output() { return m_output; }
+    // profiler sampling the tree engine's calls, if any
+    Profiler* profiler() const { return m_profiler; }
+    void set_profiler(Profiler* profiler) { m_profiler = profiler; }
+
+    // Pushes a frame of size slots onto the stack for its lifetime and
+    // makes it current. The caller checks there's room for it.
+    class FrameChange {
+    public:
+        FrameChange(Interpreter& interp, Function* func, std::size_t size)
+            : m_interp(interp)
+            , m_frame(interp.m_frame)
+            , m_function(interp.m_function)
+            , m_stack_top(interp.m_stack_top)
+        {
+            assert(interp.has_stack_room(size));
+            m_interp.m_frame = m_interp.m_stack_top;
+            m_interp.m_function = func;
+            // slots are traced by the GC before their variables are declared
+            for (; size > 0; --size)
+                new (m_interp.m_stack_top++) Value(make_nil());
+        }
+
+        FrameChange(const FrameChange&) = delete;
+        FrameChange& operator=(const FrameChange&) = delete;
+
+        ~FrameChange()
+        {
+            m_interp.m_stack_top = m_stack_top;
+            m_interp.m_function = m_function;
+            m_interp.m_frame = m_frame;
+        }
+
+    private:
+        Interpreter& m_interp;
+        Value* m_frame { nullptr };
+        Function* m_function { nullptr };
+        Value* m_stack_top { nullptr };
+    };
+
+    // Keeps values that are held only in C++ locals reachable by the GC
+    // for its lifetime, e.g. while evaluating code that may hit a safe point.
+    // The values are pushed onto the stack above the current frame.
+    class TempRoots {
+    public:
+        explicit TempRoots(Interpreter& interp)
+            : m_interp(interp)
+            , m_base(interp.m_stack_top)
+        {}
+
+        TempRoots(const TempRoots&) = delete;
+        TempRoots& operator=(const TempRoots&) = delete;
+
+        ~TempRoots() { m_interp.m_stack_top = m_base; }
+
+        void push(const Value& value)
+        {
+            assert(m_interp.has_stack_room(1));
+            new (m_interp.m_stack_top++) Value(value);
+        }
+        std::span<const Value> values() const
+        {
+            return { m_base, m_interp.m_stack_top };
+        }
+
+    private:
+        Interpreter& m_interp;
+        Value* m_base { nullptr };
+    };
+
+    // room for slots plus headroom above them; safe from overflow for any
+    // slots, e.g. the frame size of a corrupt cached program
+    bool has_stack_room(std::size_t slots, std::size_t headroom = 0) const
     {
-        assert(parent);
-        return { m_scope, std::make_shared<Scope>(parent) };
+        auto left = static_cast<std::size_t>(m_stack_end - m_stack_top);
+        return slots <= left && headroom <= left - slots;
     }
-    TemporaryChange<std::shared_ptr<Scope>> push_scope()
+    void define_var(std::string_view name, const Value& value)
     {
-        return { m_scope, std::make_shared<Scope>(m_scope) };
+        assert(!m_function);
+        m_globals->define(name, value);
     }
-    void define_var(std::string_view name, const std::shared_ptr<Object>& value)
+    void define_var(const Identifier& ident, const Value& value);
+    Value get_var(const Identifier& ident);
+    bool set_var(const Identifier& ident, const Value& value);
+    // box of the current frame to be captured by a function being created
+    Value capture(const Capture& capture);
+
+    // program whose code is being executed
+    const Program& program() const
     {
-        m_scope->define(name, value);
+        assert(m_program);
+        return *m_program;
+    }
+    TemporaryChange<const Program*> push_program(const Program& program)
+    {
+        return { m_program, &program };
     }
-    std::shared_ptr<Object> get_var(const Identifier& ident);
-    bool set_var(const Identifier& ident, const std::shared_ptr<Object>& value);
 
     std::string_view source() const { return m_source; }
     TemporaryChange<std::string_view> push_source(std::string_view source)
@@ -240,12 +696,21 @@ public:
         return { m_source, source };
     }
 
+    // span of the call being made, errors of builtins point to it
+    std::string_view call_span() const { return m_call_span; }
+    TemporaryChange<std::string_view> push_call_span(std::string_view span)
+    {
+        return { m_call_span, span };
+    }
+
     void error(std::string msg, std::string_view span);
     bool has_errors() const { return m_errors.size() > 0; }
     const std::vector<Error>& errors() const { return m_errors; }
 
     bool is_print_expr_statements_mode() const { return m_print_expr_statements_mode; }
     void print_expr_statements_mode(bool on) { m_print_expr_statements_mode = on; }
+    // print the value of an expression statement in print-expr-statements mode
+    void echo(const Value& value);
 
     bool is_break() const { return m_break; }
     void set_break(bool on)
@@ -261,33 +726,84 @@ public:
         m_continue = on;
     }
 
-    bool is_return() const { return m_return_value != nullptr; }
-    void set_return_value(const std::shared_ptr<Object>& value)
+    bool is_return() const { return static_cast<bool>(m_return_value); }
+    void set_return_value(const Value& value)
     {
         assert(value);
         assert(!m_return_value);
         m_return_value = value;
     }
-    std::shared_ptr<Object>&& pop_return_value()
+    Value pop_return_value()
     {
         assert(m_return_value);
-        return std::move(m_return_value);
+        return std::exchange(m_return_value, {});
     }
 
     bool check_interrupt();
 
+    // calls made by programs over the interpreter's lifetime
+    std::size_t call_count() const { return m_call_count; }
+    void count_call() { ++m_call_count; }
+
+    void trace_roots(Heap&) const;
+
 private:
+    Value& local(std::uint32_t slot) { return m_frame[slot]; }
+    Box& boxed_local(std::uint32_t slot)
+    {
+        return static_cast<Box&>(m_frame[slot].get_object());
+    }
+    Box& captured(std::uint32_t index)
+    {
+        assert(m_function);
+        return m_function->capture(index);
+    }
+
     std::vector<Error> m_errors;
-    std::shared_ptr<Scope> m_scope;
-    // inited from m_scope, so must be declared after it due to member init order
-    std::shared_ptr<Scope> m_globals;
+    Scope* m_globals { nullptr };
+    // frames of active calls and temporary roots; values are constructed
+    // in place, so the stack is never reallocated
+    Value* m_stack { nullptr };
+    Value* m_stack_top { nullptr };
+    Value* m_stack_end { nullptr };
+    Value* m_frame { nullptr };
+    // function of the current frame, null for the program's frame
+    Function* m_function { nullptr };
     bool m_print_expr_statements_mode { false };
     bool m_break { false };
     bool m_continue { false };
-    std::shared_ptr<Object> m_return_value;
+    Value m_return_value;
     std::string_view m_source;
+    std::string_view m_call_span;
+    const Program* m_program { nullptr };
+    Engine m_engine { Engine::Tree };
+    Profiler* m_profiler { nullptr };
+    std::size_t m_call_count { 0 };
+    std::unique_ptr<VM> m_vm;
+    Output m_output;
 };
 
+// operator semantics shared by the tree-walking interpreter and the VM;
+// on a type error, report it at span and return an empty value
+Value unary_op(UnaryOp, const Value&, Interpreter&, std::string_view span);
+Value binary_op(BinaryOp, const Value& left, const Value& right, Interpreter&,
+    std::string_view span);
+// apply operator to constant operands ahead of runtime, or to operands
+// whose error span isn't known yet; return empty if it doesn't apply to
+// them, leaving the error for unary_op or binary_op to report
+Value fold_unary_op(UnaryOp, const Value&);
+Value fold_binary_op(BinaryOp, const Value& left, const Value& right);
+// object[index] and object[index] = value, errors are reported at span
+Value get_item(const Value& object, const Value& index, Interpreter&,
+    std::string_view span);
+bool set_item(const Value& object, const Value& index, const Value& value,
+    Interpreter&, std::string_view span);
+// error message if callable can't be called with argc args, else empty
+std::string arity_error(const Callable&, std::size_t argc);
+// map of a literal, from its keys alternating with their values
+Value make_map(std::span<const Value> entries, Interpreter&,
+    std::string_view span);
+
 extern volatile std::sig_atomic_t g_interrupt;
 
 }
@@ -1,27 +1,66 @@
 #include "Lexer.h"
+#include <array>
 #include <cassert>
 #include <charconv>
-#include <unordered_map>
+#include <cstring>
+#include <limits>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace Lox {
 
-std::string Token::value_string() const
+Token::ValueType Token::value(const TokenTable& table) const
 {
-    if (std::holds_alternative<DefaultValueType>(m_value))
+    switch (m_type) {
+    case TokenType::True:
+        return true;
+    case TokenType::False:
+        return false;
+    case TokenType::Number:
+        return table.number(m_value_index);
+    case TokenType::String:
+        if (m_value_index != NO_VALUE)
+            return table.string(m_value_index);
+        // w/out escapes, the value is the text between the quotes
+        assert(m_length >= 2);
+        return table.source().substr(m_offset + 1, m_length - 2);
+    default:
+        return DefaultValueType();
+    }
+}
+
+std::string Token::value_string(const TokenTable& table) const
+{
+    auto value = this->value(table);
+    if (std::holds_alternative<DefaultValueType>(value))
         return "<none>";
-    else if (std::holds_alternative<bool>(m_value))
-        return std::get<bool>(m_value) ? "true" : "false";
-    else if (std::holds_alternative<double>(m_value))
-        return number_to_string(std::get<double>(m_value));
-    else if (std::holds_alternative<std::string>(m_value))
-        return escape(std::get<std::string>(m_value));
+    else if (std::holds_alternative<bool>(value))
+        return std::get<bool>(value) ? "true" : "false";
+    else if (std::holds_alternative<double>(value))
+        return number_to_string(std::get<double>(value));
+    else if (std::holds_alternative<std::string_view>(value))
+        return escape(std::string(std::get<std::string_view>(value)));
     else
         assert(0);
 }
 
-std::string Token::dump() const
+std::string Token::dump(const TokenTable& table) const
 {
-    return type_string() + ' ' + value_string() + ' ' + escape(std::string(m_text));
+    return type_string() + ' ' + value_string(table) + ' ' +
+        escape(std::string(text(table)));
+}
+
+Lexer::Lexer(std::string_view source)
+    : m_source(source)
+    , m_table(source)
+{
+    assert(source.data());
+    // tokens store 32-bit offsets
+    if (source.size() > std::numeric_limits<std::uint32_t>::max()) {
+        m_errors.push_back({ "source is too large", m_source, m_source.substr(0, 1) });
+        m_start = m_end = m_source.size();
+    }
 }
 
 bool Lexer::match(char next)
@@ -106,7 +145,63 @@ bool Lexer::unescape(std::string& s)
     return true;
 }
 
-static const std::unordered_map<std::string_view, TokenType> keywords = {
+// Perfect hash of the keywords, built at compile time. A word's hash mixes
+// its length with its first and last chars, which is enough to tell the
+// keywords apart, so a lookup is one hash and at most one compare.
+class KeywordTable {
+public:
+    struct Keyword {
+        std::string_view name;
+        TokenType type;
+    };
+
+    template<std::size_t N>
+    consteval KeywordTable(const Keyword (&keywords)[N])
+    {
+        // find the first multiplier that maps keywords to distinct slots
+        for (m_mult = 1; !try_fill(keywords); ++m_mult) {
+            if (m_mult == 0xff)
+                throw "no perfect hash for keywords"; // fails compilation
+        }
+    }
+
+    constexpr const Keyword* find(std::string_view word) const
+    {
+        auto& slot = m_slots[hash(word)];
+        return slot.name == word ? &slot : nullptr;
+    }
+
+private:
+    static constexpr std::size_t SIZE = 64;
+
+    constexpr std::size_t hash(std::string_view word) const
+    {
+        // keywords are at least 2 chars long, shorter words miss
+        if (word.size() < 2)
+            return 0;
+        return (word.size() * m_mult + static_cast<unsigned char>(word.front()) * 3 +
+            static_cast<unsigned char>(word.back())) % SIZE;
+    }
+
+    template<std::size_t N>
+    constexpr bool try_fill(const Keyword (&keywords)[N])
+    {
+        m_slots = {};
+        for (auto& keyword : keywords) {
+            auto h = hash(keyword.name);
+            // slot 0 is reserved for misses of short words
+            if (h == 0 || !m_slots[h].name.empty())
+                return false;
+            m_slots[h] = keyword;
+        }
+        return true;
+    }
+
+    std::size_t m_mult { 0 };
+    std::array<Keyword, SIZE> m_slots {};
+};
+
+static constexpr KeywordTable::Keyword keyword_list[] = {
     { "and", TokenType::And },
     { "assert", TokenType::Assert },
     { "break", TokenType::Break },
@@ -128,20 +223,120 @@ static const std::unordered_map<std::string_view, TokenType> keywords = {
     { "while", TokenType::While },
 };
 
-std::vector<Token> Lexer::lex()
+static constexpr KeywordTable keywords(keyword_list);
+
+static_assert(keywords.find("while")->type == TokenType::While);
+static_assert(!keywords.find("whale"));
+static_assert(!keywords.find("f"));
+
+// Scanners of runs of chars, which find the end of a run 16 chars at a time
+// where SSE2 is available (always on x86-64). They return the position of
+// the first char past the run starting at pos.
+#ifdef __SSE2__
+static constexpr std::size_t SIMD_WIDTH = 16;
+
+// mask of chars in [lo, hi]; chars are compared as signed, so non-ascii
+// chars are never in ascii ranges
+static __m128i in_range(__m128i chars, char lo, char hi)
 {
-    std::vector<Token> tokens;
+    return _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8(lo - 1)),
+        _mm_cmplt_epi8(chars, _mm_set1_epi8(hi + 1)));
+}
 
-    auto add_token = [&](TokenType type,
-                         Token::ValueType&& value = Token::DefaultValueType()) {
-            tokens.push_back(Token {
-                type,
-                token_text(),
-                std::move(value),
-            });
-            consume();
-    };
+// scan 16 chars at a time while is_run(chars) marks all of them
+template<typename IsRun>
+static std::size_t scan_simd(std::string_view s, std::size_t pos, IsRun is_run)
+{
+    while (pos + SIMD_WIDTH <= s.size()) {
+        auto chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s.data() + pos));
+        auto mask = ~_mm_movemask_epi8(is_run(chars)) & 0xffff;
+        if (mask)
+            return pos + __builtin_ctz(mask);
+        pos += SIMD_WIDTH;
+    }
+    return pos;
+}
+#endif
+
+static std::size_t skip_identifier_chars(std::string_view s, std::size_t pos)
+{
+#ifdef __SSE2__
+    pos = scan_simd(s, pos, [](__m128i chars) {
+        // setting bit 5 maps upper case letters to lower case
+        auto lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+        return _mm_or_si128(
+            _mm_or_si128(in_range(lower, 'a', 'z'), in_range(chars, '0', '9')),
+            _mm_cmpeq_epi8(chars, _mm_set1_epi8('_')));
+    });
+#endif
+    while (pos < s.size() && is_identifier_char(s[pos]))
+        ++pos;
+    return pos;
+}
+
+constexpr bool is_whitespace(char ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+}
 
+static std::size_t skip_whitespace(std::string_view s, std::size_t pos)
+{
+#ifdef __SSE2__
+    pos = scan_simd(s, pos, [](__m128i chars) {
+        return _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chars, _mm_set1_epi8(' ')),
+                _mm_cmpeq_epi8(chars, _mm_set1_epi8('\n'))),
+            _mm_or_si128(_mm_cmpeq_epi8(chars, _mm_set1_epi8('\t')),
+                _mm_cmpeq_epi8(chars, _mm_set1_epi8('\r'))));
+    });
+#endif
+    while (pos < s.size() && is_whitespace(s[pos]))
+        ++pos;
+    return pos;
+}
+
+// skip chars of a string literal's body up to a quote or a backslash
+static std::size_t skip_string_chars(std::string_view s, std::size_t pos)
+{
+#ifdef __SSE2__
+    pos = scan_simd(s, pos, [](__m128i chars) {
+        return _mm_andnot_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chars, _mm_set1_epi8('"')),
+                _mm_cmpeq_epi8(chars, _mm_set1_epi8('\\'))),
+            _mm_set1_epi8(-1));
+    });
+#endif
+    while (pos < s.size() && s[pos] != '"' && s[pos] != '\\')
+        ++pos;
+    return pos;
+}
+
+// skip to the end of line, which libc's memchr finds with simd
+static std::size_t skip_line(std::string_view s, std::size_t pos)
+{
+    auto eol = static_cast<const char*>(
+        std::memchr(s.data() + pos, '\n', s.size() - pos));
+    return eol ? eol - s.data() : s.size();
+}
+
+Token Lexer::make_token(TokenType type, std::uint32_t value_index)
+{
+    Token token { type, static_cast<std::uint32_t>(m_start),
+        static_cast<std::uint32_t>(m_end - m_start), value_index };
+    consume();
+    ++m_token_count;
+    return token;
+}
+
+Token Lexer::eof_token()
+{
+    // nothing is lexed after an error
+    m_start = m_end = m_source.size();
+    return Token { TokenType::Eof, static_cast<std::uint32_t>(m_source.size()), 0 };
+}
+
+Token Lexer::next_token()
+{
     while (m_start < m_source.size()) {
         assert(m_start == m_end);
         auto ch = next();
@@ -151,103 +346,80 @@ std::vector<Token> Lexer::lex()
         case '\t':
         case '\r':
         case '\n':
+            m_end = skip_whitespace(m_source, m_end);
             consume();
             break;
         case '(':
-            add_token(TokenType::LeftParen);
-            break;
+            return make_token(TokenType::LeftParen);
         case ')':
-            add_token(TokenType::RightParen);
-            break;
+            return make_token(TokenType::RightParen);
         case '{':
-            add_token(TokenType::LeftBrace);
-            break;
+            return make_token(TokenType::LeftBrace);
         case '}':
-            add_token(TokenType::RightBrace);
-            break;
+            return make_token(TokenType::RightBrace);
+        case '[':
+            return make_token(TokenType::LeftBracket);
+        case ']':
+            return make_token(TokenType::RightBracket);
         case ',':
-            add_token(TokenType::Comma);
-            break;
+            return make_token(TokenType::Comma);
         case '.':
-            add_token(TokenType::Dot);
-            break;
+            return make_token(TokenType::Dot);
         case '-':
-            add_token(TokenType::Minus);
-            break;
+            return make_token(TokenType::Minus);
         case '+':
-            add_token(TokenType::Plus);
-            break;
+            return make_token(TokenType::Plus);
         case ';':
-            add_token(TokenType::Semicolon);
-            break;
+            return make_token(TokenType::Semicolon);
+        case ':':
+            return make_token(TokenType::Colon);
         case '/':
             if (match('/')) {
-                while (more() && next() != '\n')
-                    advance();
+                m_end = skip_line(m_source, m_end);
                 consume();
             } else
-                add_token(TokenType::Slash);
+                return make_token(TokenType::Slash);
             break;
         case '*':
-            add_token(TokenType::Star);
-            break;
+            return make_token(TokenType::Star);
         case '%':
-            add_token(TokenType::Percent);
-            break;
+            return make_token(TokenType::Percent);
         case '!':
-            add_token(match('=') ? TokenType::BangEqual : TokenType::Bang);
-            break;
+            return make_token(match('=') ? TokenType::BangEqual : TokenType::Bang);
         case '=':
-            add_token(match('=') ? TokenType::EqualEqual : TokenType::Equal);
-            break;
+            return make_token(match('=') ? TokenType::EqualEqual : TokenType::Equal);
         case '>':
-            add_token(match('=') ? TokenType::GreaterEqual : TokenType::Greater);
-            break;
+            return make_token(match('=') ? TokenType::GreaterEqual : TokenType::Greater);
         case '<':
-            add_token(match('=') ? TokenType::LessEqual : TokenType::Less);
-            break;
+            return make_token(match('=') ? TokenType::LessEqual : TokenType::Less);
         case '"': {
             int num_escapes = 0;
-            while (more() && next() != '"') {
-                auto ch = next();
+            while ((m_end = skip_string_chars(m_source, m_end)) < m_source.size() &&
+                next() == '\\') {
+                ++num_escapes;
                 advance();
-                if (ch == '\\') {
-                    ++num_escapes;
-                    if (more())
-                        advance();
-                }
+                if (more())
+                    advance();
             }
             if (!more()) {
                 error("unterminated string");
-                return {};
+                return eof_token();
             }
             advance();
             assert(m_end >= m_start + 2);
-            auto substr = m_source.substr(m_start + 1, m_end - m_start - 2);
-            auto value = std::string(substr);
-            if (num_escapes > 0 && !unescape(value))
-                return {};
-            add_token(TokenType::String, std::move(value));
-            break;
+            if (num_escapes == 0)
+                return make_token(TokenType::String);
+            auto value = std::string(m_source.substr(m_start + 1, m_end - m_start - 2));
+            if (!unescape(value))
+                return eof_token();
+            return make_token(TokenType::String, m_table.add_string(std::move(value)));
         }
         default:
             if (is_identifier_first_char(ch)) {
-                while (is_identifier_char(peek()))
-                    advance();
-                if (auto keyword = keywords.find(token_text());
-                    keyword != keywords.end()) {
-                    switch (auto type = keyword->second) {
-                    case TokenType::False:
-                        add_token(type, false);
-                        break;
-                    case TokenType::True:
-                        add_token(type, true);
-                        break;
-                    default:
-                        add_token(type);
-                    }
-                } else
-                    add_token(TokenType::Identifier);
+                m_end = skip_identifier_chars(m_source, m_end);
+                if (auto keyword = keywords.find(token_text()))
+                    return make_token(keyword->type);
+                return make_token(TokenType::Identifier);
             } else if (is_ascii_digit(ch)) {
                 double num = 0;
                 auto ptr_start = m_source.data() + m_start;
@@ -257,18 +429,32 @@ std::vector<Token> Lexer::lex()
                 m_end = m_start + (ptr_end - ptr_start);
                 assert(m_end <= m_source.size());
                 if (ec == std::errc())
-                    add_token(TokenType::Number, num);
+                    return make_token(TokenType::Number, m_table.add_number(num));
                 else if (ec == std::errc::result_out_of_range) {
                     error("literal exceeds range of double-precision floating point");
-                    return {};
+                    return eof_token();
                 } else
                     assert(0); // unknown error, shouldn't happen
             } else {
                 error("unknown token");
-                return {};
+                return eof_token();
             }
         }
     }
+    return eof_token();
+}
+
+std::vector<Token> Lexer::lex()
+{
+    std::vector<Token> tokens;
+    // code averages a token per 3-6 chars; growing the vector moves every
+    // token, which costs more than lexing them, while reserved memory that
+    // stays unused is never touched
+    tokens.reserve(m_source.size() / 3);
+    for (auto token = next_token(); token.type() != TokenType::Eof; token = next_token())
+        tokens.push_back(std::move(token));
+    if (has_errors())
+        return {};
     return tokens;
 }
 
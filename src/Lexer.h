@@ -1,6 +1,8 @@
 #pragma once
 
 #include "Utils.h"
+#include <cstdint>
+#include <deque>
 #include <variant>
 #include <vector>
 #include <string>
@@ -13,11 +15,14 @@ namespace Lox {
     __TOKEN(RightParen)     \
     __TOKEN(LeftBrace)      \
     __TOKEN(RightBrace)     \
+    __TOKEN(LeftBracket)    \
+    __TOKEN(RightBracket)   \
     __TOKEN(Comma)          \
     __TOKEN(Dot)            \
     __TOKEN(Minus)          \
     __TOKEN(Plus)           \
     __TOKEN(Semicolon)      \
+    __TOKEN(Colon)          \
     __TOKEN(Star)           \
     __TOKEN(Bang)           \
     __TOKEN(BangEqual)      \
@@ -54,28 +59,67 @@ namespace Lox {
     __TOKEN(While)          \
     __TOKEN(Eof)
 
-enum class TokenType {
+enum class TokenType : std::uint8_t {
 #define __TOKEN(x) x,
     FOR_EACH_TOKEN_TYPE
 #undef __TOKEN
 };
 
+// The source and decoded literals that tokens of one lex refer to.
+class TokenTable {
+public:
+    explicit TokenTable(std::string_view source) : m_source(source)
+    {}
+
+    std::string_view source() const { return m_source; }
+
+    std::uint32_t add_number(double num)
+    {
+        m_numbers.push_back(num);
+        return m_numbers.size() - 1;
+    }
+    // only strings w/ escapes are stored, others are read from source
+    std::uint32_t add_string(std::string&& str)
+    {
+        m_strings.push_back(std::move(str));
+        return m_strings.size() - 1;
+    }
+
+    double number(std::uint32_t index) const { return m_numbers[index]; }
+    std::string_view string(std::uint32_t index) const { return m_strings[index]; }
+
+private:
+    std::string_view m_source;
+    std::vector<double> m_numbers;
+    // deque doesn't move the strings, so views of them stay valid
+    std::deque<std::string> m_strings;
+};
+
 class Token {
 public:
     using DefaultValueType = std::monostate;
-    using ValueType = std::variant<DefaultValueType, bool, double, std::string>;
+    using ValueType = std::variant<DefaultValueType, bool, double, std::string_view>;
 
-    Token(TokenType type, std::string_view text, ValueType&& value = DefaultValueType())
-        : m_type(type)
-        , m_text(text)
-        , m_value(std::move(value))
+    static constexpr std::uint32_t NO_VALUE = -1;
+
+    Token() : Token(TokenType::Eof, 0, 0)
+    {}
+    Token(TokenType type, std::uint32_t offset, std::uint32_t length,
+        std::uint32_t value_index = NO_VALUE)
+        : m_offset(offset)
+        , m_length(length)
+        , m_value_index(value_index)
+        , m_type(type)
     {}
 
     bool operator==(const Token&) const = default;
 
     TokenType type() const { return m_type; }
-    std::string_view text() const { return m_text; }
-    const ValueType& value() const { return m_value; }
+    std::string_view text(const TokenTable& table) const
+    {
+        return table.source().substr(m_offset, m_length);
+    }
+    ValueType value(const TokenTable&) const;
 
     std::string type_string() const
     {
@@ -88,25 +132,33 @@ public:
         }
         assert(0);
     }
-    std::string value_string() const;
-    std::string dump() const;
+    std::string value_string(const TokenTable&) const;
+    std::string dump(const TokenTable&) const;
 
 private:
-    const TokenType m_type;
-    std::string_view m_text;
-    ValueType m_value;
+    std::uint32_t m_offset;
+    std::uint32_t m_length;
+    // into the table's numbers or strings, depending on type
+    std::uint32_t m_value_index;
+    TokenType m_type;
 };
 
+static_assert(sizeof(Token) <= 16);
+
 #undef FOR_EACH_TOKEN_TYPE
 
 class Lexer {
 public:
-    Lexer(std::string_view source) : m_source(source)
-    {
-        assert(source.data());
-    }
+    Lexer(std::string_view source);
 
+    // Eof at the end of source or after an error, and forever after
+    Token next_token();
+    // all tokens until Eof, or empty on error
     std::vector<Token> lex();
+    // for reading the text and values of tokens, lives as long as the lexer
+    const TokenTable& table() const { return m_table; }
+    std::string_view source() const { return m_source; }
+    std::size_t token_count() const { return m_token_count; }
     bool has_errors() const { return m_errors.size() > 0; }
     const std::vector<Error>& errors() const { return m_errors; }
 
@@ -118,13 +170,17 @@ private:
     char peek() const { return more() ? next() : 0; }
     bool match(char next);
 
+    Token make_token(TokenType, std::uint32_t value_index = Token::NO_VALUE);
+    Token eof_token();
     std::string_view token_text() const;
     bool unescape(std::string&);
     void error(std::string msg, std::string_view span = {});
 
     std::string_view m_source;
+    TokenTable m_table;
     std::size_t m_start { 0 };
     std::size_t m_end { 0 };
+    std::size_t m_token_count { 0 };
     std::vector<Error> m_errors;
 };
 
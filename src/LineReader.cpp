@@ -0,0 +1,81 @@
+#include "LineReader.h"
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+namespace Lox {
+
+LineReader::LineReader(int fd, bool owns_fd)
+    : m_fd(fd)
+    , m_owns_fd(owns_fd)
+    , m_buffer(BLOCK_SIZE, '\0')
+{}
+
+LineReader::~LineReader()
+{
+    close();
+}
+
+void LineReader::close()
+{
+    if (m_owns_fd && m_fd >= 0)
+        ::close(m_fd);
+    m_fd = -1;
+}
+
+bool LineReader::fill()
+{
+    if (m_eof || m_error)
+        return false;
+    // move the unread start of a line to the front, and make room for
+    // a block after it
+    if (m_pos > 0) {
+        std::memmove(m_buffer.data(), m_buffer.data() + m_pos, m_end - m_pos);
+        m_end -= m_pos;
+        m_pos = 0;
+    }
+    if (m_buffer.size() - m_end < BLOCK_SIZE)
+        m_buffer.resize(m_end + BLOCK_SIZE);
+    for (;;) {
+        auto n = read(m_fd, m_buffer.data() + m_end, m_buffer.size() - m_end);
+        if (n > 0) {
+            m_end += n;
+            return true;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            m_error = errno;
+        else
+            m_eof = true;
+        close();
+        return false;
+    }
+}
+
+std::optional<std::string_view> LineReader::next()
+{
+    // where to continue looking for '\n' after a fill
+    auto scanned = m_pos;
+    for (;;) {
+        auto data = m_buffer.data();
+        auto nl = static_cast<const char*>(
+            std::memchr(data + scanned, '\n', m_end - scanned));
+        if (nl) {
+            std::string_view line(data + m_pos, nl - (data + m_pos));
+            m_pos += line.size() + 1;
+            return line;
+        }
+        // fill moves the unread part to the front
+        scanned = m_end - m_pos;
+        if (!fill())
+            break;
+    }
+    if (m_error || m_pos == m_end)
+        return {};
+    std::string_view line(m_buffer.data() + m_pos, m_end - m_pos);
+    m_pos = m_end;
+    return line;
+}
+
+}
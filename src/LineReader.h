@@ -0,0 +1,49 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace Lox {
+
+// Lines of a file read in blocks, so that a file of any size is read in
+// memory of about a block, or of its longest line if that's longer. Lines
+// are split at '\n', which isn't part of them; a last line without '\n'
+// is a line too.
+class LineReader {
+public:
+    static constexpr std::size_t BLOCK_SIZE = 64 * 1024;
+
+    // if owns_fd, fd is closed by the reader, as soon as it's read to
+    // the end
+    LineReader(int fd, bool owns_fd);
+    ~LineReader();
+
+    LineReader(const LineReader&) = delete;
+    LineReader& operator=(const LineReader&) = delete;
+
+    // next line, valid until the next call; empty at the end of the file
+    // or on a read error, which sets error()
+    std::optional<std::string_view> next();
+
+    // errno of a failed read, 0 if none
+    int error() const { return m_error; }
+    std::size_t buffer_size() const { return m_buffer.size(); }
+
+private:
+    // read a block after the unread part of the buffer; return false at
+    // the end of the file or on error
+    bool fill();
+    void close();
+
+    int m_fd;
+    bool m_owns_fd;
+    bool m_eof { false };
+    int m_error { 0 };
+    std::string m_buffer;
+    // unread part of the buffer
+    std::size_t m_pos { 0 };
+    std::size_t m_end { 0 };
+};
+
+}
@@ -0,0 +1,354 @@
+#include "Interpreter.h"
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <format>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace Lox {
+
+// A control byte is EMPTY, DELETED (a tombstone, which lookups probe past)
+// or the low 7 bits of the hash of the key in its slot. Only EMPTY and
+// DELETED have the sign bit set.
+static constexpr std::int8_t EMPTY = -128;
+static constexpr std::int8_t DELETED = -2;
+
+static constexpr std::size_t GROUP_WIDTH = 16;
+static constexpr std::size_t MIN_CAPACITY = GROUP_WIDTH;
+
+// at most 7/8 of the slots are full or deleted
+static std::size_t max_used(std::size_t capacity)
+{
+    return capacity - capacity / 8;
+}
+
+static std::int8_t h2(std::size_t hash)
+{
+    return static_cast<std::int8_t>(hash & 0x7f);
+}
+
+static std::size_t h1(std::size_t hash)
+{
+    return hash >> 7;
+}
+
+// the control bytes of GROUP_WIDTH consecutive slots, matched against a
+// byte at once; a match is a bit mask of the slots
+class Group {
+public:
+    explicit Group(const std::int8_t* ctrl)
+#ifdef __SSE2__
+        : m_ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl)))
+#else
+        : m_ctrl(ctrl)
+#endif
+    {}
+
+#ifdef __SSE2__
+    std::uint32_t match(std::int8_t byte) const
+    {
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(m_ctrl, _mm_set1_epi8(byte)));
+    }
+
+    std::uint32_t match_empty_or_deleted() const
+    {
+        return _mm_movemask_epi8(m_ctrl);
+    }
+#else
+    std::uint32_t match(std::int8_t byte) const
+    {
+        std::uint32_t mask = 0;
+        for (std::size_t i = 0; i < GROUP_WIDTH; ++i)
+            mask |= static_cast<std::uint32_t>(m_ctrl[i] == byte) << i;
+        return mask;
+    }
+
+    std::uint32_t match_empty_or_deleted() const
+    {
+        std::uint32_t mask = 0;
+        for (std::size_t i = 0; i < GROUP_WIDTH; ++i)
+            mask |= static_cast<std::uint32_t>(m_ctrl[i] < 0) << i;
+        return mask;
+    }
+#endif
+
+    std::uint32_t match_empty() const { return match(EMPTY); }
+
+private:
+#ifdef __SSE2__
+    __m128i m_ctrl;
+#else
+    const std::int8_t* m_ctrl;
+#endif
+};
+
+// Groups are probed in triangular steps, which visit every group of
+// a power of 2 count of them.
+class ProbeSeq {
+public:
+    ProbeSeq(std::size_t hash, std::size_t capacity)
+        : m_mask(capacity / GROUP_WIDTH - 1)
+        , m_group(h1(hash) & m_mask)
+    {}
+
+    std::size_t offset() const { return m_group * GROUP_WIDTH; }
+
+    void next()
+    {
+        ++m_step;
+        m_group = (m_group + m_step) & m_mask;
+    }
+
+private:
+    std::size_t m_mask;
+    std::size_t m_group;
+    std::size_t m_step { 0 };
+};
+
+// from murmur3, so that numbers which differ only in their high bits
+// don't all land in the same group
+static std::size_t mix(std::uint64_t bits)
+{
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    bits *= 0xc4ceb9fe1a85ec53ULL;
+    bits ^= bits >> 33;
+    return bits;
+}
+
+static std::size_t hash_value(const Value& key)
+{
+    if (key.is_number()) {
+        // -0 == 0, so they must hash the same
+        auto num = key.get_number();
+        return mix(std::bit_cast<std::uint64_t>(num == 0 ? 0.0 : num));
+    }
+    if (key.is_bool())
+        return key.get_bool() ? 0x9e3779b97f4a7c15ULL : 0x7f4a7c159e3779b9ULL;
+    if (key.is_niltype())
+        return 0x517cc1b727220a95ULL;
+    assert(key.is_string());
+    return static_cast<const String&>(key.get_object()).hash();
+}
+
+static bool keys_equal(const Value& left, const Value& right)
+{
+    return left.tag() == right.tag() && left.__eq__(right);
+}
+
+bool is_hashable(const Value& value)
+{
+    // NaN isn't equal to itself, so no lookup could find it
+    if (value.is_number())
+        return !std::isnan(value.get_number());
+    return value.is_bool() || value.is_niltype() || value.is_string();
+}
+
+std::string not_hashable_message(const Value& value)
+{
+    if (value.is_number())
+        return "NaN is not hashable";
+    return std::format("'{}' object is not hashable", value.type_name());
+}
+
+class MapIterator : public Iterator {
+public:
+    explicit MapIterator(const Map& map)
+        : m_map(const_cast<Map*>(&map))
+    {}
+
+    void trace(Heap& heap) const override { heap.mark(m_map); }
+
+    // the map may be changed while iterated; keys set meanwhile may or may
+    // not be visited, as with a rehash they move to other slots
+    bool done() const override
+    {
+        m_pos = map().next_slot(m_pos);
+        return m_pos >= map().capacity();
+    }
+
+    Value next() override
+    {
+        assert(!done());
+        return map().key_at(m_pos++);
+    }
+
+private:
+    const Map& map() const
+    {
+        return static_cast<const Map&>(m_map.get_object());
+    }
+
+    Value m_map;
+    mutable std::size_t m_pos { 0 };
+};
+
+std::size_t Map::find(const Value& key, std::size_t hash) const
+{
+    if (m_capacity == 0)
+        return m_capacity;
+    for (ProbeSeq seq(hash, m_capacity);; seq.next()) {
+        Group group(&m_ctrl[seq.offset()]);
+        for (auto mask = group.match(h2(hash)); mask; mask &= mask - 1) {
+            auto slot = seq.offset() + std::countr_zero(mask);
+            if (keys_equal(m_entries[slot].key, key))
+                return slot;
+        }
+        // the key would have been put in the empty slot
+        if (group.match_empty())
+            return m_capacity;
+    }
+}
+
+std::size_t Map::find_free_slot(std::size_t hash) const
+{
+    assert(m_size + m_deleted < m_capacity);
+    for (ProbeSeq seq(hash, m_capacity);; seq.next()) {
+        Group group(&m_ctrl[seq.offset()]);
+        if (auto mask = group.match_empty_or_deleted())
+            return seq.offset() + std::countr_zero(mask);
+    }
+}
+
+Value Map::get(const Value& key) const
+{
+    if (!is_hashable(key))
+        return {};
+    auto slot = find(key, hash_value(key));
+    return slot < m_capacity ? m_entries[slot].value : Value();
+}
+
+void Map::set(const Value& key, const Value& value)
+{
+    assert(is_hashable(key) && value);
+    auto hash = hash_value(key);
+    auto slot = find(key, hash);
+    if (slot < m_capacity) {
+        m_entries[slot].value = value;
+        return;
+    }
+    if (m_size + m_deleted + 1 > max_used(m_capacity)) {
+        // if tombstones take much of the room, dropping them is enough
+        auto grow = m_size + 1 > max_used(m_capacity) / 2;
+        rehash(m_capacity == 0 ? MIN_CAPACITY
+                : grow         ? m_capacity * 2
+                               : m_capacity);
+    }
+    slot = find_free_slot(hash);
+    if (m_ctrl[slot] == DELETED)
+        --m_deleted;
+    m_ctrl[slot] = h2(hash);
+    m_entries[slot] = { key, value };
+    ++m_size;
+}
+
+bool Map::remove(const Value& key)
+{
+    if (!is_hashable(key))
+        return false;
+    auto slot = find(key, hash_value(key));
+    if (slot >= m_capacity)
+        return false;
+    m_ctrl[slot] = DELETED;
+    // so that they may be collected
+    m_entries[slot] = {};
+    --m_size;
+    ++m_deleted;
+    return true;
+}
+
+void Map::rehash(std::size_t capacity)
+{
+    assert(capacity >= MIN_CAPACITY && std::has_single_bit(capacity));
+    auto old_ctrl = std::move(m_ctrl);
+    auto old_entries = std::move(m_entries);
+    auto old_capacity = m_capacity;
+    m_ctrl = std::make_unique_for_overwrite<std::int8_t[]>(capacity);
+    std::memset(m_ctrl.get(), EMPTY, capacity);
+    m_entries = std::make_unique<Entry[]>(capacity);
+    m_capacity = capacity;
+    m_deleted = 0;
+    for (std::size_t i = 0; i < old_capacity; ++i) {
+        if (old_ctrl[i] < 0)
+            continue;
+        auto slot = find_free_slot(hash_value(old_entries[i].key));
+        m_ctrl[slot] = old_ctrl[i];
+        m_entries[slot] = old_entries[i];
+    }
+    if (capacity > old_capacity)
+        heap().grow(*this, (capacity - old_capacity) * (1 + sizeof(Entry)));
+}
+
+std::size_t Map::next_slot(std::size_t slot) const
+{
+    while (slot < m_capacity && m_ctrl[slot] < 0)
+        ++slot;
+    return slot;
+}
+
+const Value& Map::key_at(std::size_t slot) const
+{
+    assert(slot < m_capacity && m_ctrl[slot] >= 0);
+    return m_entries[slot].key;
+}
+
+bool Map::__eq__(const Object& rhs) const
+{
+    assert(rhs.tag() == TypeTag::Map);
+    auto& map = static_cast<const Map&>(rhs);
+    if (&map == this)
+        return true;
+    if (map.size() != size())
+        return false;
+    for (auto slot = next_slot(0); slot < m_capacity; slot = next_slot(slot + 1)) {
+        auto& left = m_entries[slot].value;
+        auto right = map.get(m_entries[slot].key);
+        // unlike ==, values of different types are just unequal
+        if (!right || left.tag() != right.tag() || !left.__eq__(right))
+            return false;
+    }
+    return true;
+}
+
+std::string Map::__str__() const
+{
+    if (m_printing)
+        return "{...}";
+    TemporaryChange<bool> printing(m_printing, true);
+    auto str = [](const Value& value) {
+        return value.is_string() ? escape(value.__str__()) : value.__str__();
+    };
+    std::string s = "{";
+    for (auto slot = next_slot(0); slot < m_capacity; slot = next_slot(slot + 1)) {
+        if (s.size() > 1)
+            s += ", ";
+        s += str(m_entries[slot].key);
+        s += ": ";
+        s += str(m_entries[slot].value);
+    }
+    s += '}';
+    return s;
+}
+
+Value Map::__iter__() const
+{
+    return Value(heap().make<MapIterator>(*this));
+}
+
+std::size_t Map::external_size() const
+{
+    return m_capacity * (1 + sizeof(Entry));
+}
+
+void Map::trace(Heap& heap) const
+{
+    for (auto slot = next_slot(0); slot < m_capacity; slot = next_slot(slot + 1)) {
+        heap.mark(m_entries[slot].key);
+        heap.mark(m_entries[slot].value);
+    }
+}
+
+}
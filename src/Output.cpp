@@ -0,0 +1,59 @@
+#include "Output.h"
+#include <cerrno>
+
+namespace Lox {
+
+static bool write_all(int fd, std::string_view data)
+{
+    while (!data.empty()) {
+        auto n = ::write(fd, data.data(), data.size());
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data.remove_prefix(n);
+    }
+    return true;
+}
+
+Output::Output(int fd, std::size_t capacity)
+    : m_fd(fd)
+    , m_capacity(capacity)
+    , m_line_buffered(isatty(fd))
+{
+    m_buffer.reserve(capacity);
+}
+
+void Output::write(std::string_view data)
+{
+    if (data.size() > m_capacity - m_buffer.size()) {
+        flush();
+        // data that doesn't fit an empty buffer isn't copied into it
+        if (data.size() >= m_capacity) {
+            write_all(m_fd, data);
+            return;
+        }
+    }
+    m_buffer.append(data);
+    if (m_line_buffered && data.find('\n') != data.npos)
+        flush();
+}
+
+bool Output::flush()
+{
+    if (m_buffer.empty())
+        return true;
+    auto ok = write_all(m_fd, m_buffer);
+    m_buffer.clear();
+    return ok;
+}
+
+void Output::set_capacity(std::size_t capacity)
+{
+    flush();
+    m_capacity = capacity;
+    m_buffer.reserve(capacity);
+}
+
+}
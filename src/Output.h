@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unistd.h>
+
+namespace Lox {
+
+// Buffered writer of a program's output to a file descriptor. Output is
+// collected in the buffer and written with one write(2) when it fills
+// up, so that printing many short lines costs one syscall per buffer
+// rather than one per line. Like stdio, output to a terminal is flushed
+// at the end of every line. The interpreter flushes it whenever output
+// must be seen: after a program, before reporting an error and before
+// reading input.
+class Output {
+public:
+    static constexpr std::size_t DEFAULT_CAPACITY = 64 * 1024;
+
+    explicit Output(int fd = STDOUT_FILENO,
+        std::size_t capacity = DEFAULT_CAPACITY);
+    ~Output() { flush(); }
+
+    Output(const Output&) = delete;
+    Output& operator=(const Output&) = delete;
+
+    void write(std::string_view data);
+    // write out what's buffered; on failure, drop it and return false with
+    // errno set
+    bool flush();
+
+    std::size_t capacity() const { return m_capacity; }
+    // flushes first; with capacity 0, output is written unbuffered
+    void set_capacity(std::size_t capacity);
+    bool is_line_buffered() const { return m_line_buffered; }
+
+private:
+    int m_fd;
+    std::size_t m_capacity;
+    std::string m_buffer;
+    bool m_line_buffered;
+};
+
+}
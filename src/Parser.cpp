@@ -1,23 +1,30 @@
 #include "Parser.h"
+#include <array>
 #include <cassert>
 #include <format>
 
 namespace Lox {
 
-static const Token EOF_TOKEN { TokenType::Eof, {} };
-
-const Token& Parser::peek() const
+const Token& Parser::lookahead(std::size_t n)
 {
-    if (m_cur < m_tokens.size())
-        return m_tokens[m_cur];
-    return EOF_TOKEN;
+    assert(n < LOOKAHEAD_SIZE);
+    while (m_lookahead_count <= n) {
+        auto slot = (m_lookahead_start + m_lookahead_count) % LOOKAHEAD_SIZE;
+        m_lookahead[slot] = m_lexer.next_token();
+        ++m_lookahead_count;
+    }
+    return m_lookahead[(m_lookahead_start + n) % LOOKAHEAD_SIZE];
 }
 
-const Token& Parser::peek2() const
+void Parser::advance()
 {
-    if (m_cur + 1 < m_tokens.size())
-        return m_tokens[m_cur + 1];
-    return EOF_TOKEN;
+    auto& token = peek();
+    // the lexer keeps returning eof
+    if (token.type() == TokenType::Eof)
+        return;
+    m_last_text = token.text(m_table);
+    m_lookahead_start = (m_lookahead_start + 1) % LOOKAHEAD_SIZE;
+    --m_lookahead_count;
 }
 
 bool Parser::match(TokenType next, std::string_view err_msg)
@@ -28,7 +35,7 @@ bool Parser::match(TokenType next, std::string_view err_msg)
         return true;
     }
     if (!err_msg.empty())
-        error(std::string(err_msg), token.text());
+        error(std::string(err_msg), token.text(m_table));
     return false;
 }
 
@@ -41,8 +48,8 @@ void Parser::error(std::string msg, std::string_view span)
 
     assert(peek().type() == TokenType::Eof);
     // w/out tokens there can't be errors, so there must be at least one token
-    assert(m_tokens.size() > 0);
-    m_errors.push_back({ std::move(msg), m_source, m_tokens.back().text() });
+    assert(!m_last_text.empty());
+    m_errors.push_back({ std::move(msg), m_source, m_last_text });
 }
 
 static std::string_view merge_texts(std::string_view start, std::string_view end)
@@ -55,34 +62,36 @@ static std::string_view merge_texts(std::string_view start, std::string_view end
     return std::string_view(start.data(), end.data() - start.data() + end.size());
 }
 
-std::shared_ptr<Identifier> Parser::parse_identifier()
+Identifier* Parser::parse_identifier()
 {
-    if (auto& token = peek(); token.type() == TokenType::Identifier) {
+    if (auto text = peek().text(m_table); peek().type() == TokenType::Identifier) {
         advance();
-        return std::make_shared<Identifier>(token.text(), token.text());
+        return m_arena.make<Identifier>(text, text);
     } else
-        error("expected identifier", token.text());
+        error("expected identifier", text);
     return {};
 }
 
-std::shared_ptr<FunctionExpr> Parser::parse_function(const Token& fn_token)
+FunctionExpr* Parser::parse_function(std::string_view fn_text)
 {
     if (!match(TokenType::LeftParen, "expected '('"))
         return {};
 
-    std::vector<std::shared_ptr<Identifier>> params;
+    auto params_base = m_ident_scratch.size();
     if (!match(TokenType::RightParen)) {
         do {
             auto ident = parse_identifier();
             if (!ident)
                 return {};
-            params.push_back(ident);
+            m_ident_scratch.push_back(ident);
         } while (match(TokenType::Comma));
 
         if (!match(TokenType::RightParen, "expected ')'"))
             return {};
     }
 
+    auto params = take_list(m_ident_scratch, params_base);
+
     start_function_context();
     auto block = parse_block_statement();
     end_function_context();
@@ -106,259 +115,282 @@ std::shared_ptr<FunctionExpr> Parser::parse_function(const Token& fn_token)
         }
     }
 
-    return std::make_shared<FunctionExpr>(std::move(params), block,
-        merge_texts(fn_token.text(), block->text()));
+    return m_arena.make<FunctionExpr>(params, block,
+        merge_texts(fn_text, block->text()));
 }
 
-std::shared_ptr<Expr> Parser::parse_primary()
+Expr* Parser::parse_primary()
 {
-    if (auto& token = peek(); token.type() == TokenType::String) {
+    auto& token = peek();
+    auto text = token.text(m_table);
+    if (token.type() == TokenType::String) {
+        auto value = m_arena.copy(std::get<std::string_view>(token.value(m_table)));
         advance();
-        return std::make_shared<StringLiteral>(std::get<std::string>(token.value()),
-                                               token.text());
+        return m_arena.make<StringLiteral>(value, text);
     } else if (token.type() == TokenType::Number) {
+        auto value = std::get<double>(token.value(m_table));
         advance();
-        return std::make_shared<NumberLiteral>(std::get<double>(token.value()),
-                                               token.text());
+        return m_arena.make<NumberLiteral>(value, text);
     } else if (token.type() == TokenType::Identifier) {
         advance();
-        return std::make_shared<Identifier>(token.text(), token.text());
+        return m_arena.make<Identifier>(text, text);
     } else if (token.type() == TokenType::True ||
                token.type() == TokenType::False) {
+        auto value = std::get<bool>(token.value(m_table));
         advance();
-        return std::make_shared<BoolLiteral>(std::get<bool>(token.value()),
-                                             token.text());
+        return m_arena.make<BoolLiteral>(value, text);
     } else if (token.type() == TokenType::Nil) {
         advance();
-        return std::make_shared<NilLiteral>(token.text());
+        return m_arena.make<NilLiteral>(text);
     } else if (token.type() == TokenType::LeftParen) {
         advance();
         if (auto expr = parse_expression()) {
-            if (auto& closing = peek(); closing.type() == TokenType::RightParen) {
+            if (auto closing = peek().text(m_table); peek().type() == TokenType::RightParen) {
                 advance();
-                return std::make_shared<GroupExpr>(expr,
-                    merge_texts(token.text(), closing.text()));
+                return m_arena.make<GroupExpr>(expr, merge_texts(text, closing));
             } else
-                error("'(' was never closed", token.text());
+                error("'(' was never closed", text);
         }
         return {};
+    } else if (token.type() == TokenType::LeftBracket) {
+        advance();
+        return parse_list(text);
+    } else if (token.type() == TokenType::LeftBrace) {
+        advance();
+        return parse_map(text);
     } else if (token.type() == TokenType::Fn) {
         advance();
-        return parse_function(token);
+        return parse_function(text);
     } else
-        error("expected expression", token.text());
+        error("expected expression", text);
     return {};
 }
 
-std::shared_ptr<Expr> Parser::parse_call()
+Expr* Parser::parse_call(Expr* callee)
 {
-    auto expr = parse_primary();
-    if (!expr)
-        return {};
-
-    while (match(TokenType::LeftParen)) {
-        auto end = peek().text();
-        std::vector<std::shared_ptr<Expr>> args;
-        if (!match(TokenType::RightParen)) {
-            do {
-                auto arg = parse_expression();
-                if (!arg)
-                    return {};
-                args.push_back(arg);
-            } while (match(TokenType::Comma));
-
-            end = peek().text();
-            if (!match(TokenType::RightParen, "expected ')'"))
+    assert(peek().type() == TokenType::LeftParen);
+    advance();
+    auto end = peek().text(m_table);
+    auto args_base = m_expr_scratch.size();
+    if (!match(TokenType::RightParen)) {
+        do {
+            auto arg = parse_expression();
+            if (!arg)
                 return {};
-        }
-        expr = std::make_shared<CallExpr>(expr, std::move(args),
-            merge_texts(expr->text(), end));
+            m_expr_scratch.push_back(arg);
+        } while (match(TokenType::Comma));
+
+        end = peek().text(m_table);
+        if (!match(TokenType::RightParen, "expected ')'"))
+            return {};
     }
-    return expr;
+    return m_arena.make<CallExpr>(callee,
+        take_list(m_expr_scratch, args_base),
+        merge_texts(callee->text(), end));
 }
 
-std::shared_ptr<Expr> Parser::parse_unary()
+Expr* Parser::parse_list(std::string_view lbracket)
 {
-    if (auto& token = peek(); token.type() == TokenType::Minus ||
-        token.type() == TokenType::Bang) {
-        advance();
-        if (auto expr = parse_unary()) {
-            UnaryOp op = [&token]() {
-                switch (token.type()) {
-                case TokenType::Minus:
-                    return UnaryOp::Minus;
-                case TokenType::Bang:
-                    return UnaryOp::Not;
-                default:
-                    assert(0);
-                }
-            }();
-            return std::make_shared<UnaryExpr>(op, expr,
-                merge_texts(token.text(), expr->text()));
-        }
-        return {};
+    auto end = peek().text(m_table);
+    auto items_base = m_expr_scratch.size();
+    if (!match(TokenType::RightBracket)) {
+        do {
+            auto item = parse_expression();
+            if (!item)
+                return {};
+            m_expr_scratch.push_back(item);
+        } while (match(TokenType::Comma));
+
+        end = peek().text(m_table);
+        if (!match(TokenType::RightBracket, "expected ']'"))
+            return {};
     }
-    return parse_call();
+    return m_arena.make<ListExpr>(take_list(m_expr_scratch, items_base),
+        merge_texts(lbracket, end));
 }
 
-std::shared_ptr<Expr> Parser::parse_multiply()
+Expr* Parser::parse_map(std::string_view lbrace)
 {
-    auto left = parse_unary();
-    if (!left)
-        return {};
+    auto end = peek().text(m_table);
+    auto entries_base = m_expr_scratch.size();
+    if (!match(TokenType::RightBrace)) {
+        do {
+            auto key = parse_expression();
+            if (!key)
+                return {};
+            if (!match(TokenType::Colon, "expected ':'"))
+                return {};
+            auto value = parse_expression();
+            if (!value)
+                return {};
+            m_expr_scratch.push_back(key);
+            m_expr_scratch.push_back(value);
+        } while (match(TokenType::Comma));
 
-    for (;;) {
-        auto& token = peek();
-        if (!(token.type() == TokenType::Slash ||
-            token.type() == TokenType::Star ||
-            token.type() == TokenType::Percent))
-            break;
-        advance();
-        auto right = parse_unary();
-        if (!right)
+        end = peek().text(m_table);
+        if (!match(TokenType::RightBrace, "expected '}'"))
             return {};
-        BinaryOp op = [&token]() {
-            switch (token.type()) {
-            case TokenType::Slash:
-                return BinaryOp::Divide;
-            case TokenType::Star:
-                return BinaryOp::Multiply;
-            case TokenType::Percent:
-                return BinaryOp::Modulo;
-            default:
-                assert(0);
-            }
-        }();
-        left = std::make_shared<BinaryExpr>(op, left, right,
-            merge_texts(left->text(), right->text()));
     }
-    return left;
+    return m_arena.make<MapExpr>(take_list(m_expr_scratch, entries_base),
+        merge_texts(lbrace, end));
 }
 
-std::shared_ptr<Expr> Parser::parse_add()
+Expr* Parser::parse_index(Expr* object)
 {
-    auto left = parse_multiply();
-    if (!left)
+    assert(peek().type() == TokenType::LeftBracket);
+    advance();
+    auto index = parse_expression();
+    if (!index)
+        return {};
+    auto end = peek().text(m_table);
+    if (!match(TokenType::RightBracket, "expected ']'"))
         return {};
+    return m_arena.make<IndexExpr>(object, index, merge_texts(object->text(), end));
+}
 
-    for (;;) {
-        auto& token = peek();
-        if (!(token.type() == TokenType::Plus ||
-            token.type() == TokenType::Minus))
-            break;
-        advance();
-        auto right = parse_multiply();
-        if (!right)
-            return {};
-        BinaryOp op = [&token]() {
+Expr* Parser::parse_unary()
+{
+    if (auto& token = peek(); token.type() == TokenType::Minus ||
+        token.type() == TokenType::Bang) {
+        UnaryOp op = [&token]() {
             switch (token.type()) {
-            case TokenType::Plus:
-                return BinaryOp::Add;
             case TokenType::Minus:
-                return BinaryOp::Subtract;
+                return UnaryOp::Minus;
+            case TokenType::Bang:
+                return UnaryOp::Not;
             default:
                 assert(0);
             }
         }();
-        left = std::make_shared<BinaryExpr>(op, left, right,
-            merge_texts(left->text(), right->text()));
+        auto text = token.text(m_table);
+        advance();
+        if (auto expr = parse_expression(Precedence::Unary))
+            return m_arena.make<UnaryExpr>(op, expr, merge_texts(text, expr->text()));
+        return {};
     }
-    return left;
+    return parse_primary();
 }
 
-std::shared_ptr<Expr> Parser::parse_compare()
-{
-    auto left = parse_add();
-    if (!left)
-        return {};
+namespace {
+
+enum class Associativity : std::uint8_t {
+    Left,
+    Right,
+    // a < b < c is an error
+    None,
+};
+
+enum class InfixKind : std::uint8_t {
+    Binary,
+    Logical,
+    Call,
+    Index,
+};
+
+struct InfixRule {
+    Parser::Precedence precedence { Parser::Precedence::None };
+    Associativity associativity { Associativity::Left };
+    InfixKind kind { InfixKind::Binary };
+    BinaryOp binary_op {};
+    LogicalOp logical_op {};
+};
 
-    if (auto& token = peek(); token.type() == TokenType::EqualEqual ||
-        token.type() == TokenType::BangEqual ||
-        token.type() == TokenType::Less ||
-        token.type() == TokenType::LessEqual ||
-        token.type() == TokenType::Greater ||
-        token.type() == TokenType::GreaterEqual) {
-        advance();
-        if (auto right = parse_add()) {
-            BinaryOp op = [&token]() {
-                switch (token.type()) {
-                case TokenType::EqualEqual:
-                    return BinaryOp::Equal;
-                case TokenType::BangEqual:
-                    return BinaryOp::NotEqual;
-                case TokenType::Less:
-                    return BinaryOp::Less;
-                case TokenType::LessEqual:
-                    return BinaryOp::LessOrEqual;
-                case TokenType::Greater:
-                    return BinaryOp::Greater;
-                case TokenType::GreaterEqual:
-                    return BinaryOp::GreaterOrEqual;
-                default:
-                    assert(0);
-                }
-            }();
-            return std::make_shared<BinaryExpr>(op, left, right,
-                merge_texts(left->text(), right->text()));
-        }
-        return {};
-    }
-    return left;
 }
 
-std::shared_ptr<Expr> Parser::parse_logical_and()
+// operators that follow their left operand, by token type
+static constexpr auto infix_rules = []() {
+    using enum Parser::Precedence;
+    std::array<InfixRule, static_cast<std::size_t>(TokenType::Eof) + 1> rules {};
+    auto binary = [&](TokenType type, Parser::Precedence prec, BinaryOp op,
+                      Associativity assoc = Associativity::Left) {
+        rules[static_cast<std::size_t>(type)] = { prec, assoc, InfixKind::Binary, op, {} };
+    };
+    auto logical = [&](TokenType type, Parser::Precedence prec, LogicalOp op) {
+        rules[static_cast<std::size_t>(type)] = { prec, Associativity::Left,
+            InfixKind::Logical, {}, op };
+    };
+    logical(TokenType::Or, Or, LogicalOp::Or);
+    logical(TokenType::And, And, LogicalOp::And);
+    binary(TokenType::EqualEqual, Compare, BinaryOp::Equal, Associativity::None);
+    binary(TokenType::BangEqual, Compare, BinaryOp::NotEqual, Associativity::None);
+    binary(TokenType::Less, Compare, BinaryOp::Less, Associativity::None);
+    binary(TokenType::LessEqual, Compare, BinaryOp::LessOrEqual, Associativity::None);
+    binary(TokenType::Greater, Compare, BinaryOp::Greater, Associativity::None);
+    binary(TokenType::GreaterEqual, Compare, BinaryOp::GreaterOrEqual,
+        Associativity::None);
+    binary(TokenType::Plus, Add, BinaryOp::Add);
+    binary(TokenType::Minus, Add, BinaryOp::Subtract);
+    binary(TokenType::Star, Multiply, BinaryOp::Multiply);
+    binary(TokenType::Slash, Multiply, BinaryOp::Divide);
+    binary(TokenType::Percent, Multiply, BinaryOp::Modulo);
+    rules[static_cast<std::size_t>(TokenType::LeftParen)] = { Call,
+        Associativity::Left, InfixKind::Call };
+    rules[static_cast<std::size_t>(TokenType::LeftBracket)] = { Call,
+        Associativity::Left, InfixKind::Index };
+    return rules;
+}();
+
+static Parser::Precedence next_precedence(Parser::Precedence prec)
 {
-    auto left = parse_compare();
-    if (!left)
-        return {};
-
-    while (match(TokenType::And)) {
-        auto right = parse_compare();
-        if (!right)
-            return {};
-        left = std::make_shared<LogicalExpr>(LogicalOp::And, left, right,
-            merge_texts(left->text(), right->text()));
-    }
-    return left;
+    return static_cast<Parser::Precedence>(static_cast<std::uint8_t>(prec) + 1);
 }
 
-std::shared_ptr<Expr> Parser::parse_logical_or()
+Expr* Parser::parse_expression(Precedence min_precedence)
 {
-    auto left = parse_logical_and();
+    assert(min_precedence > Precedence::None);
+    auto left = parse_unary();
     if (!left)
         return {};
 
-    while (match(TokenType::Or)) {
-        auto right = parse_logical_and();
-        if (!right)
-            return {};
-        left = std::make_shared<LogicalExpr>(LogicalOp::Or, left, right,
-            merge_texts(left->text(), right->text()));
+    // operators binding tighter than the last one were refused by its
+    // right operand, b/c they follow a non-associative operator there,
+    // so they must be refused here too
+    auto max_precedence = Precedence::Call;
+    for (;;) {
+        auto& rule = infix_rules[static_cast<std::size_t>(peek().type())];
+        auto prec = rule.precedence;
+        if (prec == Precedence::None || prec < min_precedence || prec > max_precedence)
+            break;
+
+        if (rule.kind == InfixKind::Call || rule.kind == InfixKind::Index) {
+            left = rule.kind == InfixKind::Call ? parse_call(left) : parse_index(left);
+            if (!left)
+                return {};
+        } else {
+            advance();
+            auto right = parse_expression(rule.associativity == Associativity::Right ?
+                prec : next_precedence(prec));
+            if (!right)
+                return {};
+            auto text = merge_texts(left->text(), right->text());
+            if (rule.kind == InfixKind::Logical)
+                left = m_arena.make<LogicalExpr>(rule.logical_op, left, right, text);
+            else
+                left = m_arena.make<BinaryExpr>(rule.binary_op, left, right, text);
+        }
+        max_precedence = rule.associativity == Associativity::None ?
+            static_cast<Precedence>(static_cast<std::uint8_t>(prec) - 1) : prec;
     }
     return left;
 }
 
-std::shared_ptr<Expr> Parser::parse_expression()
-{
-    return parse_logical_or();
-}
-
 std::pair<bool, std::string_view> Parser::finish_statement(bool fail_on_error)
 {
     if (auto& token = peek(); token.type() == TokenType::Semicolon) {
+        auto text = token.text(m_table);
         advance();
-        return { true, token.text() };
+        return { true, text };
     } else if (token.type() == TokenType::Eof && m_implicit_semicolon)
         return { true, {} };
     else if (fail_on_error)
-        error("expected ';'", token.text());
+        error("expected ';'", token.text(m_table));
     return { false, {} };
 }
 
-std::shared_ptr<Stmt> Parser::parse_assert_statement()
+Stmt* Parser::parse_assert_statement()
 {
-    auto& assert_tok = peek();
-    assert(assert_tok.type() == TokenType::Assert);
+    assert(peek().type() == TokenType::Assert);
+    auto assert_text = peek().text(m_table);
     advance();
 
     auto expr = parse_expression();
@@ -366,23 +398,23 @@ std::shared_ptr<Stmt> Parser::parse_assert_statement()
         return {};
 
     if (auto [res, end] = finish_statement(); res) {
-        return std::make_shared<AssertStmt>(expr,
-            merge_texts(assert_tok.text(), end.size() ? end : expr->text()));
+        return m_arena.make<AssertStmt>(expr,
+            merge_texts(assert_text, end.size() ? end : expr->text()));
     }
     return {};
 }
 
-std::shared_ptr<Stmt> Parser::parse_var_statement()
+Stmt* Parser::parse_var_statement()
 {
-    auto& var = peek();
-    assert(var.type() == TokenType::Var);
+    assert(peek().type() == TokenType::Var);
+    auto var_text = peek().text(m_table);
     advance();
 
     auto ident = parse_identifier();
     if (!ident)
         return {};
 
-    std::shared_ptr<Expr> init;
+    Expr* init = nullptr;
     if (match(TokenType::Equal)) {
         init = parse_expression();
         if (!init)
@@ -390,13 +422,13 @@ std::shared_ptr<Stmt> Parser::parse_var_statement()
     }
 
     if (auto [res, end] = finish_statement(); res)
-        return std::make_shared<VarStmt>(ident, init,
-            merge_texts(var.text(), end.size() ? end : (
+        return m_arena.make<VarStmt>(ident, init,
+            merge_texts(var_text, end.size() ? end : (
                 init ? init->text() : ident->text())));
     return {};
 }
 
-std::shared_ptr<Stmt> Parser::parse_assign_statement(std::shared_ptr<Expr> place)
+Stmt* Parser::parse_assign_statement(Expr* place)
 {
     assert(place);
 
@@ -405,42 +437,43 @@ std::shared_ptr<Stmt> Parser::parse_assign_statement(std::shared_ptr<Expr> place
         return {};
 
     if (auto [res, end] = finish_statement(); res)
-        return std::make_shared<AssignStmt>(place, val,
+        return m_arena.make<AssignStmt>(place, val,
             merge_texts(place->text(), end.size() ? end : val->text()));
     return {};
 }
 
-std::shared_ptr<BlockStmt> Parser::parse_block_statement()
+BlockStmt* Parser::parse_block_statement()
 {
-    auto& lbrace = peek();
-    if (lbrace.type() != TokenType::LeftBrace) {
-        error("expected '{'", lbrace.text());
+    auto lbrace = peek().text(m_table);
+    if (peek().type() != TokenType::LeftBrace) {
+        error("expected '{'", lbrace);
         return {};
     }
     advance();
 
-    std::vector<std::shared_ptr<Stmt>> stmts;
+    auto stmts_base = m_stmt_scratch.size();
     for (;;) {
         if (auto& token = peek(); token.type() == TokenType::RightBrace) {
+            auto rbrace = token.text(m_table);
             advance();
-            return std::make_shared<BlockStmt>(std::move(stmts),
-                merge_texts(lbrace.text(), token.text()));
+            return m_arena.make<BlockStmt>(take_list(m_stmt_scratch, stmts_base),
+                merge_texts(lbrace, rbrace));
         } else if (token.type() == TokenType::Eof) {
-            error("'{' was never closed", lbrace.text());
+            error("'{' was never closed", lbrace);
             return {};
         }
         auto stmt = parse_statement();
         if (!stmt)
             return {};
-        stmts.push_back(stmt);
+        m_stmt_scratch.push_back(stmt);
     }
     assert(0);
 }
 
-std::shared_ptr<Stmt> Parser::parse_if_statement()
+Stmt* Parser::parse_if_statement()
 {
-    auto& if_tok = peek();
-    assert(if_tok.type() == TokenType::If);
+    assert(peek().type() == TokenType::If);
+    auto if_text = peek().text(m_table);
     advance();
 
     auto test = parse_expression();
@@ -451,7 +484,7 @@ std::shared_ptr<Stmt> Parser::parse_if_statement()
     if (!then_block)
         return {};
 
-    std::shared_ptr<Stmt> else_block;
+    Stmt* else_block = nullptr;
     if (match(TokenType::Else)) {
         if (peek().type() == TokenType::If)
             else_block = parse_if_statement();
@@ -460,15 +493,15 @@ std::shared_ptr<Stmt> Parser::parse_if_statement()
         if (!else_block)
             return {};
     }
-    return std::make_shared<IfStmt>(test, then_block, else_block,
-        merge_texts(if_tok.text(),
+    return m_arena.make<IfStmt>(test, then_block, else_block,
+        merge_texts(if_text,
             else_block ? else_block->text() : then_block->text()));
 }
 
-std::shared_ptr<Stmt> Parser::parse_while_statement()
+Stmt* Parser::parse_while_statement()
 {
-    auto& while_tok = peek();
-    assert(while_tok.type() == TokenType::While);
+    assert(peek().type() == TokenType::While);
+    auto while_text = peek().text(m_table);
     advance();
 
     auto test = parse_expression();
@@ -481,14 +514,14 @@ std::shared_ptr<Stmt> Parser::parse_while_statement()
     if (!block)
         return {};
 
-    return std::make_shared<WhileStmt>(test, block,
-        merge_texts(while_tok.text(), block->text()));
+    return m_arena.make<WhileStmt>(test, block,
+        merge_texts(while_text, block->text()));
 }
 
-std::shared_ptr<Stmt> Parser::parse_for_statement()
+Stmt* Parser::parse_for_statement()
 {
-    auto& for_tok = peek();
-    assert(for_tok.type() == TokenType::For);
+    assert(peek().type() == TokenType::For);
+    auto for_text = peek().text(m_table);
     advance();
 
     auto ident = parse_identifier();
@@ -508,87 +541,88 @@ std::shared_ptr<Stmt> Parser::parse_for_statement()
     if (!block)
         return {};
 
-    return std::make_shared<ForStmt>(ident, expr, block,
-        merge_texts(for_tok.text(), block->text()));
+    return m_arena.make<ForStmt>(ident, expr, block,
+        merge_texts(for_text, block->text()));
 }
 
-std::shared_ptr<Stmt> Parser::parse_break_statement()
+Stmt* Parser::parse_break_statement()
 {
-    auto& break_tok = peek();
-    assert(break_tok.type() == TokenType::Break);
+    assert(peek().type() == TokenType::Break);
+    auto break_text = peek().text(m_table);
     advance();
 
     if (!is_loop_context()) {
-        error("'break' outside loop", break_tok.text());
+        error("'break' outside loop", break_text);
         return {};
     }
 
     if (auto [res, end] = finish_statement(); res)
-        return std::make_shared<BreakStmt>(end.empty() ? break_tok.text() :
-            merge_texts(break_tok.text(), end));
+        return m_arena.make<BreakStmt>(end.empty() ? break_text :
+            merge_texts(break_text, end));
     return {};
 }
 
-std::shared_ptr<Stmt> Parser::parse_continue_statement()
+Stmt* Parser::parse_continue_statement()
 {
-    auto& cont_tok = peek();
-    assert(cont_tok.type() == TokenType::Continue);
+    assert(peek().type() == TokenType::Continue);
+    auto cont_text = peek().text(m_table);
     advance();
 
     if (!is_loop_context()) {
-        error("'continue' outside loop", cont_tok.text());
+        error("'continue' outside loop", cont_text);
         return {};
     }
 
     if (auto [res, end] = finish_statement(); res)
-        return std::make_shared<ContinueStmt>(end.empty() ? cont_tok.text() :
-            merge_texts(cont_tok.text(), end));
+        return m_arena.make<ContinueStmt>(end.empty() ? cont_text :
+            merge_texts(cont_text, end));
     return {};
 }
 
-std::shared_ptr<Stmt> Parser::parse_function_declaration()
+Stmt* Parser::parse_function_declaration()
 {
-    auto& fn_tok = peek();
-    assert(fn_tok.type() == TokenType::Fn);
+    assert(peek().type() == TokenType::Fn);
+    auto fn_text = peek().text(m_table);
     advance();
 
     auto name = parse_identifier();
     if (!name)
         return {};
 
-    auto func = parse_function(fn_tok);
+    auto func = parse_function(fn_text);
     if (!func)
         return {};
+    func->set_name(name->name());
 
-    return std::make_shared<FunctionDeclaration>(name, func, func->text());
+    return m_arena.make<FunctionDeclaration>(name, func, func->text());
 }
 
-std::shared_ptr<Stmt> Parser::parse_return_statement()
+Stmt* Parser::parse_return_statement()
 {
-    auto& ret_tok = peek();
-    assert(ret_tok.type() == TokenType::Return);
+    assert(peek().type() == TokenType::Return);
+    auto ret_text = peek().text(m_table);
     advance();
 
     if (!is_function_context()) {
-        error("'return' outside function", ret_tok.text());
+        error("'return' outside function", ret_text);
         return {};
     }
 
     if (auto [res, end] = finish_statement(false); res)
-        return std::make_shared<ReturnStmt>(std::shared_ptr<Expr>(),
-            end.size() ? merge_texts(ret_tok.text(), end) : ret_tok.text());
+        return m_arena.make<ReturnStmt>(nullptr,
+            end.size() ? merge_texts(ret_text, end) : ret_text);
 
     auto expr = parse_expression();
     if (!expr)
         return {};
 
     if (auto [res, end] = finish_statement(); res)
-        return std::make_shared<ReturnStmt>(expr,
-            merge_texts(ret_tok.text(), end.size() ? end : expr->text()));
+        return m_arena.make<ReturnStmt>(expr,
+            merge_texts(ret_text, end.size() ? end : expr->text()));
     return {};
 }
 
-std::shared_ptr<Stmt> Parser::parse_statement()
+Stmt* Parser::parse_statement()
 {
     if (auto& token = peek(); token.type() == TokenType::Assert)
         return parse_assert_statement();
@@ -616,25 +650,26 @@ std::shared_ptr<Stmt> Parser::parse_statement()
     if (!expr)
         return {};
 
-    if (expr->is_identifier() && match(TokenType::Equal))
+    if ((expr->is_identifier() || expr->is_index()) && match(TokenType::Equal))
         return parse_assign_statement(expr);
 
     if (auto [res, end] = finish_statement(); res)
-        return std::make_shared<ExpressionStmt>(expr,
+        return m_arena.make<ExpressionStmt>(expr,
             end.empty() ? expr->text() : merge_texts(expr->text(), end));
     return {};
 }
 
 std::shared_ptr<Program> Parser::parse()
 {
-    std::vector<std::shared_ptr<Stmt>> stmts;
+    assert(m_stmt_scratch.empty());
     while (peek().type() != TokenType::Eof) {
         auto stmt = parse_statement();
         if (!stmt)
             return {};
-        stmts.push_back(stmt);
+        m_stmt_scratch.push_back(stmt);
     }
-    return std::make_shared<Program>(std::move(stmts), m_source);
+    auto stmts = take_list(m_stmt_scratch, 0);
+    return std::make_shared<Program>(stmts, m_source, std::move(m_arena));
 }
 
 }
@@ -2,6 +2,7 @@
 
 #include "Lexer.h"
 #include "AST.h"
+#include <array>
 #include <vector>
 #include <utility>
 
@@ -9,12 +10,25 @@ namespace Lox {
 
 class Parser {
 public:
-    Parser(std::vector<Token>&& tokens, std::string_view source)
-        : m_tokens(std::move(tokens))
-        , m_source(source)
-    {
-        assert(source.data());
-    }
+    // tokens are pulled from the lexer while parsing, so that only the few
+    // looked ahead at are kept in memory
+    explicit Parser(Lexer& lexer)
+        : m_lexer(lexer)
+        , m_table(lexer.table())
+        , m_source(lexer.source())
+    {}
+
+    // of infix operators, from loosest to tightest binding
+    enum class Precedence : std::uint8_t {
+        None,
+        Or,
+        And,
+        Compare,
+        Add,
+        Multiply,
+        Unary,
+        Call,
+    };
 
     std::shared_ptr<Program> parse();
     bool has_errors() const { return m_errors.size() > 0; }
@@ -22,40 +36,53 @@ public:
     void repl_mode(bool on) { m_implicit_semicolon = on; }
 
 private:
-    const Token& peek() const;
-    const Token& peek2() const;
-    void advance() { ++m_cur; }
+    // references are valid until the next advance()
+    const Token& lookahead(std::size_t n);
+    const Token& peek() { return lookahead(0); }
+    const Token& peek2() { return lookahead(1); }
+    void advance();
     bool match(TokenType next, std::string_view err_msg = {});
 
     void error(std::string msg, std::string_view span);
 
-    std::shared_ptr<Identifier> parse_identifier();
-    std::shared_ptr<FunctionExpr> parse_function(const Token& fn_token);
-    std::shared_ptr<Expr> parse_primary();
-    std::shared_ptr<Expr> parse_call();
-    std::shared_ptr<Expr> parse_unary();
-    std::shared_ptr<Expr> parse_multiply();
-    std::shared_ptr<Expr> parse_add();
-    std::shared_ptr<Expr> parse_compare();
-    std::shared_ptr<Expr> parse_logical_and();
-    std::shared_ptr<Expr> parse_logical_or();
-    std::shared_ptr<Expr> parse_expression();
+    Identifier* parse_identifier();
+    FunctionExpr* parse_function(std::string_view fn_text);
+    Expr* parse_primary();
+    Expr* parse_list(std::string_view lbracket);
+    // a '{' that starts a statement starts a block instead
+    Expr* parse_map(std::string_view lbrace);
+    Expr* parse_call(Expr* callee);
+    Expr* parse_index(Expr* object);
+    Expr* parse_unary();
+    // operators of lower precedence than min_precedence end the expression
+    Expr* parse_expression(Precedence min_precedence = Precedence::Or);
 
-    std::shared_ptr<Stmt> parse_assert_statement();
-    std::shared_ptr<Stmt> parse_var_statement();
-    std::shared_ptr<Stmt> parse_assign_statement(std::shared_ptr<Expr>);
-    std::shared_ptr<BlockStmt> parse_block_statement();
-    std::shared_ptr<Stmt> parse_if_statement();
-    std::shared_ptr<Stmt> parse_while_statement();
-    std::shared_ptr<Stmt> parse_for_statement();
-    std::shared_ptr<Stmt> parse_break_statement();
-    std::shared_ptr<Stmt> parse_continue_statement();
-    std::shared_ptr<Stmt> parse_function_declaration();
-    std::shared_ptr<Stmt> parse_return_statement();
-    std::shared_ptr<Stmt> parse_statement();
+    Stmt* parse_assert_statement();
+    Stmt* parse_var_statement();
+    Stmt* parse_assign_statement(Expr*);
+    BlockStmt* parse_block_statement();
+    Stmt* parse_if_statement();
+    Stmt* parse_while_statement();
+    Stmt* parse_for_statement();
+    Stmt* parse_break_statement();
+    Stmt* parse_continue_statement();
+    Stmt* parse_function_declaration();
+    Stmt* parse_return_statement();
+    Stmt* parse_statement();
 
     std::pair<bool, std::string_view> finish_statement(bool fail_on_error = true);
 
+    // move the list items pushed onto the scratch stack since base into
+    // the arena, so that they are stored contiguously
+    template<typename T>
+    std::span<T* const> take_list(std::vector<T*>& scratch, std::size_t base)
+    {
+        assert(base <= scratch.size());
+        auto list = m_arena.copy(std::span<T* const>(scratch).subspan(base));
+        scratch.resize(base);
+        return list;
+    }
+
     bool is_loop_context() const { return m_loop_context > 0; }
     void start_loop_context() { ++m_loop_context; }
     void end_loop_context()
@@ -72,9 +99,21 @@ private:
         --m_function_context;
     }
 
-    std::vector<Token> m_tokens;
+    Lexer& m_lexer;
+    const TokenTable& m_table;
     std::string_view m_source;
-    std::size_t m_cur { 0 };
+    // ring of the tokens pulled from the lexer, but not consumed yet
+    static constexpr std::size_t LOOKAHEAD_SIZE = 2;
+    std::array<Token, LOOKAHEAD_SIZE> m_lookahead;
+    std::size_t m_lookahead_start { 0 };
+    std::size_t m_lookahead_count { 0 };
+    // of the last consumed token, errors at eof point to it
+    std::string_view m_last_text;
+    AstArena m_arena;
+    // items of the lists being parsed, shared by all nesting levels
+    std::vector<Stmt*> m_stmt_scratch;
+    std::vector<Expr*> m_expr_scratch;
+    std::vector<Identifier*> m_ident_scratch;
     std::vector<Error> m_errors;
     bool m_implicit_semicolon { false };
     std::size_t m_loop_context { 0 };
@@ -1,56 +1,276 @@
 #include "Interpreter.h"
+#include "LineReader.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <format>
 #include <iostream>
+#include <unistd.h>
 
 namespace Lox {
 
-using ArgsVector = std::vector<std::shared_ptr<Object>>;
-using BuiltinFunctionPtr =
-    std::shared_ptr<Object> (*)(const ArgsVector&, Interpreter&);
+using Args = std::span<const Value>;
+using BuiltinFunctionPtr = Value (*)(Args, Interpreter&);
 
 class BuiltinFunction : public Callable {
 public:
     BuiltinFunction(BuiltinFunctionPtr func, std::size_t arity)
-        : m_func(func)
+        : BuiltinFunction(func, arity, arity)
+    {}
+    BuiltinFunction(BuiltinFunctionPtr func, std::size_t arity,
+        std::size_t max_arity)
+        : Callable(TypeTag::BuiltinFunction)
+        , m_func(func)
         , m_arity(arity)
+        , m_max_arity(max_arity)
     {
         assert(func);
+        assert(arity <= max_arity);
     }
 
     std::string_view type_name() const override { return "BuiltinFunction"; }
 
-    std::shared_ptr<Object> __call__(const ArgsVector& args,
-                                     Interpreter& interp) override
+    Value __call__(Args args, Interpreter& interp) override
     {
         return m_func(args, interp);
     }
 
     std::size_t arity() const override { return m_arity; }
+    std::size_t max_arity() const override { return m_max_arity; }
 
 private:
     const BuiltinFunctionPtr m_func;
     std::size_t m_arity { 0 };
+    std::size_t m_max_arity { 0 };
 };
 
-static std::shared_ptr<Object> print(const ArgsVector& args, Interpreter&)
+// print(args...): args separated by spaces, then a newline, as one write
+static Value print(Args args, Interpreter& interp)
 {
-    std::cout << args[0]->__str__();
-    std::cout << '\n';
+    std::string line;
+    for (auto& arg : args) {
+        if (&arg != &args.front())
+            line += ' ';
+        line += arg.__str__();
+    }
+    line += '\n';
+    interp.output().write(line);
     return make_nil();
 }
 
-static std::shared_ptr<Object> input(const ArgsVector& args, Interpreter&)
+static Value flush(Args, Interpreter& interp)
 {
-    std::cout << args[0]->__str__();
+    interp.output().flush();
+    return make_nil();
+}
+
+static Value input(Args args, Interpreter& interp)
+{
+    // the prompt is seen before waiting for the line
+    interp.output().write(args[0].__str__());
+    interp.output().flush();
     std::string line;
     if (std::getline(std::cin, line))
         return make_string(std::move(line));
     return {};
 }
 
+// list that args[0] refers to, or null after reporting an error
+static List* list_arg(Args args, Interpreter& interp)
+{
+    if (args[0].tag() != TypeTag::List) {
+        interp.error(std::format("expected 'List', got '{}'",
+            args[0].type_name()), interp.call_span());
+        return nullptr;
+    }
+    return &static_cast<List&>(args[0].get_object());
+}
+
+// map that args[0] refers to, or null after reporting an error; if
+// the map is keyed by args[1], it must be hashable
+static Map* map_arg(Args args, Interpreter& interp)
+{
+    if (args[0].tag() != TypeTag::Map) {
+        interp.error(std::format("expected 'Map', got '{}'",
+            args[0].type_name()), interp.call_span());
+        return nullptr;
+    }
+    if (args.size() > 1 && !is_hashable(args[1])) {
+        interp.error(not_hashable_message(args[1]), interp.call_span());
+        return nullptr;
+    }
+    return &static_cast<Map&>(args[0].get_object());
+}
+
+static Value len(Args args, Interpreter& interp)
+{
+    switch (args[0].tag()) {
+    case TypeTag::List:
+        return make_number(static_cast<List&>(args[0].get_object()).size());
+    case TypeTag::Map:
+        return make_number(static_cast<Map&>(args[0].get_object()).size());
+    case TypeTag::String:
+        return make_number(static_cast<String&>(args[0].get_object()).size());
+    default:
+        interp.error(std::format("'{}' object has no length",
+            args[0].type_name()), interp.call_span());
+        return {};
+    }
+}
+
+static Value push(Args args, Interpreter& interp)
+{
+    auto list = list_arg(args, interp);
+    if (!list)
+        return {};
+    list->push(args[1]);
+    return make_nil();
+}
+
+static Value pop(Args args, Interpreter& interp)
+{
+    auto list = list_arg(args, interp);
+    if (!list)
+        return {};
+    if (list->size() == 0) {
+        interp.error("pop from empty list", interp.call_span());
+        return {};
+    }
+    return list->pop();
+}
+
+static Value contains(Args args, Interpreter& interp)
+{
+    auto map = map_arg(args, interp);
+    if (!map)
+        return {};
+    return make_bool(map->contains(args[1]));
+}
+
+// return whether the key was in the map
+static Value remove(Args args, Interpreter& interp)
+{
+    auto map = map_arg(args, interp);
+    if (!map)
+        return {};
+    return make_bool(map->remove(args[1]));
+}
+
+static Value keys(Args args, Interpreter& interp)
+{
+    auto map = map_arg(args, interp);
+    if (!map)
+        return {};
+    auto list = heap().make<List>();
+    for (auto slot = map->next_slot(0); slot < map->capacity();
+         slot = map->next_slot(slot + 1))
+        list->push(map->key_at(slot));
+    return Value(list);
+}
+
+// Lines of a file as strings, read as they're iterated over, so that
+// a loop over the lines of a big file runs in constant memory.
+class LineIterator : public Iterator {
+public:
+    LineIterator(int fd, bool owns_fd, std::string name)
+        : m_reader(fd, owns_fd)
+        , m_name(std::move(name))
+    {}
+
+    // not done after an error, so that next() reports it
+    bool done() const override
+    {
+        if (!m_line && !m_reader.error())
+            m_line = m_reader.next();
+        return !m_line && !m_reader.error();
+    }
+
+    Value next() override
+    {
+        assert(!done());
+        if (!m_line)
+            return {};
+        auto line = make_string(*m_line);
+        m_line.reset();
+        return line;
+    }
+
+    std::string error() const override
+    {
+        return std::format("cannot read from '{}': {}", m_name,
+            std::strerror(m_reader.error()));
+    }
+
+    std::size_t external_size() const override
+    {
+        return m_reader.buffer_size();
+    }
+
+private:
+    mutable LineReader m_reader;
+    // line read ahead by done()
+    mutable std::optional<std::string_view> m_line;
+    std::string m_name;
+};
+
+static Value lines(Args args, Interpreter& interp)
+{
+    if (!args[0].is_string()) {
+        interp.error(std::format("expected 'String', got '{}'",
+            args[0].type_name()), interp.call_span());
+        return {};
+    }
+    std::string path(args[0].get_string());
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        interp.error(std::format("cannot open '{}': {}", path,
+            std::strerror(errno)), interp.call_span());
+        return {};
+    }
+    return Value(heap().make<LineIterator>(fd, true, std::move(path)));
+}
+
+// lines of stdin; input() reads stdin through a buffer of its own, so
+// the two shouldn't be mixed
+static Value stdin_lines(Args, Interpreter&)
+{
+    return Value(heap().make<LineIterator>(STDIN_FILENO, false, "<stdin>"));
+}
+
+// range(start, stop) or range(start, stop, step)
+static Value range(Args args, Interpreter& interp)
+{
+    for (auto& arg : args) {
+        if (!arg.is_number()) {
+            interp.error(std::format("expected 'Number', got '{}'",
+                arg.type_name()), interp.call_span());
+            return {};
+        }
+    }
+    auto step = args.size() > 2 ? args[2].get_number() : 1;
+    if (step == 0) {
+        interp.error("range step must not be zero", interp.call_span());
+        return {};
+    }
+    return Value(heap().make<NumberRange>(args[0].get_number(),
+        args[1].get_number(), step));
+}
+
 void prelude(Interpreter& interp)
 {
-    interp.define_var("print", std::make_shared<BuiltinFunction>(print, 1));
-    interp.define_var("input", std::make_shared<BuiltinFunction>(input, 1));
+    interp.define_var("print", Value(heap().make<BuiltinFunction>(print, 0,
+        Callable::ANY_ARITY)));
+    interp.define_var("flush", Value(heap().make<BuiltinFunction>(flush, 0)));
+    interp.define_var("input", Value(heap().make<BuiltinFunction>(input, 1)));
+    interp.define_var("len", Value(heap().make<BuiltinFunction>(len, 1)));
+    interp.define_var("push", Value(heap().make<BuiltinFunction>(push, 2)));
+    interp.define_var("pop", Value(heap().make<BuiltinFunction>(pop, 1)));
+    interp.define_var("contains", Value(heap().make<BuiltinFunction>(contains, 2)));
+    interp.define_var("remove", Value(heap().make<BuiltinFunction>(remove, 2)));
+    interp.define_var("keys", Value(heap().make<BuiltinFunction>(keys, 1)));
+    interp.define_var("range", Value(heap().make<BuiltinFunction>(range, 2, 3)));
+    interp.define_var("lines", Value(heap().make<BuiltinFunction>(lines, 1)));
+    interp.define_var("stdin_lines", Value(heap().make<BuiltinFunction>(stdin_lines, 0)));
 }
 
 }
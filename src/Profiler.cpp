@@ -0,0 +1,188 @@
+#include "Profiler.h"
+#include "AST.h"
+#include "Utils.h"
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <tuple>
+#include <signal.h>
+#include <sys/time.h>
+
+namespace Lox {
+
+static std::atomic<Profiler*> running_profiler;
+
+static void sigprof_handler(int)
+{
+    if (auto profiler = running_profiler.load(std::memory_order_relaxed))
+        profiler->sample();
+}
+
+Profiler::Profiler(std::chrono::microseconds interval)
+    : m_interval(interval)
+    , m_stack(std::make_unique<Frame[]>(MAX_DEPTH))
+    , m_sampled_frames(std::make_unique_for_overwrite<SampledFrame[]>(MAX_SAMPLED_FRAMES))
+    , m_sample_sizes(std::make_unique_for_overwrite<std::uint32_t[]>(MAX_SAMPLES))
+{
+    assert(interval.count() > 0);
+}
+
+Profiler::~Profiler()
+{
+    if (running_profiler.load() == this)
+        stop();
+}
+
+void Profiler::add_source(std::string_view source, std::string name)
+{
+    m_source_texts[source.data()] = source;
+    m_source_names[source.data()] = std::move(name);
+}
+
+bool Profiler::start()
+{
+    Profiler* expected = nullptr;
+    if (!running_profiler.compare_exchange_strong(expected, this))
+        return false;
+
+    struct sigaction sa = {};
+    sa.sa_handler = sigprof_handler;
+    // don't interrupt the program's i/o
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGPROF, &sa, nullptr)) {
+        running_profiler = nullptr;
+        return false;
+    }
+
+    struct itimerval timer = {};
+    auto secs = std::chrono::duration_cast<std::chrono::seconds>(m_interval);
+    timer.it_interval.tv_sec = secs.count();
+    timer.it_interval.tv_usec = (m_interval - secs).count();
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, nullptr)) {
+        running_profiler = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void Profiler::stop()
+{
+    assert(running_profiler.load() == this);
+    struct itimerval timer = {};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    running_profiler = nullptr;
+    // a signal that was already pending finds no profiler to sample
+    struct sigaction sa = {};
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPROF, &sa, nullptr);
+}
+
+void Profiler::push_frame(const FunctionExpr* func, std::string_view source)
+{
+    auto depth = m_depth.load(std::memory_order_relaxed);
+    if (depth < MAX_DEPTH) {
+        auto& frame = m_stack[depth];
+        frame.func = func;
+        frame.source = source.data();
+        frame.pos.store(nullptr, std::memory_order_relaxed);
+    }
+    // the handler runs on this thread, so it only has to see the frame
+    // written before the depth that includes it
+    std::atomic_signal_fence(std::memory_order_release);
+    m_depth.store(depth + 1, std::memory_order_relaxed);
+}
+
+void Profiler::pop_frame()
+{
+    auto depth = m_depth.load(std::memory_order_relaxed);
+    assert(depth > 0);
+    m_depth.store(depth - 1, std::memory_order_relaxed);
+}
+
+void Profiler::sample()
+{
+    auto depth = std::min(m_depth.load(std::memory_order_relaxed), MAX_DEPTH);
+    std::atomic_signal_fence(std::memory_order_acquire);
+    if (depth == 0)
+        return;
+    if (m_sample_count == MAX_SAMPLES ||
+        depth > MAX_SAMPLED_FRAMES - m_sampled_frame_count) {
+        ++m_dropped_count;
+        return;
+    }
+    auto out = &m_sampled_frames[m_sampled_frame_count];
+    for (std::size_t i = 0; i < depth; ++i) {
+        auto& frame = m_stack[i];
+        out[i] = { frame.func, frame.source,
+            frame.pos.load(std::memory_order_relaxed) };
+    }
+    m_sampled_frame_count += depth;
+    m_sample_sizes[m_sample_count++] = depth;
+}
+
+std::string Profiler::frame_name(const SampledFrame& frame,
+    const std::unordered_map<const char*, SourceMap>& smaps) const
+{
+    std::string name = "<unknown>";
+    std::size_t line_num = 0;
+    if (auto it = m_source_names.find(frame.source); it != m_source_names.end())
+        name = it->second;
+    // a frame that hasn't started executing statements yet is at the
+    // start of its function
+    auto pos = frame.pos;
+    if (!pos)
+        pos = frame.func ? frame.func->text().data() : frame.source;
+    if (auto it = smaps.find(frame.source); it != smaps.end()) {
+        auto& limits = it->second.line_limits();
+        std::size_t offset = pos - frame.source;
+        line_num = std::upper_bound(limits.begin(), limits.end(), offset) -
+            limits.begin() + 1;
+    }
+
+    name += ':';
+    name += std::to_string(line_num);
+    name += ' ';
+    if (!frame.func)
+        name += "<script>";
+    else if (frame.func->name().empty())
+        name += "<anonymous>";
+    else
+        name += frame.func->name();
+    return name;
+}
+
+void Profiler::write_folded(std::ostream& out) const
+{
+    std::unordered_map<const char*, SourceMap> smaps;
+    for (auto& [data, source] : m_source_texts)
+        smaps.try_emplace(data, source);
+
+    // names of frames are cached, b/c the same frames recur in most samples
+    std::map<std::tuple<const FunctionExpr*, const char*, const char*>,
+        std::string> names;
+    auto get_name = [&](const SampledFrame& frame) -> const std::string& {
+        auto [it, inserted] = names.try_emplace(
+            { frame.func, frame.source, frame.pos });
+        if (inserted)
+            it->second = frame_name(frame, smaps);
+        return it->second;
+    };
+
+    std::map<std::string, std::size_t> stacks;
+    auto frames = m_sampled_frames.get();
+    for (std::size_t i = 0; i < m_sample_count; ++i) {
+        std::string stack;
+        for (std::size_t j = 0; j < m_sample_sizes[i]; ++j) {
+            if (j > 0)
+                stack += ';';
+            stack += get_name(frames[j]);
+        }
+        frames += m_sample_sizes[i];
+        ++stacks[stack];
+    }
+    for (auto& [stack, count] : stacks)
+        out << stack << ' ' << count << '\n';
+}
+
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+namespace Lox {
+
+class FunctionExpr;
+class SourceMap;
+
+// Sampling profiler. While it's set on an interpreter, the interpreter
+// maintains a shadow stack of function calls and the statement each call
+// is executing. On every tick of a profiling timer, the SIGPROF handler
+// copies the shadow stack into preallocated storage, so the handler
+// neither allocates nor locks. Afterwards, samples are aggregated into
+// folded stacks: one line per unique stack of "file:line function" frames,
+// root first, followed by the number of its samples - the input format of
+// flamegraph tools.
+class Profiler {
+public:
+    static constexpr std::chrono::microseconds DEFAULT_INTERVAL { 1000 };
+
+    explicit Profiler(std::chrono::microseconds interval = DEFAULT_INTERVAL);
+    ~Profiler();
+
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    // name source for reporting, e.g. with the path of its file
+    void add_source(std::string_view source, std::string name);
+
+    // start and stop the timer; only one profiler may run at a time
+    bool start();
+    void stop();
+
+    // func is null for the program's top level
+    void push_frame(const FunctionExpr* func, std::string_view source);
+    void pop_frame();
+    // set position of the statement executed by the innermost frame
+    void set_position(const char* pos)
+    {
+        auto depth = m_depth.load(std::memory_order_relaxed);
+        if (depth > 0 && depth <= MAX_DEPTH)
+            m_stack[depth - 1].pos.store(pos, std::memory_order_relaxed);
+    }
+
+    // record the current shadow stack; called by the SIGPROF handler
+    void sample();
+
+    std::size_t sample_count() const { return m_sample_count; }
+    std::size_t dropped_count() const { return m_dropped_count; }
+    void write_folded(std::ostream&) const;
+
+    // pushes a frame for its lifetime if profiler is set
+    class FramePusher {
+    public:
+        FramePusher(Profiler* profiler, const FunctionExpr* func,
+            std::string_view source)
+            : m_profiler(profiler)
+        {
+            if (m_profiler)
+                m_profiler->push_frame(func, source);
+        }
+
+        FramePusher(const FramePusher&) = delete;
+        FramePusher& operator=(const FramePusher&) = delete;
+
+        ~FramePusher()
+        {
+            if (m_profiler)
+                m_profiler->pop_frame();
+        }
+
+    private:
+        Profiler* m_profiler { nullptr };
+    };
+
+private:
+    static constexpr std::size_t MAX_DEPTH = 1 << 16;
+    static constexpr std::size_t MAX_SAMPLES = 1 << 20;
+    static constexpr std::size_t MAX_SAMPLED_FRAMES = 1 << 22;
+
+    struct Frame {
+        const FunctionExpr* func { nullptr };
+        const char* source { nullptr };
+        std::atomic<const char*> pos { nullptr };
+    };
+
+    struct SampledFrame {
+        const FunctionExpr* func { nullptr };
+        const char* source { nullptr };
+        const char* pos { nullptr };
+    };
+
+    std::string frame_name(const SampledFrame&,
+        const std::unordered_map<const char*, SourceMap>& smaps) const;
+
+    std::chrono::microseconds m_interval;
+    std::unordered_map<const char*, std::string_view> m_source_texts;
+    std::unordered_map<const char*, std::string> m_source_names;
+
+    // frames deeper than MAX_DEPTH are counted, but not recorded
+    std::unique_ptr<Frame[]> m_stack;
+    std::atomic<std::size_t> m_depth { 0 };
+
+    // frames of all samples, one after another
+    std::unique_ptr<SampledFrame[]> m_sampled_frames;
+    std::size_t m_sampled_frame_count { 0 };
+    // number of frames in each sample
+    std::unique_ptr<std::uint32_t[]> m_sample_sizes;
+    std::size_t m_sample_count { 0 };
+    std::size_t m_dropped_count { 0 };
+};
+
+}
@@ -0,0 +1,1083 @@
+#include "ProgramCache.h"
+#include "Interpreter.h"
+#include "SourceFile.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <unistd.h>
+#include <vector>
+
+namespace Lox {
+
+namespace fs = std::filesystem;
+
+static constexpr char MAGIC[4] = { 'L', 'O', 'X', 'C' };
+
+enum class NodeTag : std::uint8_t {
+    None, // null child
+    StringLiteral,
+    NumberLiteral,
+    Identifier,
+    BoolLiteral,
+    NilLiteral,
+    UnaryExpr,
+    GroupExpr,
+    BinaryExpr,
+    LogicalExpr,
+    CallExpr,
+    FunctionExpr,
+    ExpressionStmt,
+    AssertStmt,
+    VarStmt,
+    AssignStmt,
+    BlockStmt,
+    IfStmt,
+    WhileStmt,
+    ForStmt,
+    BreakStmt,
+    ContinueStmt,
+    FunctionDeclaration,
+    ReturnStmt,
+    ListExpr,
+    IndexExpr,
+    MapExpr,
+};
+
+enum class ConstantTag : std::uint8_t {
+    None, // not folded
+    Nil,
+    Bool,
+    Number,
+    String,
+};
+
+// Appends nodes in pre-order, in the host's byte order. Spans are stored
+// as offsets into the source.
+class AstWriter {
+public:
+    AstWriter(std::string_view source, std::string& out)
+        : m_source(source)
+        , m_out(out)
+    {}
+
+    bool ok() const { return m_ok; }
+
+    template<typename T>
+    void write_raw(T val)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        m_out.append(reinterpret_cast<const char*>(&val), sizeof(val));
+    }
+
+    void write_u8(std::uint8_t val) { write_raw(val); }
+    void write_u32(std::uint32_t val) { write_raw(val); }
+    void write_u64(std::uint64_t val) { write_raw(val); }
+    void write_double(double val) { write_raw(val); }
+    void write_tag(NodeTag tag) { write_u8(static_cast<std::uint8_t>(tag)); }
+
+    void write_span(std::string_view span)
+    {
+        if (span.empty()) {
+            write_u32(0);
+            write_u32(0);
+            return;
+        }
+        assert(span.data() >= m_source.data());
+        assert(span.data() + span.size() <= m_source.data() + m_source.size());
+        write_u32(span.data() - m_source.data());
+        write_u32(span.size());
+    }
+
+    void write_string(std::string_view str)
+    {
+        write_u32(str.size());
+        m_out.append(str);
+    }
+
+    void write_node(const ASTNode* node)
+    {
+        if (node)
+            node->write(*this);
+        else
+            write_tag(NodeTag::None);
+    }
+
+    template<typename T>
+    void write_list(std::span<T* const> nodes)
+    {
+        write_u32(nodes.size());
+        for (auto node : nodes)
+            write_node(node);
+    }
+
+    void write_constant(const Value* val)
+    {
+        if (!val)
+            write_u8(static_cast<std::uint8_t>(ConstantTag::None));
+        else if (val->is_niltype())
+            write_u8(static_cast<std::uint8_t>(ConstantTag::Nil));
+        else if (val->is_bool()) {
+            write_u8(static_cast<std::uint8_t>(ConstantTag::Bool));
+            write_u8(val->get_bool());
+        } else if (val->is_number()) {
+            write_u8(static_cast<std::uint8_t>(ConstantTag::Number));
+            write_double(val->get_number());
+        } else if (val->is_string()) {
+            write_u8(static_cast<std::uint8_t>(ConstantTag::String));
+            write_string(val->get_string());
+        } else
+            m_ok = false;
+    }
+
+private:
+    std::string_view m_source;
+    std::string& m_out;
+    bool m_ok { true };
+};
+
+void StringLiteral::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::StringLiteral);
+    out.write_span(m_text);
+    out.write_string(m_value);
+    out.write_constant(m_constant);
+}
+
+void NumberLiteral::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::NumberLiteral);
+    out.write_span(m_text);
+    out.write_double(m_value);
+}
+
+void Identifier::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::Identifier);
+    out.write_span(m_text);
+    out.write_span(m_name);
+    out.write_u8(static_cast<std::uint8_t>(m_var.kind));
+    out.write_u32(m_var.index);
+    out.write_u8(m_var.new_box);
+}
+
+void BoolLiteral::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::BoolLiteral);
+    out.write_span(m_text);
+    out.write_u8(m_value);
+}
+
+void NilLiteral::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::NilLiteral);
+    out.write_span(m_text);
+}
+
+void UnaryExpr::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::UnaryExpr);
+    out.write_span(m_text);
+    out.write_u8(static_cast<std::uint8_t>(m_op));
+    out.write_node(m_expr);
+    out.write_constant(m_constant);
+}
+
+void GroupExpr::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::GroupExpr);
+    out.write_span(m_text);
+    out.write_node(m_expr);
+}
+
+void BinaryExpr::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::BinaryExpr);
+    out.write_span(m_text);
+    out.write_u8(static_cast<std::uint8_t>(m_op));
+    out.write_node(m_left);
+    out.write_node(m_right);
+    out.write_constant(m_constant);
+}
+
+void LogicalExpr::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::LogicalExpr);
+    out.write_span(m_text);
+    out.write_u8(static_cast<std::uint8_t>(m_op));
+    out.write_node(m_left);
+    out.write_node(m_right);
+    out.write_constant(m_constant);
+}
+
+void CallExpr::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::CallExpr);
+    out.write_span(m_text);
+    out.write_node(m_callee);
+    out.write_list(m_args);
+}
+
+void ListExpr::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::ListExpr);
+    out.write_span(m_text);
+    out.write_list(m_items);
+}
+
+void IndexExpr::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::IndexExpr);
+    out.write_span(m_text);
+    out.write_node(m_object);
+    out.write_node(m_index);
+}
+
+void MapExpr::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::MapExpr);
+    out.write_span(m_text);
+    out.write_list(m_entries);
+}
+
+void FunctionExpr::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::FunctionExpr);
+    out.write_span(m_text);
+    out.write_list(m_params);
+    out.write_node(m_block);
+    out.write_u64(m_frame_size);
+    out.write_u32(m_captures.size());
+    for (auto& capture : m_captures) {
+        out.write_u8(capture.is_local);
+        out.write_u32(capture.index);
+    }
+    out.write_span(m_name);
+}
+
+void ExpressionStmt::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::ExpressionStmt);
+    out.write_span(m_text);
+    out.write_node(m_expr);
+}
+
+void AssertStmt::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::AssertStmt);
+    out.write_span(m_text);
+    out.write_node(m_expr);
+}
+
+void VarStmt::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::VarStmt);
+    out.write_span(m_text);
+    out.write_node(m_ident);
+    out.write_node(m_init);
+}
+
+void AssignStmt::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::AssignStmt);
+    out.write_span(m_text);
+    out.write_node(m_place);
+    out.write_node(m_value);
+}
+
+void BlockStmt::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::BlockStmt);
+    out.write_span(m_text);
+    out.write_list(m_stmts);
+}
+
+void IfStmt::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::IfStmt);
+    out.write_span(m_text);
+    out.write_node(m_test);
+    out.write_node(m_then_block);
+    out.write_node(m_else_block);
+}
+
+void WhileStmt::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::WhileStmt);
+    out.write_span(m_text);
+    out.write_node(m_test);
+    out.write_node(m_block);
+}
+
+void ForStmt::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::ForStmt);
+    out.write_span(m_text);
+    out.write_node(m_ident);
+    out.write_node(m_expr);
+    out.write_node(m_block);
+}
+
+void BreakStmt::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::BreakStmt);
+    out.write_span(m_text);
+}
+
+void ContinueStmt::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::ContinueStmt);
+    out.write_span(m_text);
+}
+
+void FunctionDeclaration::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::FunctionDeclaration);
+    out.write_span(m_text);
+    out.write_node(m_name);
+    out.write_node(m_func);
+}
+
+void ReturnStmt::write(AstWriter& out) const
+{
+    out.write_tag(NodeTag::ReturnStmt);
+    out.write_span(m_text);
+    out.write_node(m_expr);
+}
+
+void Program::write(AstWriter& out) const
+{
+    out.write_u64(m_frame_size);
+    out.write_list(m_stmts);
+}
+
+// Rebuilds a program written by AstWriter. Cache files may be truncated or
+// corrupt, so every read is checked; the first failure makes all further
+// reads fail, and the caller discards what was read. The nodes befriend
+// the reader so that it restores what the checker stored in them.
+class AstReader {
+public:
+    AstReader(std::string_view data, std::string_view source)
+        : m_data(data)
+        , m_source(source)
+    {}
+
+    std::shared_ptr<Program> read_program()
+    {
+        auto program = std::make_shared<Program>(std::span<Stmt* const>(),
+            m_source, AstArena());
+        m_program = program.get();
+        m_frames.emplace_back();
+        push_scope();
+        auto frame_size = read_u64();
+        auto stmts = read_list<Stmt>(&AstReader::read_stmt);
+        if (!m_ok || m_pos != m_data.size())
+            return {};
+        if (!check_frame(frame_size, 0))
+            return {};
+        program->m_stmts = stmts;
+        program->m_frame_size = frame_size;
+        return program;
+    }
+
+private:
+    bool fail()
+    {
+        m_ok = false;
+        return false;
+    }
+
+    // What a live slot of a frame holds, as the checker's scopes left it:
+    // declarations take the next slot, references must find their slot
+    // holding what their kind expects, and captured slots must hold boxes.
+    // Otherwise a corrupt file could make the interpreter take a number
+    // for a box or run outside of its stack.
+    enum class Slot : std::uint8_t {
+        Hidden, // reserved by a for loop, not referenced by name
+        Plain,
+        Boxed,
+    };
+
+    struct Frame {
+        std::vector<Slot> slots;
+        // slot counts when the open scopes were pushed, innermost last
+        std::vector<std::size_t> scopes;
+        std::uint64_t slots_used { 0 };
+        std::uint64_t captures_used { 0 };
+    };
+
+    void push_scope()
+    {
+        auto& frame = m_frames.back();
+        frame.scopes.push_back(frame.slots.size());
+    }
+
+    void pop_scope()
+    {
+        auto& frame = m_frames.back();
+        assert(frame.scopes.size());
+        frame.slots.resize(frame.scopes.back());
+        frame.scopes.pop_back();
+    }
+
+    void push_slots(std::size_t count, Slot slot)
+    {
+        auto& frame = m_frames.back();
+        frame.slots.resize(frame.slots.size() + count, slot);
+        frame.slots_used = std::max<std::uint64_t>(frame.slots_used,
+            frame.slots.size());
+    }
+
+    static Slot slot_for(VarKind kind)
+    {
+        return kind == VarKind::BoxedLocal ? Slot::Boxed : Slot::Plain;
+    }
+
+    bool declare_var(const VarRef& var)
+    {
+        if (!m_ok)
+            return false;
+        auto& frame = m_frames.back();
+        switch (var.kind) {
+        case VarKind::Local:
+        case VarKind::BoxedLocal:
+            if (var.new_box) {
+                if (var.index != frame.slots.size())
+                    return fail();
+                push_slots(1, slot_for(var.kind));
+                return true;
+            }
+            // redeclaration in the same scope
+            assert(frame.scopes.size());
+            if (var.index < frame.scopes.back()
+                || var.index >= frame.slots.size()
+                || frame.slots[var.index] != slot_for(var.kind))
+                return fail();
+            return true;
+        case VarKind::Captured:
+            return fail();
+        case VarKind::Global:
+            return true;
+        }
+        return fail();
+    }
+
+    bool use_var(const VarRef& var)
+    {
+        if (!m_ok)
+            return false;
+        auto& frame = m_frames.back();
+        switch (var.kind) {
+        case VarKind::Local:
+        case VarKind::BoxedLocal:
+            if (var.index >= frame.slots.size()
+                || frame.slots[var.index] != slot_for(var.kind))
+                return fail();
+            return true;
+        case VarKind::Captured:
+            frame.captures_used = std::max<std::uint64_t>(frame.captures_used,
+                static_cast<std::uint64_t>(var.index) + 1);
+            return true;
+        case VarKind::Global:
+            return true;
+        }
+        return fail();
+    }
+
+    bool check_frame(std::uint64_t frame_size, std::size_t capture_count)
+    {
+        auto& frame = m_frames.back();
+        if (frame_size > Interpreter::STACK_SLOTS
+            || frame.slots_used > frame_size
+            || frame.captures_used > capture_count)
+            return fail();
+        return true;
+    }
+
+    template<typename T>
+    T read_raw()
+    {
+        T val {};
+        if (!m_ok || m_data.size() - m_pos < sizeof(T)) {
+            fail();
+            return val;
+        }
+        std::memcpy(&val, m_data.data() + m_pos, sizeof(T));
+        m_pos += sizeof(T);
+        return val;
+    }
+
+    std::uint8_t read_u8() { return read_raw<std::uint8_t>(); }
+    std::uint32_t read_u32() { return read_raw<std::uint32_t>(); }
+    std::uint64_t read_u64() { return read_raw<std::uint64_t>(); }
+    double read_double() { return read_raw<double>(); }
+    bool read_bool() { return read_u8() != 0; }
+
+    // enum whose last member is last
+    template<typename Enum>
+    Enum read_enum(Enum last)
+    {
+        auto val = read_u8();
+        if (val > static_cast<std::uint8_t>(last))
+            fail();
+        return static_cast<Enum>(val);
+    }
+
+    std::string_view read_span()
+    {
+        std::size_t offset = read_u32();
+        std::size_t size = read_u32();
+        if (!m_ok || offset > m_source.size() || size > m_source.size() - offset) {
+            fail();
+            return {};
+        }
+        return size ? m_source.substr(offset, size) : std::string_view();
+    }
+
+    std::string_view read_string()
+    {
+        std::size_t size = read_u32();
+        if (!m_ok || size > m_data.size() - m_pos) {
+            fail();
+            return {};
+        }
+        auto str = m_data.substr(m_pos, size);
+        m_pos += size;
+        return str;
+    }
+
+    const Value* read_constant()
+    {
+        Value val;
+        switch (read_enum(ConstantTag::String)) {
+        case ConstantTag::None:
+            return nullptr;
+        case ConstantTag::Nil:
+            val = make_nil();
+            break;
+        case ConstantTag::Bool:
+            val = make_bool(read_bool());
+            break;
+        case ConstantTag::Number:
+            val = make_number(read_double());
+            break;
+        case ConstantTag::String:
+            val = make_string(read_string());
+            break;
+        }
+        if (!m_ok)
+            return nullptr;
+        // like Checker::add_constant
+        if (val.is_object())
+            m_program->add_constant(&val.get_object());
+        return arena().make<Value>(val);
+    }
+
+    NodeTag read_tag() { return read_enum(NodeTag::MapExpr); }
+
+    // node of the type that read_node reads, it mustn't be null
+    template<typename T>
+    T* read_child(T* (AstReader::*read_node)(NodeTag), NodeTag tag)
+    {
+        auto node = m_ok ? (this->*read_node)(tag) : nullptr;
+        if (!node)
+            fail();
+        return node;
+    }
+
+    template<typename T>
+    T* read_child(T* (AstReader::*read_node)(NodeTag))
+    {
+        return read_child(read_node, read_tag());
+    }
+
+    template<typename T>
+    T* read_optional_child(T* (AstReader::*read_node)(NodeTag))
+    {
+        auto tag = read_tag();
+        return tag == NodeTag::None ? nullptr : read_child(read_node, tag);
+    }
+
+    template<typename T>
+    std::span<T* const> read_list(T* (AstReader::*read_item)(NodeTag))
+    {
+        std::size_t count = read_u32();
+        // every node takes at least a byte, so don't trust a bigger count
+        if (!m_ok || count > m_data.size() - m_pos) {
+            fail();
+            return {};
+        }
+        // items of nested lists go on top of the same scratch stack, like
+        // in the parser
+        auto& scratch = scratch_for(static_cast<T*>(nullptr));
+        auto base = scratch.size();
+        for (std::size_t i = 0; i < count; ++i) {
+            auto item = read_child(read_item);
+            if (!item)
+                return {};
+            scratch.push_back(item);
+        }
+        auto list = arena().copy(std::span<T* const>(scratch).subspan(base));
+        scratch.resize(base);
+        return list;
+    }
+
+    Identifier* read_identifier(NodeTag tag)
+    {
+        if (tag != NodeTag::Identifier)
+            return nullptr;
+        auto text = read_span();
+        auto name = read_span();
+        VarRef var;
+        var.kind = read_enum(VarKind::Captured);
+        var.index = read_u32();
+        var.new_box = read_bool();
+        if (!m_ok)
+            return nullptr;
+        auto ident = arena().make<Identifier>(name, text);
+        ident->m_var = var;
+        return ident;
+    }
+
+    // identifier that declares its variable as soon as it is read, like
+    // a parameter or the name of a function
+    Identifier* read_declaration(NodeTag tag)
+    {
+        auto ident = read_identifier(tag);
+        if (!ident || !declare_var(ident->var()))
+            return nullptr;
+        return ident;
+    }
+
+    BlockStmt* read_block(NodeTag tag)
+    {
+        push_scope();
+        auto block = read_body(tag);
+        pop_scope();
+        return block;
+    }
+
+    // block of a function or a for loop, whose statements are in the scope
+    // of the parameters or the loop variable
+    BlockStmt* read_body(NodeTag tag)
+    {
+        if (tag != NodeTag::BlockStmt)
+            return nullptr;
+        auto text = read_span();
+        auto stmts = read_list<Stmt>(&AstReader::read_stmt);
+        if (!m_ok)
+            return nullptr;
+        return arena().make<BlockStmt>(stmts, text);
+    }
+
+    FunctionExpr* read_function(NodeTag tag)
+    {
+        if (tag != NodeTag::FunctionExpr)
+            return nullptr;
+        auto text = read_span();
+        m_frames.emplace_back();
+        push_scope();
+        auto params = read_list<Identifier>(&AstReader::read_declaration);
+        auto block = read_child(&AstReader::read_body);
+        auto frame_size = read_u64();
+        std::size_t capture_count = read_u32();
+        if (!m_ok || capture_count > m_data.size() - m_pos) {
+            m_frames.pop_back();
+            return nullptr;
+        }
+        std::vector<Capture> captures(capture_count);
+        for (auto& capture : captures) {
+            capture.is_local = read_bool();
+            capture.index = read_u32();
+        }
+        auto name = read_span();
+        auto ok = m_ok && check_frame(frame_size, capture_count);
+        m_frames.pop_back();
+        if (!ok)
+            return nullptr;
+        // a capture is a boxed slot or a capture of the enclosing function
+        for (auto& capture : captures) {
+            if (!use_var({ capture.is_local ? VarKind::BoxedLocal :
+                    VarKind::Captured, capture.index, false }))
+                return nullptr;
+        }
+        auto func = arena().make<FunctionExpr>(params, block, text);
+        func->m_frame_size = frame_size;
+        func->m_captures = arena().copy(std::span<const Capture>(captures));
+        func->set_name(name);
+        return func;
+    }
+
+    Expr* read_expr(NodeTag tag)
+    {
+        switch (tag) {
+        case NodeTag::StringLiteral: {
+            auto text = read_span();
+            auto value = arena().copy(read_string());
+            auto constant = read_constant();
+            if (!m_ok)
+                return nullptr;
+            auto literal = arena().make<StringLiteral>(value, text);
+            literal->m_constant = constant;
+            return literal;
+        }
+        case NodeTag::NumberLiteral: {
+            auto text = read_span();
+            auto value = read_double();
+            return m_ok ? arena().make<NumberLiteral>(value, text) : nullptr;
+        }
+        case NodeTag::Identifier: {
+            auto ident = read_identifier(tag);
+            return ident && use_var(ident->var()) ? ident : nullptr;
+        }
+        case NodeTag::BoolLiteral: {
+            auto text = read_span();
+            auto value = read_bool();
+            return m_ok ? arena().make<BoolLiteral>(value, text) : nullptr;
+        }
+        case NodeTag::NilLiteral: {
+            auto text = read_span();
+            return m_ok ? arena().make<NilLiteral>(text) : nullptr;
+        }
+        case NodeTag::UnaryExpr: {
+            auto text = read_span();
+            auto op = read_enum(UnaryOp::Not);
+            auto expr = read_child(&AstReader::read_expr);
+            auto constant = read_constant();
+            if (!m_ok)
+                return nullptr;
+            auto unary = arena().make<UnaryExpr>(op, expr, text);
+            unary->m_constant = constant;
+            return unary;
+        }
+        case NodeTag::GroupExpr: {
+            auto text = read_span();
+            auto expr = read_child(&AstReader::read_expr);
+            return m_ok ? arena().make<GroupExpr>(expr, text) : nullptr;
+        }
+        case NodeTag::BinaryExpr: {
+            auto text = read_span();
+            auto op = read_enum(BinaryOp::GreaterOrEqual);
+            auto left = read_child(&AstReader::read_expr);
+            auto right = read_child(&AstReader::read_expr);
+            auto constant = read_constant();
+            if (!m_ok)
+                return nullptr;
+            auto binary = arena().make<BinaryExpr>(op, left, right, text);
+            binary->m_constant = constant;
+            return binary;
+        }
+        case NodeTag::LogicalExpr: {
+            auto text = read_span();
+            auto op = read_enum(LogicalOp::Or);
+            auto left = read_child(&AstReader::read_expr);
+            auto right = read_child(&AstReader::read_expr);
+            auto constant = read_constant();
+            if (!m_ok)
+                return nullptr;
+            auto logical = arena().make<LogicalExpr>(op, left, right, text);
+            logical->m_constant = constant;
+            return logical;
+        }
+        case NodeTag::CallExpr: {
+            auto text = read_span();
+            auto callee = read_child(&AstReader::read_expr);
+            auto args = read_list<Expr>(&AstReader::read_expr);
+            return m_ok ? arena().make<CallExpr>(callee, args, text) : nullptr;
+        }
+        case NodeTag::ListExpr: {
+            auto text = read_span();
+            auto items = read_list<Expr>(&AstReader::read_expr);
+            return m_ok ? arena().make<ListExpr>(items, text) : nullptr;
+        }
+        case NodeTag::IndexExpr: {
+            auto text = read_span();
+            auto object = read_child(&AstReader::read_expr);
+            auto index = read_child(&AstReader::read_expr);
+            return m_ok ? arena().make<IndexExpr>(object, index, text) : nullptr;
+        }
+        case NodeTag::MapExpr: {
+            auto text = read_span();
+            auto entries = read_list<Expr>(&AstReader::read_expr);
+            if (!m_ok || entries.size() % 2 != 0)
+                return nullptr;
+            return arena().make<MapExpr>(entries, text);
+        }
+        case NodeTag::FunctionExpr:
+            return read_function(tag);
+        default:
+            return nullptr;
+        }
+    }
+
+    Stmt* read_stmt(NodeTag tag)
+    {
+        switch (tag) {
+        case NodeTag::ExpressionStmt: {
+            auto text = read_span();
+            auto expr = read_child(&AstReader::read_expr);
+            return m_ok ? arena().make<ExpressionStmt>(expr, text) : nullptr;
+        }
+        case NodeTag::AssertStmt: {
+            auto text = read_span();
+            auto expr = read_child(&AstReader::read_expr);
+            return m_ok ? arena().make<AssertStmt>(expr, text) : nullptr;
+        }
+        case NodeTag::VarStmt: {
+            auto text = read_span();
+            auto ident = read_child(&AstReader::read_identifier);
+            auto init = read_optional_child(&AstReader::read_expr);
+            // the initializer is evaluated before the variable is declared
+            if (!m_ok || !declare_var(ident->var()))
+                return nullptr;
+            return arena().make<VarStmt>(ident, init, text);
+        }
+        case NodeTag::AssignStmt: {
+            auto text = read_span();
+            auto place = read_child(&AstReader::read_expr);
+            auto value = read_child(&AstReader::read_expr);
+            if (!m_ok || !(place->is_identifier() || place->is_index()))
+                return nullptr;
+            return arena().make<AssignStmt>(place, value, text);
+        }
+        case NodeTag::BlockStmt:
+            return read_block(tag);
+        case NodeTag::IfStmt: {
+            auto text = read_span();
+            auto test = read_child(&AstReader::read_expr);
+            auto then_block = read_child(&AstReader::read_stmt);
+            auto else_block = read_optional_child(&AstReader::read_stmt);
+            return m_ok ? arena().make<IfStmt>(test, then_block, else_block, text) :
+                nullptr;
+        }
+        case NodeTag::WhileStmt: {
+            auto text = read_span();
+            auto test = read_child(&AstReader::read_expr);
+            auto block = read_child(&AstReader::read_stmt);
+            return m_ok ? arena().make<WhileStmt>(test, block, text) : nullptr;
+        }
+        case NodeTag::ForStmt: {
+            auto text = read_span();
+            auto ident = read_child(&AstReader::read_identifier);
+            auto expr = read_child(&AstReader::read_expr);
+            if (!m_ok)
+                return nullptr;
+            // like ForStmt::check
+            push_scope();
+            push_slots(2, Slot::Hidden);
+            auto block = declare_var(ident->var()) ?
+                read_child(&AstReader::read_body) : nullptr;
+            pop_scope();
+            return m_ok ? arena().make<ForStmt>(ident, expr, block, text) : nullptr;
+        }
+        case NodeTag::BreakStmt: {
+            auto text = read_span();
+            return m_ok ? arena().make<BreakStmt>(text) : nullptr;
+        }
+        case NodeTag::ContinueStmt: {
+            auto text = read_span();
+            return m_ok ? arena().make<ContinueStmt>(text) : nullptr;
+        }
+        case NodeTag::FunctionDeclaration: {
+            auto text = read_span();
+            // declared before the function, which may capture it
+            auto name = read_child(&AstReader::read_declaration);
+            auto func = read_child(&AstReader::read_function);
+            return m_ok ? arena().make<FunctionDeclaration>(name, func, text) :
+                nullptr;
+        }
+        case NodeTag::ReturnStmt: {
+            auto text = read_span();
+            auto expr = read_optional_child(&AstReader::read_expr);
+            return m_ok ? arena().make<ReturnStmt>(expr, text) : nullptr;
+        }
+        default:
+            return nullptr;
+        }
+    }
+
+    AstArena& arena() { return m_program->arena(); }
+    std::vector<Stmt*>& scratch_for(Stmt*) { return m_stmt_scratch; }
+    std::vector<Expr*>& scratch_for(Expr*) { return m_expr_scratch; }
+    std::vector<Identifier*>& scratch_for(Identifier*) { return m_ident_scratch; }
+
+    std::string_view m_data;
+    std::size_t m_pos { 0 };
+    std::string_view m_source;
+    Program* m_program { nullptr };
+    std::vector<Stmt*> m_stmt_scratch;
+    std::vector<Expr*> m_expr_scratch;
+    std::vector<Identifier*> m_ident_scratch;
+    std::vector<Frame> m_frames;
+    bool m_ok { true };
+};
+
+std::uint64_t hash_bytes(std::string_view bytes)
+{
+    // FNV-1a
+    std::uint64_t hash = 0xcbf29ce484222325;
+    for (unsigned char ch : bytes) {
+        hash ^= ch;
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+// the hash of the payload catches corruption that the reader's checks
+// can't, like a changed number or a swapped variable kind
+static void write_header(std::string& out, std::string_view source,
+    std::string_view payload)
+{
+    out.append(MAGIC, sizeof(MAGIC));
+    auto append = [&](auto val) {
+        out.append(reinterpret_cast<const char*>(&val), sizeof(val));
+    };
+    append(ProgramCache::VERSION);
+    append(hash_bytes(source));
+    append(static_cast<std::uint64_t>(source.size()));
+    append(hash_bytes(payload));
+}
+
+std::string write_program(const Program& program, std::string_view source)
+{
+    assert(program.text().data() == source.data());
+    std::string payload;
+    AstWriter writer(source, payload);
+    program.write(writer);
+    if (!writer.ok())
+        return {};
+    std::string out;
+    write_header(out, source, payload);
+    out.append(payload);
+    assert(out.size() == ProgramCache::HEADER_SIZE + payload.size());
+    return out;
+}
+
+std::shared_ptr<Program> read_program(std::string_view data,
+    std::string_view source)
+{
+    if (data.size() < ProgramCache::HEADER_SIZE)
+        return {};
+    auto payload = data.substr(ProgramCache::HEADER_SIZE);
+    std::string header;
+    write_header(header, source, payload);
+    if (!data.starts_with(header))
+        return {};
+    return AstReader(payload, source).read_program();
+}
+
+fs::path ProgramCache::default_dir()
+{
+    if (auto dir = std::getenv("LOX_CACHE_DIR"); dir && *dir)
+        return dir;
+    if (auto dir = std::getenv("XDG_CACHE_HOME"); dir && *dir)
+        return fs::path(dir) / "lox";
+    if (auto dir = std::getenv("HOME"); dir && *dir)
+        return fs::path(dir) / ".cache" / "lox";
+    return {};
+}
+
+fs::path ProgramCache::path_for(std::string_view source) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.loxc",
+        static_cast<unsigned long long>(hash_bytes(source)));
+    return m_dir / name;
+}
+
+std::shared_ptr<Program> ProgramCache::load(std::string_view source) const
+{
+    int fd = open(path_for(source).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return {};
+    SourceFile file;
+    auto loaded = file.load(fd);
+    std::shared_ptr<Program> program;
+    if (loaded)
+        program = read_program(file.text(), source);
+    // mark the file as used, so that pruning keeps it
+    if (program)
+        futimens(fd, nullptr);
+    close(fd);
+    return program;
+}
+
+bool ProgramCache::store(const Program& program, std::string_view source) const
+{
+    auto data = write_program(program, source);
+    if (data.empty())
+        return false;
+
+    std::error_code ec;
+    fs::create_directories(m_dir, ec);
+    if (ec)
+        return false;
+    // write to a temporary file first, so that a concurrent run never
+    // loads a partly written file
+    auto path = path_for(source);
+    auto tmp_path = fs::path(path).concat(".tmp" + std::to_string(getpid()));
+    std::ofstream fout(tmp_path, std::ios::binary);
+    fout.write(data.data(), data.size());
+    fout.close();
+    if (!fout) {
+        fs::remove(tmp_path, ec);
+        return false;
+    }
+    fs::rename(tmp_path, path, ec);
+    if (ec) {
+        fs::remove(tmp_path, ec);
+        return false;
+    }
+    prune(path);
+    return true;
+}
+
+void ProgramCache::prune(const fs::path& keep) const
+{
+    struct Entry {
+        fs::path path;
+        fs::file_time_type time;
+        std::uintmax_t size;
+    };
+    std::vector<Entry> entries;
+    auto now = fs::file_time_type::clock::now();
+    std::error_code ec;
+    for (fs::directory_iterator it(m_dir, ec), end; !ec && it != end;
+         it.increment(ec)) {
+        // cache files and temporary files left by runs that died
+        auto name = it->path().filename().native();
+        if (name.find(".loxc") == name.npos || it->path() == keep)
+            continue;
+        std::error_code entry_ec;
+        auto time = it->last_write_time(entry_ec);
+        auto size = it->file_size(entry_ec);
+        if (entry_ec)
+            continue;
+        if (now - time > MAX_AGE)
+            fs::remove(it->path(), entry_ec);
+        // a temporary file may still be written by a concurrent run
+        else if (name.ends_with(".loxc"))
+            entries.push_back({ it->path(), time, size });
+    }
+
+    std::uintmax_t total = fs::file_size(keep, ec);
+    if (ec)
+        total = 0;
+    for (auto& entry : entries)
+        total += entry.size;
+    if (total <= m_max_size)
+        return;
+    std::sort(entries.begin(), entries.end(),
+        [](auto& a, auto& b) { return a.time < b.time; });
+    for (auto& entry : entries) {
+        if (total <= m_max_size)
+            break;
+        if (fs::remove(entry.path, ec))
+            total -= entry.size;
+    }
+}
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "AST.h"
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+namespace Lox {
+
+// Checked programs serialized to .loxc files named by the hash of their
+// source, so that running an unchanged script skips lexing, parsing and
+// checking. A cached program refers to its source by offsets, so loading
+// it needs the source, which also serves the spans of error messages.
+//
+// Loading a file marks it as used; storing one prunes the files unused for
+// MAX_AGE, then the least recently used files until the cache is within
+// its size.
+class ProgramCache {
+public:
+    // bump when the format or the meaning of anything checked changes
+    static constexpr std::uint32_t VERSION = 5;
+    // magic, version, hash and size of the source, hash of the payload
+    static constexpr std::size_t HEADER_SIZE = 32;
+    static constexpr std::uintmax_t DEFAULT_MAX_SIZE = 64 << 20;
+    static constexpr std::chrono::hours MAX_AGE { 30 * 24 };
+
+    explicit ProgramCache(std::filesystem::path dir,
+        std::uintmax_t max_size = DEFAULT_MAX_SIZE)
+        : m_dir(std::move(dir))
+        , m_max_size(max_size)
+    {}
+
+    // $LOX_CACHE_DIR, $XDG_CACHE_HOME/lox or ~/.cache/lox; empty if none
+    // of the variables is set
+    static std::filesystem::path default_dir();
+
+    const std::filesystem::path& dir() const { return m_dir; }
+    std::filesystem::path path_for(std::string_view source) const;
+
+    // return empty if there is no valid cache file for source
+    std::shared_ptr<Program> load(std::string_view source) const;
+    // the cache is best effort, so failures are only reported by returning
+    // false
+    bool store(const Program&, std::string_view source) const;
+
+private:
+    // keep is the file just stored, which stays even if it alone exceeds
+    // the size
+    void prune(const std::filesystem::path& keep) const;
+
+    std::filesystem::path m_dir;
+    std::uintmax_t m_max_size;
+};
+
+// FNV-1a, of a source or of a cache file's payload
+std::uint64_t hash_bytes(std::string_view bytes);
+
+// program's text must be source
+std::string write_program(const Program&, std::string_view source);
+// return empty if data isn't a program written for source
+std::shared_ptr<Program> read_program(std::string_view data,
+    std::string_view source);
+
+}
@@ -0,0 +1,61 @@
+#include "SourceFile.h"
+#include <algorithm>
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Lox {
+
+SourceFile::~SourceFile()
+{
+    if (m_mapped)
+        munmap(const_cast<char*>(m_text.data()), m_text.size());
+}
+
+bool SourceFile::load(int fd)
+{
+    struct stat st = {};
+    if (fstat(fd, &st))
+        return false;
+    std::size_t size = st.st_size;
+    // an empty file can't be mapped, and files in e.g. /proc report zero
+    // size, so read those
+    if (S_ISREG(st.st_mode) && size > 0) {
+        auto addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            // the lexer reads the text once, front to back
+            madvise(addr, size, MADV_SEQUENTIAL);
+            m_text = { static_cast<const char*>(addr), size };
+            m_mapped = true;
+            return true;
+        }
+    }
+    return read_all(fd, S_ISREG(st.st_mode) ? size : 0);
+}
+
+bool SourceFile::read_all(int fd, std::size_t size_hint)
+{
+    // a regular file is read with a single call into a buffer of its size
+    // (plus a byte to see the end), a pipe in growing chunks
+    m_buffer.resize(std::max<std::size_t>(size_hint + 1, 64 * 1024));
+    std::size_t len = 0;
+    while (true) {
+        if (len == m_buffer.size())
+            m_buffer.resize(m_buffer.size() * 2);
+        auto n = read(fd, m_buffer.data() + len, m_buffer.size() - len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        if (n == 0)
+            break;
+        len += n;
+    }
+    m_buffer.resize(len);
+    m_text = m_buffer;
+    return true;
+}
+
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace Lox {
+
+// Text of a source file. A regular file is mapped into memory read-only,
+// so loading it copies nothing: its pages are read as the lexer first
+// touches them. Other files, e.g. pipes, are read into a buffer. Tokens
+// and syntax tree nodes hold views into the text, so a program keeps its
+// source file alive.
+class SourceFile {
+public:
+    SourceFile() = default;
+    ~SourceFile();
+
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    // load file open at fd, which stays owned by the caller; on failure,
+    // return false with errno set
+    bool load(int fd);
+
+    std::string_view text() const { return m_text; }
+    bool is_mapped() const { return m_mapped; }
+
+private:
+    bool read_all(int fd, std::size_t size_hint);
+
+    std::string_view m_text;
+    bool m_mapped { false };
+    // contents of a file that couldn't be mapped
+    std::string m_buffer;
+};
+
+}
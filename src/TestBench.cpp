@@ -0,0 +1,103 @@
+#include "Bench.h"
+#include <gtest/gtest.h>
+#include <sstream>
+
+TEST(Bench, Percentiles)
+{
+    Lox::BenchResult result;
+    result.wall_ms = { 5, 1, 4, 2, 3 };
+    EXPECT_EQ(result.median_ms(), 3);
+    EXPECT_EQ(result.p95_ms(), 5);
+
+    result.wall_ms = { 2, 1 };
+    EXPECT_EQ(result.median_ms(), 1);
+    EXPECT_EQ(result.p95_ms(), 2);
+
+    result.wall_ms.clear();
+    for (int i = 100; i > 0; --i)
+        result.wall_ms.push_back(i);
+    EXPECT_EQ(result.median_ms(), 50);
+    EXPECT_EQ(result.p95_ms(), 95);
+}
+
+TEST(Bench, ReportRoundTrip)
+{
+    Lox::BenchBaseline baseline { "tree", { { "fib", 100 }, { "loop", 10 } } };
+    Lox::BenchReport report;
+    report.engine = "tree";
+    report.runs = 3;
+    report.baseline = &baseline;
+    report.threshold = 0.1;
+    report.results.resize(4);
+    auto& fib = report.results[0];
+    fib.name = "fib";
+    fib.wall_ms = { 105, 109, 120 };
+    auto& loop = report.results[1];
+    loop.name = "loop";
+    loop.wall_ms = { 12, 11.5, 13 };
+    auto& other = report.results[2];
+    other.name = "other";
+    other.wall_ms = { 1 };
+    auto& failed = report.results[3];
+    failed.name = "failed";
+    failed.ok = false;
+
+    EXPECT_FALSE(report.is_regression(fib));
+    EXPECT_TRUE(report.is_regression(loop));
+    EXPECT_FALSE(report.is_regression(other));
+    EXPECT_FALSE(report.is_regression(failed));
+
+    std::stringstream json;
+    report.write_json(json);
+    auto read = Lox::read_bench_baseline(json);
+    ASSERT_TRUE(read);
+    EXPECT_EQ(*read, (Lox::BenchBaseline { "tree",
+        { { "fib", 109 }, { "loop", 12 }, { "other", 1 } } }));
+}
+
+TEST(Bench, SkipsBaselineOfOtherEngine)
+{
+    Lox::BenchBaseline baseline { "tree", { { "fib", 100 } } };
+    Lox::BenchReport report;
+    report.engine = "vm";
+    report.runs = 1;
+    report.baseline = &baseline;
+    auto& fib = report.results.emplace_back();
+    fib.name = "fib";
+    fib.wall_ms = { 200 };
+
+    EXPECT_FALSE(report.compares_baseline());
+    EXPECT_FALSE(report.is_regression(fib));
+    std::stringstream json;
+    report.write_json(json);
+    EXPECT_EQ(json.str().find("baseline_median_ms"), std::string::npos);
+    std::stringstream summary;
+    report.write_summary(summary);
+    EXPECT_EQ(summary.str(), "baseline is of the 'tree' engine, not 'vm', "
+        "so it is not compared with\nfib: 200.0 ms\n");
+
+    report.engine = "tree";
+    EXPECT_TRUE(report.compares_baseline());
+    EXPECT_TRUE(report.is_regression(fib));
+    // reports that don't name their engine compare with any
+    baseline.engine.clear();
+    report.engine = "vm";
+    EXPECT_TRUE(report.is_regression(fib));
+}
+
+TEST(Bench, BadBaseline)
+{
+    auto read = [](std::string_view text) {
+        std::istringstream in { std::string(text) };
+        return Lox::read_bench_baseline(in);
+    };
+    EXPECT_FALSE(read(""));
+    EXPECT_FALSE(read("{"));
+    EXPECT_FALSE(read("[]"));
+    EXPECT_FALSE(read(R"({"benchmarks": {}})"));
+    EXPECT_FALSE(read(R"({"benchmarks": [{"name": "fib"}]})"));
+    EXPECT_FALSE(read(R"({"benchmarks": [{"name": 1, "median_ms": 1}]})"));
+    EXPECT_FALSE(read(R"({"benchmarks": []} x)"));
+    EXPECT_FALSE(read(R"({"engine": 1, "benchmarks": []})"));
+    EXPECT_TRUE(read(R"({"benchmarks": []})"));
+}
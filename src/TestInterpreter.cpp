@@ -1,6 +1,7 @@
 #include "Interpreter.h"
 #include "Lexer.h"
 #include "Parser.h"
+#include "Checker.h"
 #include <gtest/gtest.h>
 #include <optional>
 
@@ -9,9 +10,12 @@ public:
     std::string_view type_name() const override { return "DummyFunction"; }
 };
 
-static std::shared_ptr<DummyFunction> make_dummy_function()
+static Lox::Value make_dummy_function()
 {
-    return std::make_shared<DummyFunction>();
+    // expected values aren't reachable by the GC, so keep the dummy
+    // outside of the heap
+    static DummyFunction dummy;
+    return Lox::Value(&dummy);
 }
 
 static void assert_scope(std::vector<std::string_view> sources,
@@ -25,14 +29,16 @@ static void assert_scope(std::vector<std::string_view> sources,
     Lox::Interpreter interp;
     for (std::size_t i = 0; i < sources.size(); ++i) {
         Lox::Lexer lexer(sources[i]);
-        auto tokens = lexer.lex();
-        ASSERT_FALSE(lexer.has_errors());
-
-        Lox::Parser parser(std::move(tokens), sources[i]);
+        Lox::Parser parser(lexer);
         auto program = parser.parse();
+        ASSERT_FALSE(lexer.has_errors());
         ASSERT_FALSE(parser.has_errors());
         ASSERT_TRUE(program);
 
+        Lox::Checker checker;
+        checker.check(program);
+        ASSERT_FALSE(checker.has_errors());
+
         interp.interpret(program);
         if (errors.empty() || !errors[i].has_value())
             ASSERT_FALSE(interp.has_errors());
@@ -44,20 +50,21 @@ static void assert_scope(std::vector<std::string_view> sources,
         }
     }
 
-    auto& vars = interp.scope().vars();
+    auto& vars = interp.globals().vars();
     EXPECT_EQ(vars.size(), scope_vars.size());
     for (auto& [name, value] : scope_vars) {
         ASSERT_TRUE(vars.contains(name));
         auto& obj = vars.at(name);
         ASSERT_TRUE(obj);
         ASSERT_TRUE(value);
-        if (value->type_name() == "DummyFunction")
-            EXPECT_EQ(obj->type_name(), "Function");
+        if (value.type_name() == "DummyFunction")
+            EXPECT_EQ(obj.type_name(), "Function");
         else
-            EXPECT_TRUE(value->__eq__(*obj)) << '\n' <<
+            EXPECT_TRUE(obj.type_name() == value.type_name() &&
+                value.__eq__(obj)) << '\n' <<
                 "Variable: " << name << '\n' <<
-                "  Actual: " << obj->__str__() << '\n' <<
-                "Expected: " << value->__str__() << '\n';
+                "  Actual: " << obj.__str__() << '\n' <<
+                "Expected: " << value.__str__() << '\n';
     }
 }
 
@@ -106,3 +113,66 @@ TEST(Interpreter, FunctionErrorHasFunctionSource)
         { {}, Lox::Error { "", definition, "x" } }
     );
 }
+
+static void interpret(Lox::Interpreter& interp, std::string_view source)
+{
+    Lox::Lexer lexer(source);
+    Lox::Parser parser(lexer);
+    auto program = parser.parse();
+    ASSERT_FALSE(lexer.has_errors());
+    ASSERT_FALSE(parser.has_errors());
+
+    Lox::Checker checker;
+    checker.check(program);
+    ASSERT_FALSE(checker.has_errors());
+
+    interp.interpret(program);
+    ASSERT_FALSE(interp.has_errors());
+}
+
+TEST(Interpreter, GarbageCollectorFreesCycles)
+{
+    // a local function that calls itself captures the box of its own
+    // variable, which references the function back; such cycles must be
+    // freed once unreachable
+    auto& heap = Lox::heap();
+    Lox::Interpreter interp;
+    interpret(interp, "fn make() { var x = 0; "
+        "fn get() { if false { get(); } return x; } return get; }");
+    heap.collect();
+    auto live = heap.stats().live_objects;
+
+    interpret(interp, "var i = 0; while i < 100 { make(); i = i + 1; }");
+    heap.collect();
+    EXPECT_EQ(heap.stats().live_objects, live);
+
+    // a closure stored in a global keeps its boxes alive
+    interpret(interp, "var g = make();");
+    heap.collect();
+    EXPECT_EQ(heap.stats().live_objects, live + 3);
+}
+
+TEST(Interpreter, CountsCallsAndAllocationsByType)
+{
+    auto& heap = Lox::heap();
+    auto objects = heap.stats().allocated_objects;
+    std::size_t typed_objects = 0;
+    for (auto& [_, count] : heap.stats().allocated_by_type)
+        typed_objects -= count;
+
+    heap.count_types(true);
+    for (auto engine : { Lox::Interpreter::Engine::Tree,
+             Lox::Interpreter::Engine::VM }) {
+        Lox::Interpreter interp;
+        interp.set_engine(engine);
+        interpret(interp, "fn f(n) { if n > 0 { f(n - 1); } } f(3); f(0);");
+        EXPECT_EQ(interp.call_count(), 5);
+    }
+    heap.count_types(false);
+
+    // every object allocated while counting is counted by its type
+    for (auto& [_, count] : heap.stats().allocated_by_type)
+        typed_objects += count;
+    EXPECT_EQ(typed_objects, heap.stats().allocated_objects - objects);
+    EXPECT_GT(heap.stats().allocated_by_type.at("Function"), 0);
+}
@@ -0,0 +1,82 @@
+#include "LineReader.h"
+#include <gtest/gtest.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// file with contents, opened for reading and unlinked, so that it's gone
+// once the reader closes it
+static int open_temp_file(std::string_view contents)
+{
+    char path[] = "/tmp/lox-test-XXXXXX";
+    int fd = mkstemp(path);
+    EXPECT_GE(fd, 0);
+    unlink(path);
+    EXPECT_EQ(write(fd, contents.data(), contents.size()),
+        static_cast<ssize_t>(contents.size()));
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+static std::vector<std::string> read_lines(Lox::LineReader& reader)
+{
+    std::vector<std::string> lines;
+    while (auto line = reader.next())
+        lines.emplace_back(*line);
+    return lines;
+}
+
+TEST(LineReader, SplitsLines)
+{
+    Lox::LineReader reader(open_temp_file("a\n\nbc\nlast"), true);
+    EXPECT_EQ(read_lines(reader),
+        (std::vector<std::string> { "a", "", "bc", "last" }));
+    EXPECT_EQ(reader.error(), 0);
+    // stays at the end
+    EXPECT_FALSE(reader.next());
+}
+
+TEST(LineReader, ReadsEmptyFiles)
+{
+    Lox::LineReader reader(open_temp_file(""), true);
+    EXPECT_FALSE(reader.next());
+    Lox::LineReader newline(open_temp_file("\n"), true);
+    EXPECT_EQ(read_lines(newline), std::vector<std::string> { "" });
+}
+
+TEST(LineReader, ReadsLinesAcrossBlocks)
+{
+    // lines that straddle blocks, and one longer than a block
+    std::string text;
+    std::vector<std::string> expected;
+    for (std::size_t i = 0; i < 3000; ++i) {
+        expected.push_back(std::string(i % 97, 'a' + i % 26));
+        text += expected.back() + '\n';
+    }
+    expected.push_back(std::string(3 * Lox::LineReader::BLOCK_SIZE, 'x'));
+    text += expected.back() + '\n';
+    expected.push_back("end");
+    text += "end\n";
+
+    Lox::LineReader reader(open_temp_file(text), true);
+    EXPECT_EQ(read_lines(reader), expected);
+    EXPECT_LE(reader.buffer_size(), 5 * Lox::LineReader::BLOCK_SIZE);
+}
+
+TEST(LineReader, ReportsErrors)
+{
+    Lox::LineReader reader(-1, false);
+    EXPECT_FALSE(reader.next());
+    EXPECT_EQ(reader.error(), EBADF);
+}
+
+TEST(LineReader, ClosesOwnedFdAtEnd)
+{
+    int fd = open_temp_file("a\n");
+    Lox::LineReader reader(fd, true);
+    EXPECT_TRUE(reader.next());
+    EXPECT_FALSE(reader.next());
+    EXPECT_EQ(fcntl(fd, F_GETFD), -1);
+}
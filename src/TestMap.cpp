@@ -0,0 +1,71 @@
+#include "Interpreter.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+
+using Lox::make_number;
+
+TEST(Map, SetsGetsAndRemoves)
+{
+    auto& map = *Lox::heap().make<Lox::Map>();
+    for (int i = 0; i < 1000; ++i)
+        map.set(make_number(i), make_number(i * 2));
+    EXPECT_EQ(map.size(), 1000u);
+    for (int i = 0; i < 1000; ++i)
+        EXPECT_EQ(map.get(make_number(i)).get_number(), i * 2);
+    EXPECT_FALSE(map.get(make_number(1000)));
+    EXPECT_FALSE(map.get(make_number(0.5)));
+
+    for (int i = 0; i < 1000; i += 2)
+        EXPECT_TRUE(map.remove(make_number(i)));
+    EXPECT_FALSE(map.remove(make_number(0)));
+    EXPECT_EQ(map.size(), 500u);
+    for (int i = 0; i < 1000; ++i)
+        EXPECT_EQ(map.contains(make_number(i)), i % 2 == 1);
+}
+
+TEST(Map, KeysOfOtherTypesAreDistinct)
+{
+    auto& map = *Lox::heap().make<Lox::Map>();
+    map.set(make_number(1), make_number(1));
+    map.set(Lox::make_string(std::string_view("1")), make_number(2));
+    map.set(Lox::make_bool(true), make_number(3));
+    map.set(Lox::make_nil(), make_number(4));
+    EXPECT_EQ(map.size(), 4u);
+    EXPECT_EQ(map.get(Lox::make_string(std::string_view("1"))).get_number(), 2);
+    EXPECT_EQ(map.get(Lox::make_nil()).get_number(), 4);
+
+    // -0 == 0
+    map.set(make_number(-0.0), make_number(5));
+    EXPECT_EQ(map.get(make_number(0)).get_number(), 5);
+    EXPECT_FALSE(map.get(Lox::make_list({})));
+}
+
+TEST(Map, ReusesRoomOfRemovedKeys)
+{
+    // a queue of keys passing through the map leaves tombstones behind,
+    // which rehashing drops rather than growing the map
+    auto& map = *Lox::heap().make<Lox::Map>();
+    for (int i = 0; i < 100000; ++i) {
+        map.set(make_number(i), make_number(i));
+        if (i >= 10) {
+            ASSERT_TRUE(map.remove(make_number(i - 10)));
+        }
+    }
+    EXPECT_EQ(map.size(), 10u);
+    EXPECT_EQ(map.capacity(), 16u);
+}
+
+TEST(Map, IteratesOverEveryKey)
+{
+    auto& map = *Lox::heap().make<Lox::Map>();
+    for (int i = 0; i < 100; ++i)
+        map.set(make_number(i), make_number(i));
+    std::vector<bool> seen(100);
+    for (auto slot = map.next_slot(0); slot < map.capacity();
+         slot = map.next_slot(slot + 1)) {
+        auto key = static_cast<std::size_t>(map.key_at(slot).get_number());
+        EXPECT_FALSE(seen[key]);
+        seen[key] = true;
+    }
+    EXPECT_EQ(std::count(seen.begin(), seen.end(), true), 100);
+}
@@ -0,0 +1,83 @@
+#include "Output.h"
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+
+// pipe whose read end doesn't block, to see what's been written so far
+class Pipe {
+public:
+    Pipe()
+    {
+        EXPECT_EQ(pipe(m_fds), 0);
+        fcntl(m_fds[0], F_SETFL, O_NONBLOCK);
+    }
+
+    ~Pipe()
+    {
+        close(m_fds[0]);
+        close(m_fds[1]);
+    }
+
+    int write_fd() const { return m_fds[1]; }
+
+    std::string read_all()
+    {
+        std::string data;
+        char buf[4096];
+        for (ssize_t n; (n = read(m_fds[0], buf, sizeof(buf))) > 0;)
+            data.append(buf, n);
+        return data;
+    }
+
+private:
+    int m_fds[2] = { -1, -1 };
+};
+
+TEST(Output, WritesWhenBufferFills)
+{
+    Pipe pipe;
+    Lox::Output out(pipe.write_fd(), 8);
+    EXPECT_FALSE(out.is_line_buffered());
+    out.write("abc\n");
+    out.write("def\n");
+    EXPECT_EQ(pipe.read_all(), "");
+    out.write("g");
+    EXPECT_EQ(pipe.read_all(), "abc\ndef\n");
+    EXPECT_TRUE(out.flush());
+    EXPECT_EQ(pipe.read_all(), "g");
+}
+
+TEST(Output, WritesLongDataDirectly)
+{
+    Pipe pipe;
+    Lox::Output out(pipe.write_fd(), 8);
+    out.write("ab");
+    out.write("0123456789");
+    EXPECT_EQ(pipe.read_all(), "ab0123456789");
+}
+
+TEST(Output, FlushesOnDestructionAndCapacityChange)
+{
+    Pipe pipe;
+    {
+        Lox::Output out(pipe.write_fd());
+        out.write("abc");
+        out.set_capacity(0);
+        EXPECT_EQ(pipe.read_all(), "abc");
+        out.write("d");
+        EXPECT_EQ(pipe.read_all(), "d");
+        out.set_capacity(16);
+        out.write("e");
+    }
+    EXPECT_EQ(pipe.read_all(), "e");
+}
+
+TEST(Output, ReportsWriteErrors)
+{
+    Lox::Output out(-1);
+    out.write("abc");
+    EXPECT_FALSE(out.flush());
+    // what failed to be written is dropped
+    EXPECT_TRUE(out.flush());
+}
@@ -0,0 +1,84 @@
+#include "Interpreter.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "Checker.h"
+#include "Profiler.h"
+#include <gtest/gtest.h>
+#include <sstream>
+
+// takes a sample when called, so that samples are deterministic
+class SampleNow : public Lox::Callable {
+public:
+    explicit SampleNow(Lox::Profiler& profiler)
+        : Callable(Lox::TypeTag::BuiltinFunction)
+        , m_profiler(profiler)
+    {}
+
+    Lox::Value __call__(std::span<const Lox::Value>, Lox::Interpreter&) override
+    {
+        m_profiler.sample();
+        return Lox::make_nil();
+    }
+    std::size_t arity() const override { return 0; }
+
+private:
+    Lox::Profiler& m_profiler;
+};
+
+static std::string profile(std::string_view source)
+{
+    Lox::Lexer lexer(source);
+    Lox::Parser parser(lexer);
+    auto program = parser.parse();
+    EXPECT_FALSE(lexer.has_errors());
+    EXPECT_FALSE(parser.has_errors());
+
+    Lox::Checker checker;
+    checker.check(program);
+    EXPECT_FALSE(checker.has_errors());
+
+    Lox::Profiler profiler;
+    profiler.add_source(source, "test.lox");
+    // keep the callable outside of the heap, b/c it references the profiler
+    SampleNow sample(profiler);
+    Lox::Interpreter interp;
+    interp.define_var("sample", Lox::Value(&sample));
+    interp.set_profiler(&profiler);
+    interp.interpret(program);
+    EXPECT_FALSE(interp.has_errors());
+
+    std::ostringstream out;
+    profiler.write_folded(out);
+    return out.str();
+}
+
+TEST(Profiler, FoldsSampledStacks)
+{
+    auto folded = profile(
+        "fn inner() {\n"
+        "    sample();\n"
+        "}\n"
+        "fn outer() {\n"
+        "    inner();\n"
+        "    inner();\n"
+        "}\n"
+        "outer();\n"
+        "var f = fn() { sample(); };\n"
+        "f();\n"
+        "sample();\n");
+    EXPECT_EQ(folded,
+        "test.lox:10 <script>;test.lox:9 <anonymous> 1\n"
+        "test.lox:11 <script> 1\n"
+        "test.lox:8 <script>;test.lox:5 outer;test.lox:2 inner 1\n"
+        "test.lox:8 <script>;test.lox:6 outer;test.lox:2 inner 1\n");
+}
+
+TEST(Profiler, NoSamplesOutsideOfPrograms)
+{
+    Lox::Profiler profiler;
+    profiler.sample();
+    EXPECT_EQ(profiler.sample_count(), 0);
+    std::ostringstream out;
+    profiler.write_folded(out);
+    EXPECT_EQ(out.str(), "");
+}
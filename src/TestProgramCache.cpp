@@ -0,0 +1,237 @@
+#include "ProgramCache.h"
+#include "Checker.h"
+#include "Interpreter.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// closures, boxed and captured variables, folded constants, nested
+// blocks, lists and maps, with asserts that fail if any of them is restored wrong
+static constexpr std::string_view source = R"(
+fn counter(start) {
+    var n = start;
+    fn inc() { n = n + 1; return n; }
+    return inc;
+}
+var c = counter(10);
+c();
+assert c() == 12;
+var s = "con" + "cat\n";
+assert s == "concat\n";
+assert -(2 * 3) + 1 == -5;
+assert true and !false;
+{
+    var i = 0;
+    while i < 3 { i = i + 1; if i == 2 { continue; } }
+    for ch in "ab" { var x = ch; }
+    assert i == 3;
+}
+var f = fn(a, b) { return a % b; };
+assert f(7, 4) == 3;
+var l = [1, "two", [3]];
+l[2][0] = l[0] + 1;
+assert l == [1, "two", [2]];
+var m = {"a": l, 2: {}};
+m[2]["b"] = m["a"][0];
+assert m[2] == {"b": 1};
+)";
+
+static std::shared_ptr<Lox::Program> check(std::string_view text)
+{
+    Lox::Lexer lexer(text);
+    Lox::Parser parser(lexer);
+    auto program = parser.parse();
+    EXPECT_FALSE(lexer.has_errors());
+    EXPECT_FALSE(parser.has_errors());
+    Lox::Checker checker;
+    checker.check(program);
+    EXPECT_FALSE(checker.has_errors());
+    return program;
+}
+
+// patching a file breaks the hash of its payload; restore it so that the
+// reader's own checks see the patch
+static void rehash(std::string& data)
+{
+    auto hash = Lox::hash_bytes(std::string_view(data).substr(
+        Lox::ProgramCache::HEADER_SIZE));
+    std::memcpy(data.data() + Lox::ProgramCache::HEADER_SIZE - sizeof(hash),
+        &hash, sizeof(hash));
+}
+
+TEST(ProgramCache, RestoresCheckedPrograms)
+{
+    auto program = check(source);
+    auto data = Lox::write_program(*program, source);
+    ASSERT_FALSE(data.empty());
+    auto loaded = Lox::read_program(data, source);
+    ASSERT_TRUE(loaded);
+    EXPECT_EQ(loaded->dump(0), program->dump(0));
+    EXPECT_EQ(loaded->frame_size(), program->frame_size());
+    EXPECT_EQ(loaded->arena().object_count(), program->arena().object_count());
+
+    for (auto engine : { Lox::Interpreter::Engine::Tree,
+             Lox::Interpreter::Engine::VM }) {
+        Lox::Interpreter interp;
+        interp.set_engine(engine);
+        interp.interpret(loaded);
+        EXPECT_FALSE(interp.has_errors());
+    }
+}
+
+TEST(ProgramCache, KeepsSpansOfErrors)
+{
+    std::string_view text = "fn f(x) { return x + nil; }\nf(1);\n";
+    auto loaded = Lox::read_program(Lox::write_program(*check(text), text), text);
+    ASSERT_TRUE(loaded);
+    Lox::Interpreter interp;
+    interp.interpret(loaded);
+    ASSERT_TRUE(interp.has_errors());
+    auto span = interp.errors().front().span;
+    EXPECT_EQ(span.data(), text.data() + text.find("x + nil"));
+    EXPECT_EQ(span, "x + nil");
+}
+
+TEST(ProgramCache, RejectsOtherSources)
+{
+    auto program = check(source);
+    auto data = Lox::write_program(*program, source);
+    std::string changed(source);
+    changed.back() = ' ';
+    EXPECT_FALSE(Lox::read_program(data, changed));
+}
+
+TEST(ProgramCache, RejectsCorruptData)
+{
+    auto program = check(source);
+    auto data = Lox::write_program(*program, source);
+    for (std::size_t size = 0; size < data.size(); ++size)
+        EXPECT_FALSE(Lox::read_program(std::string_view(data).substr(0, size), source));
+
+    // the last byte tags the folded constant of the last expression
+    data.back() = '\xff';
+    EXPECT_FALSE(Lox::read_program(data, source));
+    rehash(data);
+    EXPECT_FALSE(Lox::read_program(data, source));
+}
+
+TEST(ProgramCache, RejectsFramesOutOfRange)
+{
+    std::string_view text = "{ var a = 1; var b = a; }\n";
+    auto program = check(text);
+    auto data = Lox::write_program(*program, text);
+    ASSERT_TRUE(Lox::read_program(data, text));
+
+    // the frame size of the program follows the header
+    constexpr std::size_t offset = Lox::ProgramCache::HEADER_SIZE;
+    std::uint64_t frame_size;
+    std::memcpy(&frame_size, data.data() + offset, sizeof(frame_size));
+    ASSERT_EQ(frame_size, program->frame_size());
+    ASSERT_EQ(frame_size, 2u);
+
+    // more slots than the stack has, which overflowed the stack checks
+    auto patched = data;
+    std::memset(patched.data() + offset, 0xff, sizeof(frame_size));
+    EXPECT_FALSE(Lox::read_program(patched, text));
+    rehash(patched);
+    EXPECT_FALSE(Lox::read_program(patched, text));
+
+    // b is in slot 1, past the end of the frame
+    patched = data;
+    frame_size = 1;
+    std::memcpy(patched.data() + offset, &frame_size, sizeof(frame_size));
+    rehash(patched);
+    EXPECT_FALSE(Lox::read_program(patched, text));
+}
+
+TEST(ProgramCache, RejectsVariableKindsNotMatchingSlots)
+{
+    std::string_view text = "fn f() { var a = 12345; return a; }\nprint(f());\n";
+    auto program = check(text);
+    auto data = Lox::write_program(*program, text);
+    ASSERT_TRUE(Lox::read_program(data, text));
+
+    // the declaration of a, whose box the tree engine would leak into the
+    // output, and the reference to it, which would take the number for a box
+    for (auto ident : { "a =", "a;" }) {
+        // an identifier is written as its text and name, both spanning
+        // the same single char, followed by its kind
+        std::uint32_t span[] = {
+            static_cast<std::uint32_t>(text.find(ident)), 1,
+            static_cast<std::uint32_t>(text.find(ident)), 1,
+        };
+        auto offset = data.find(std::string_view(
+            reinterpret_cast<const char*>(span), sizeof(span)));
+        ASSERT_NE(offset, data.npos);
+        offset += sizeof(span);
+        ASSERT_EQ(data[offset], static_cast<char>(Lox::VarKind::Local));
+
+        auto patched = data;
+        patched[offset] = static_cast<char>(Lox::VarKind::BoxedLocal);
+        EXPECT_FALSE(Lox::read_program(patched, text));
+        rehash(patched);
+        EXPECT_FALSE(Lox::read_program(patched, text));
+    }
+}
+
+TEST(ProgramCache, StoresAndLoadsFiles)
+{
+    char dir_template[] = "/tmp/lox-cache-XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir_template));
+    fs::path dir = dir_template;
+    Lox::ProgramCache cache(dir / "nested");
+
+    EXPECT_FALSE(cache.load(source));
+    ASSERT_TRUE(cache.store(*check(source), source));
+    EXPECT_TRUE(fs::is_regular_file(cache.path_for(source)));
+    auto loaded = cache.load(source);
+    ASSERT_TRUE(loaded);
+    EXPECT_EQ(loaded->dump(0), check(source)->dump(0));
+    fs::remove_all(dir);
+}
+
+TEST(ProgramCache, PrunesOldAndLeastRecentlyUsedFiles)
+{
+    char dir_template[] = "/tmp/lox-cache-XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir_template));
+    fs::path dir = dir_template;
+    // of the same size
+    std::string_view a = "var a = 1;\n", b = "var b = 1;\n",
+                     c = "var c = 1;\n", d = "var d = 1;\n";
+    Lox::ProgramCache cache(dir);
+    ASSERT_TRUE(cache.store(*check(a), a));
+    ASSERT_TRUE(cache.store(*check(b), b));
+    auto now = fs::file_time_type::clock::now();
+    fs::last_write_time(cache.path_for(a),
+        now - Lox::ProgramCache::MAX_AGE - std::chrono::hours(1));
+    ASSERT_TRUE(cache.store(*check(c), c));
+    EXPECT_FALSE(fs::exists(cache.path_for(a)));
+
+    // b is older than c until it is loaded
+    fs::last_write_time(cache.path_for(b), now - std::chrono::hours(2));
+    fs::last_write_time(cache.path_for(c), now - std::chrono::hours(1));
+    ASSERT_TRUE(cache.load(b));
+    Lox::ProgramCache small(dir, 2 * fs::file_size(cache.path_for(b)));
+    ASSERT_TRUE(small.store(*check(d), d));
+    EXPECT_TRUE(fs::exists(cache.path_for(b)));
+    EXPECT_FALSE(fs::exists(cache.path_for(c)));
+    EXPECT_TRUE(fs::exists(cache.path_for(d)));
+    fs::remove_all(dir);
+}
+
+TEST(ProgramCache, FindsDefaultDir)
+{
+    setenv("LOX_CACHE_DIR", "/tmp/lox-cache", 1);
+    EXPECT_EQ(Lox::ProgramCache::default_dir(), "/tmp/lox-cache");
+    unsetenv("LOX_CACHE_DIR");
+    setenv("XDG_CACHE_HOME", "/tmp/xdg", 1);
+    EXPECT_EQ(Lox::ProgramCache::default_dir(), "/tmp/xdg/lox");
+    unsetenv("XDG_CACHE_HOME");
+    setenv("HOME", "/tmp/home", 1);
+    EXPECT_EQ(Lox::ProgramCache::default_dir(), "/tmp/home/.cache/lox");
+}
@@ -0,0 +1,80 @@
+#include "SourceFile.h"
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+#include <sys/wait.h>
+
+class TempFile {
+public:
+    explicit TempFile(std::string_view contents)
+    {
+        m_fd = mkstemp(m_path);
+        EXPECT_GE(m_fd, 0);
+        EXPECT_EQ(write(m_fd, contents.data(), contents.size()),
+            static_cast<ssize_t>(contents.size()));
+        lseek(m_fd, 0, SEEK_SET);
+    }
+
+    ~TempFile()
+    {
+        close(m_fd);
+        unlink(m_path);
+    }
+
+    int fd() const { return m_fd; }
+
+private:
+    char m_path[32] = "/tmp/lox-test-XXXXXX";
+    int m_fd { -1 };
+};
+
+TEST(SourceFile, MapsRegularFiles)
+{
+    TempFile tmp("print 1;\n");
+    Lox::SourceFile file;
+    ASSERT_TRUE(file.load(tmp.fd()));
+    EXPECT_TRUE(file.is_mapped());
+    EXPECT_EQ(file.text(), "print 1;\n");
+}
+
+TEST(SourceFile, ReadsEmptyFiles)
+{
+    TempFile tmp("");
+    Lox::SourceFile file;
+    ASSERT_TRUE(file.load(tmp.fd()));
+    EXPECT_FALSE(file.is_mapped());
+    EXPECT_EQ(file.text(), "");
+}
+
+TEST(SourceFile, ReadsPipes)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    // more than fits in the first read buffer
+    std::string text(100 * 1024, 'x');
+    auto writer = fork();
+    ASSERT_GE(writer, 0);
+    if (writer == 0) {
+        close(fds[0]);
+        auto ok = write(fds[1], text.data(), text.size()) ==
+            static_cast<ssize_t>(text.size());
+        _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    Lox::SourceFile file;
+    EXPECT_TRUE(file.load(fds[0]));
+    close(fds[0]);
+    int status = 0;
+    waitpid(writer, &status, 0);
+    EXPECT_EQ(status, 0);
+    EXPECT_FALSE(file.is_mapped());
+    EXPECT_EQ(file.text(), text);
+}
+
+TEST(SourceFile, ReportsErrors)
+{
+    Lox::SourceFile file;
+    EXPECT_FALSE(file.load(-1));
+    EXPECT_EQ(errno, EBADF);
+}
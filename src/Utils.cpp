@@ -1,4 +1,5 @@
 #include "Utils.h"
+#include <algorithm>
 #include <cassert>
 #include <charconv>
 
@@ -29,12 +30,12 @@ Range SourceMap::span_to_range(std::string_view span)
     std::size_t end = start + span.size() - 1;
     assert(end < m_source.size());
 
+    // line limits are sorted, so binary search for the first one past pos
     auto find_line_num = [this](std::size_t pos) -> std::size_t {
-        for (std::size_t i = 0; i < m_line_limits.size(); ++i) {
-            if (pos < m_line_limits[i])
-                return i + 1;
-        }
-        return 0;
+        auto it = std::upper_bound(m_line_limits.begin(), m_line_limits.end(), pos);
+        if (it == m_line_limits.end())
+            return 0;
+        return it - m_line_limits.begin() + 1;
     };
 
     auto find_col_num = [this](std::size_t pos, std::size_t line_num) {
@@ -0,0 +1,522 @@
+#include "VM.h"
+#include <cassert>
+#include <cstring>
+#include <cmath>
+#include <format>
+
+namespace Lox {
+
+Value Closure::__call__(std::span<const Value> args, Interpreter& interp)
+{
+    return interp.vm().call(*this, args);
+}
+
+static void trace_proto(const FunctionProto& proto, Heap& heap)
+{
+    for (auto& constant : proto.chunk.constants)
+        heap.mark(constant);
+    for (auto& func : proto.chunk.functions)
+        trace_proto(*func, heap);
+}
+
+void Closure::trace(Heap& heap) const
+{
+    for (auto& upvalue : m_upvalues)
+        heap.mark(upvalue);
+    // constants of the function and of the functions nested in it
+    trace_proto(*m_proto, heap);
+}
+
+VM::VM(Interpreter& interp)
+    : m_interp(interp)
+    , m_stack(static_cast<Value*>(::operator new(Interpreter::STACK_SLOTS * sizeof(Value))))
+    , m_stack_top(m_stack)
+    , m_stack_end(m_stack + Interpreter::STACK_SLOTS)
+{
+    m_frames.reserve(64);
+}
+
+VM::~VM()
+{
+    close_upvalues(m_stack);
+    drop(m_stack_top - m_stack);
+    ::operator delete(m_stack);
+}
+
+void VM::trace_roots(Heap& heap) const
+{
+    // closures of active frames are in their frames' slot 0
+    for (auto val = m_stack; val < m_stack_top; ++val)
+        heap.mark(*val);
+    for (auto& upvalue : m_open_upvalues)
+        heap.mark(upvalue);
+}
+
+void VM::error(std::string msg, std::string_view span)
+{
+    // like the interpreter, point errors at the source of the program
+    // where the failing function was defined
+    assert(!m_frames.empty());
+    auto source_change = m_interp.push_source(
+        m_frames.back().closure->proto().program_source);
+    m_interp.error(std::move(msg), span);
+}
+
+Value VM::capture_upvalue(Value* slot)
+{
+    auto it = m_open_upvalues.end();
+    for (; it != m_open_upvalues.begin(); --it) {
+        auto& upvalue = static_cast<Upvalue&>((it - 1)->get_object());
+        if (upvalue.location() == slot)
+            return *(it - 1);
+        if (upvalue.location() < slot)
+            break;
+    }
+    return *m_open_upvalues.insert(it, Value(heap().make<Upvalue>(slot)));
+}
+
+void VM::close_upvalues(const Value* last)
+{
+    while (!m_open_upvalues.empty()) {
+        auto& upvalue = static_cast<Upvalue&>(m_open_upvalues.back().get_object());
+        if (upvalue.location() < last)
+            break;
+        upvalue.close();
+        m_open_upvalues.pop_back();
+    }
+}
+
+bool VM::push_frame(Closure& closure, std::size_t argc, std::string_view span)
+{
+    auto& proto = closure.proto();
+    if (argc != proto.arity) {
+        error(std::format("expected {} arguments, got {}", proto.arity, argc),
+            span);
+        return false;
+    }
+    auto slots = m_stack_top - argc - 1;
+    if (slots + proto.max_slots > m_stack_end) {
+        error("stack overflow", span);
+        return false;
+    }
+    m_frames.push_back({ &closure, proto.chunk.code.data(), slots });
+    return true;
+}
+
+void VM::unwind(std::size_t exit_depth)
+{
+    assert(m_frames.size() > exit_depth);
+    auto base = m_frames[exit_depth].slots;
+    close_upvalues(base);
+    drop(m_stack_top - base);
+    m_frames.resize(exit_depth);
+}
+
+bool VM::run(std::shared_ptr<const FunctionProto> script)
+{
+    assert(m_frames.empty());
+    assert(m_stack_top == m_stack);
+    if (script->max_slots > Interpreter::STACK_SLOTS) {
+        m_interp.error("stack overflow", script->program_source);
+        return false;
+    }
+    push(Value(heap().make<Closure>(std::move(script))));
+    auto& closure = static_cast<Closure&>(peek().get_object());
+    m_frames.push_back({ &closure, closure.proto().chunk.code.data(), m_stack });
+    if (!execute(0))
+        return false;
+    drop(); // script's return value
+    return true;
+}
+
+Value VM::call(Closure& closure, std::span<const Value> args)
+{
+    if (m_stack_top + args.size() + 1 > m_stack_end) {
+        m_interp.error("stack overflow", closure.proto().program_source);
+        return {};
+    }
+    auto exit_depth = m_frames.size();
+    push(Value(&closure));
+    for (auto& arg : args)
+        push(arg);
+    if (!push_frame(closure, args.size(), closure.proto().program_source)) {
+        drop(args.size() + 1);
+        return {};
+    }
+    if (!execute(exit_depth))
+        return {};
+    return pop();
+}
+
+bool VM::execute(std::size_t exit_depth)
+{
+    auto* frame = &m_frames.back();
+    auto* chunk = &frame->closure->proto().chunk;
+    auto* ip = frame->ip;
+    const std::uint8_t* op_start = nullptr;
+
+    auto read_u16 = [&ip]() {
+        std::uint16_t val;
+        std::memcpy(&val, ip, sizeof(val));
+        ip += sizeof(val);
+        return val;
+    };
+    auto read_u32 = [&ip]() {
+        std::uint32_t val;
+        std::memcpy(&val, ip, sizeof(val));
+        ip += sizeof(val);
+        return val;
+    };
+    auto load_frame = [&]() {
+        frame = &m_frames.back();
+        chunk = &frame->closure->proto().chunk;
+        ip = frame->ip;
+    };
+    auto span = [&]() {
+        return chunk->span_at(op_start - chunk->code.data());
+    };
+    auto fail = [&](std::string msg) {
+        error(std::move(msg), span());
+        unwind(exit_depth);
+        return false;
+    };
+
+    for (;;) {
+        op_start = ip;
+        switch (static_cast<OpCode>(*ip++)) {
+        case OpCode::Constant:
+            push(chunk->constants[read_u32()]);
+            break;
+        case OpCode::Nil:
+            push(make_nil());
+            break;
+        case OpCode::True:
+            push(make_bool(true));
+            break;
+        case OpCode::False:
+            push(make_bool(false));
+            break;
+        case OpCode::Pop:
+            drop();
+            break;
+        case OpCode::PopN: {
+            auto count = read_u16();
+            close_upvalues(m_stack_top - count);
+            drop(count);
+            break;
+        }
+        case OpCode::GetLocal:
+            push(frame->slots[read_u16()]);
+            break;
+        case OpCode::SetLocal:
+            frame->slots[read_u16()] = pop();
+            break;
+        case OpCode::GetUpvalue:
+            push(frame->closure->upvalue(read_u16()).get());
+            break;
+        case OpCode::SetUpvalue:
+            frame->closure->upvalue(read_u16()).get() = pop();
+            break;
+        case OpCode::GetGlobal: {
+            auto index = read_u32();
+            auto var = chunk->find_global(index, m_interp.globals());
+            if (!var) {
+                return fail(std::format("identifier '{}' is not defined",
+                    chunk->names[index]));
+            }
+            push(*var);
+            break;
+        }
+        case OpCode::SetGlobal: {
+            auto index = read_u32();
+            auto var = chunk->find_global(index, m_interp.globals());
+            if (!var) {
+                return fail(std::format("identifier '{}' is not defined",
+                    chunk->names[index]));
+            }
+            *var = pop();
+            break;
+        }
+        case OpCode::DefineGlobal:
+            m_interp.globals().define(chunk->names[read_u32()], peek());
+            drop();
+            break;
+
+        case OpCode::Negate:
+        case OpCode::Not: {
+            auto& operand = peek();
+            if (*op_start == static_cast<std::uint8_t>(OpCode::Negate) &&
+                operand.is_number()) {
+                operand = make_number(-operand.get_number());
+                break;
+            }
+            auto op = *op_start == static_cast<std::uint8_t>(OpCode::Negate) ?
+                UnaryOp::Minus : UnaryOp::Not;
+            // the span is only searched for to report an error
+            auto res = fold_unary_op(op, operand);
+            if (!res)
+                res = unary_op(op, operand, m_interp, span());
+            if (!res) {
+                unwind(exit_depth);
+                return false;
+            }
+            operand = std::move(res);
+            break;
+        }
+
+#define NUMBER_OP(opcode, binary_op_enum, expr)                             \
+        case OpCode::opcode: {                                              \
+            auto& left = peek(1);                                           \
+            auto& right = peek();                                           \
+            if (left.is_number() && right.is_number()) {                    \
+                auto a = left.get_number();                                 \
+                auto b = right.get_number();                                \
+                left = expr;                                                \
+                drop();                                                     \
+                break;                                                      \
+            }                                                               \
+            auto res = fold_binary_op(BinaryOp::binary_op_enum, left,       \
+                right);                                                     \
+            if (!res) {                                                     \
+                res = binary_op(BinaryOp::binary_op_enum, left, right,      \
+                    m_interp, span());                                      \
+            }                                                               \
+            if (!res) {                                                     \
+                unwind(exit_depth);                                         \
+                return false;                                               \
+            }                                                               \
+            left = std::move(res);                                          \
+            drop();                                                         \
+            break;                                                          \
+        }
+        NUMBER_OP(Divide, Divide, make_number(a / b))
+        NUMBER_OP(Multiply, Multiply, make_number(a * b))
+        NUMBER_OP(Modulo, Modulo, make_number(std::fmod(a, b)))
+        NUMBER_OP(Add, Add, make_number(a + b))
+        NUMBER_OP(Subtract, Subtract, make_number(a - b))
+        NUMBER_OP(Equal, Equal, make_bool(a == b))
+        NUMBER_OP(NotEqual, NotEqual, make_bool(a != b))
+        NUMBER_OP(Less, Less, make_bool(a < b))
+        NUMBER_OP(LessOrEqual, LessOrEqual, make_bool(a <= b))
+        NUMBER_OP(Greater, Greater, make_bool(a > b))
+        NUMBER_OP(GreaterOrEqual, GreaterOrEqual, make_bool(a >= b))
+#undef NUMBER_OP
+
+        case OpCode::CheckBool:
+            if (!peek().is_bool())
+                return fail(std::format("expected 'Bool', got '{}'",
+                    peek().type_name()));
+            break;
+        case OpCode::Jump: {
+            auto offset = read_u32();
+            ip += offset;
+            break;
+        }
+        case OpCode::JumpIfFalse: {
+            auto offset = read_u32();
+            if (!peek().is_bool())
+                return fail(std::format("expected 'Bool', got '{}'",
+                    peek().type_name()));
+            if (!peek().get_bool())
+                ip += offset;
+            drop();
+            break;
+        }
+        case OpCode::Loop: {
+            auto offset = read_u32();
+            ip -= offset;
+            break;
+        }
+        case OpCode::CheckInterrupt:
+            if (m_interp.check_interrupt()) {
+                unwind(exit_depth);
+                return false;
+            }
+            heap().collect_if_needed();
+            break;
+
+        case OpCode::CheckCallable:
+            if (!peek().is_callable())
+                return fail(std::format("'{}' object is not callable",
+                    peek().type_name()));
+            break;
+        case OpCode::Call: {
+            auto argc = read_u16();
+            auto call_span = chunk->spans[read_u32()].second;
+            auto& callee = static_cast<Callable&>(peek(argc).get_object());
+            m_interp.count_call();
+            if (callee.is_closure()) {
+                frame->ip = ip;
+                if (!push_frame(static_cast<Closure&>(callee), argc, call_span)) {
+                    unwind(exit_depth);
+                    return false;
+                }
+                load_frame();
+                heap().collect_if_needed();
+                break;
+            }
+            if (auto msg = arity_error(callee, argc); !msg.empty())
+                return fail(std::move(msg));
+            frame->ip = ip;
+            // like the interpreter, errors of builtins point into the
+            // source of the calling function
+            auto source_change = m_interp.push_source(
+                frame->closure->proto().program_source);
+            auto call_span_change = m_interp.push_call_span(call_span);
+            auto res = callee.__call__({ m_stack_top - argc, argc }, m_interp);
+            // a builtin could've called back into the vm, which could've
+            // grown the frame stack
+            load_frame();
+            if (!res) {
+                unwind(exit_depth);
+                return false;
+            }
+            drop(argc);
+            peek() = std::move(res);
+            break;
+        }
+        case OpCode::Closure: {
+            auto& proto = chunk->functions[read_u32()];
+            Value closure_val(heap().make<Closure>(proto));
+            auto& closure = static_cast<Closure&>(closure_val.get_object());
+            for (std::size_t i = 0; i < proto->upvalues.size(); ++i) {
+                bool is_local = *ip++;
+                auto index = read_u16();
+                if (is_local)
+                    closure.add_upvalue(capture_upvalue(frame->slots + index));
+                else
+                    closure.add_upvalue(Value(&frame->closure->upvalue(index)));
+            }
+            push(std::move(closure_val));
+            break;
+        }
+        case OpCode::BuildList: {
+            auto count = read_u32();
+            auto list = make_list({ m_stack_top - count, count });
+            drop(count);
+            push(std::move(list));
+            break;
+        }
+        case OpCode::BuildMap: {
+            auto count = 2 * read_u32();
+            auto map = make_map({ m_stack_top - count, count }, m_interp, span());
+            if (!map) {
+                unwind(exit_depth);
+                return false;
+            }
+            drop(count);
+            push(std::move(map));
+            break;
+        }
+        case OpCode::GetIndex: {
+            auto& object = peek(1);
+            auto& index = peek();
+            if (object.tag() == TypeTag::List) {
+                auto& list = static_cast<List&>(object.get_object());
+                if (auto pos = list.position(index)) {
+                    object = list.at(*pos);
+                    drop();
+                    break;
+                }
+            } else if (object.tag() == TypeTag::Map) {
+                auto& map = static_cast<Map&>(object.get_object());
+                if (auto val = map.get(index)) {
+                    object = std::move(val);
+                    drop();
+                    break;
+                }
+            }
+            auto res = get_item(object, index, m_interp, span());
+            if (!res) {
+                unwind(exit_depth);
+                return false;
+            }
+            object = std::move(res);
+            drop();
+            break;
+        }
+        case OpCode::SetIndex: {
+            auto& value = peek(2);
+            auto& object = peek(1);
+            auto& index = peek();
+            if (object.tag() == TypeTag::List) {
+                auto& list = static_cast<List&>(object.get_object());
+                if (auto pos = list.position(index)) {
+                    list.at(*pos) = value;
+                    drop(3);
+                    break;
+                }
+            } else if (object.tag() == TypeTag::Map && is_hashable(index)) {
+                static_cast<Map&>(object.get_object()).set(index, value);
+                drop(3);
+                break;
+            }
+            if (!set_item(object, index, value, m_interp, span())) {
+                unwind(exit_depth);
+                return false;
+            }
+            drop(3);
+            break;
+        }
+        case OpCode::Return: {
+            auto res = pop();
+            close_upvalues(frame->slots);
+            drop(m_stack_top - frame->slots);
+            m_frames.pop_back();
+            push(std::move(res));
+            if (m_frames.size() == exit_depth)
+                return true;
+            load_frame();
+            break;
+        }
+
+        case OpCode::GetIter: {
+            auto& val = peek();
+            // a range is counted over directly, without an iterator
+            if (val.tag() != TypeTag::Range) {
+                if (!val.is_iterable())
+                    return fail(std::format("'{}' is not iterable", val.type_name()));
+                val = val.__iter__();
+            }
+            push(make_number(0));
+            break;
+        }
+        case OpCode::ForNext: {
+            auto slot = frame->slots + read_u16();
+            auto offset = read_u32();
+            if (slot->tag() == TypeTag::Range) {
+                auto& range = static_cast<NumberRange&>(slot->get_object());
+                auto count = slot[1].get_number();
+                auto num = range.at(count);
+                if (range.is_past_end(num)) {
+                    ip += offset;
+                    break;
+                }
+                slot[1] = make_number(count + 1);
+                push(make_number(num));
+                break;
+            }
+            auto& iter = static_cast<Iterator&>(slot->get_object());
+            if (iter.done()) {
+                ip += offset;
+                break;
+            }
+            auto next = iter.next();
+            if (!next)
+                return fail(iter.error());
+            push(std::move(next));
+            break;
+        }
+        case OpCode::Assert:
+            assert(peek().is_bool());
+            if (!pop().get_bool())
+                return fail("assertion failed");
+            break;
+        case OpCode::PrintExpr:
+            m_interp.echo(pop());
+            break;
+        }
+    }
+}
+
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "Compiler.h"
+#include "Interpreter.h"
+#include <vector>
+
+namespace Lox {
+
+// A variable captured by a closure. While the variable's scope is active,
+// the upvalue points at its stack slot; once the scope is left, the value
+// is moved into the upvalue itself.
+class Upvalue : public Object {
+public:
+    explicit Upvalue(Value* slot) : m_location(slot)
+    {
+        assert(slot);
+    }
+
+    std::string_view type_name() const override { return "Upvalue"; }
+    void trace(Heap& heap) const override { heap.mark(*m_location); }
+
+    Value& get() { return *m_location; }
+    const Value* location() const { return m_location; }
+    void close()
+    {
+        m_closed = *m_location;
+        m_location = &m_closed;
+    }
+
+private:
+    Value* m_location;
+    Value m_closed;
+};
+
+class Closure : public Callable {
+public:
+    explicit Closure(std::shared_ptr<const FunctionProto> proto)
+        : Callable(TypeTag::Function)
+        , m_proto(std::move(proto))
+    {
+        assert(m_proto);
+        m_upvalues.reserve(m_proto->upvalues.size());
+    }
+
+    // closures are what functions are compiled to, so don't expose
+    // the difference to the user
+    std::string_view type_name() const override { return "Function"; }
+    bool is_closure() const override { return true; }
+    Value __call__(std::span<const Value> args, Interpreter&) override;
+    std::size_t arity() const override { return m_proto->arity; }
+    void trace(Heap&) const override;
+
+    const FunctionProto& proto() const { return *m_proto; }
+    Upvalue& upvalue(std::size_t i)
+    {
+        assert(i < m_upvalues.size());
+        return static_cast<Upvalue&>(m_upvalues[i].get_object());
+    }
+    void add_upvalue(Value upvalue) { m_upvalues.push_back(std::move(upvalue)); }
+
+private:
+    std::shared_ptr<const FunctionProto> m_proto;
+    std::vector<Value> m_upvalues;
+};
+
+class VM {
+public:
+    explicit VM(Interpreter& interp);
+    ~VM();
+
+    VM(const VM&) = delete;
+    VM& operator=(const VM&) = delete;
+
+    bool run(std::shared_ptr<const FunctionProto> script);
+    Value call(Closure& closure, std::span<const Value> args);
+
+    void trace_roots(Heap&) const;
+
+private:
+    struct CallFrame {
+        Closure* closure { nullptr };
+        const std::uint8_t* ip { nullptr };
+        Value* slots { nullptr };
+    };
+
+    bool execute(std::size_t exit_depth);
+    bool push_frame(Closure& closure, std::size_t argc, std::string_view span);
+    void unwind(std::size_t exit_depth);
+    void error(std::string msg, std::string_view span);
+
+    void push(const Value& value) { new (m_stack_top++) Value(value); }
+    void push(Value&& value) { new (m_stack_top++) Value(std::move(value)); }
+    Value pop()
+    {
+        assert(m_stack_top > m_stack);
+        Value value = std::move(*--m_stack_top);
+        m_stack_top->~Value();
+        return value;
+    }
+    void drop(std::size_t count = 1)
+    {
+        assert(m_stack_top - count >= m_stack);
+        for (; count > 0; --count)
+            (--m_stack_top)->~Value();
+    }
+    Value& peek(std::size_t distance = 0) { return m_stack_top[-1 - distance]; }
+
+    Value capture_upvalue(Value* slot);
+    void close_upvalues(const Value* last);
+
+    Interpreter& m_interp;
+    // values are constructed in place on push, so the stack is never
+    // reallocated and upvalues can point into it
+    Value* m_stack { nullptr };
+    Value* m_stack_top { nullptr };
+    Value* m_stack_end { nullptr };
+    std::vector<CallFrame> m_frames;
+    // sorted by stack slot
+    std::vector<Value> m_open_upvalues;
+};
+
+}
@@ -2,6 +2,10 @@
 #include "Checker.h"
 #include "Interpreter.h"
 #include "Prelude.h"
+#include "Profiler.h"
+#include "Bench.h"
+#include "SourceFile.h"
+#include "ProgramCache.h"
 #include <iostream>
 #include <sstream>
 #include <fstream>
@@ -10,7 +14,15 @@
 #include <filesystem>
 #include <cmath>
 #include <cstring>
+#include <chrono>
+#include <iomanip>
+#include <optional>
+#include <charconv>
+#include <algorithm>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 #include <signal.h>
 #include <poll.h>
 #include <readline/readline.h>
@@ -21,6 +33,14 @@ using namespace std::string_view_literals;
 
 static std::string argv0;
 static bool ui_testing;
+static bool gc_stats;
+static std::string profile_path;
+static bool use_cache = true;
+static bool run_stats_on;
+// empty to print stats to stderr, rather than write json
+static std::string run_stats_path;
+static Lox::Interpreter::Engine engine = Lox::Interpreter::Engine::Tree;
+static std::size_t output_buffer_size = Lox::Output::DEFAULT_CAPACITY;
 
 static std::unique_ptr<Lox::Interpreter> repl_interp;
 static bool repl_done;
@@ -39,12 +59,30 @@ static std::list<std::string> repl_sources;
     "Otherwise, run FILE or COMMAND.\n"
     "\n"
     "Options:\n"
-    "  -h, --help      Print help\n"
-    "  --ui-testing    Normalize error messages (use when testing error output)\n"
+    "  -h, --help          Print help\n"
+    "  --engine=ENGINE     Run programs with ENGINE: 'tree' walks the syntax\n"
+    "                      tree (default), 'vm' compiles to bytecode\n"
+    "  --gc-stats          Print garbage collector statistics on exit\n"
+    "  --output-buffer=N   Buffer up to N bytes of output between writes (default:\n"
+    "                      65536); 0 writes output unbuffered\n"
+    "  --no-cache          Don't load FILE's checked program from the cache, or\n"
+    "                      store it there; the cache is in $LOX_CACHE_DIR,\n"
+    "                      $XDG_CACHE_HOME/lox or ~/.cache/lox, holds up to\n"
+    "                      64 MiB of the most recently run files and drops\n"
+    "                      those not run for 30 days. Programs from stdin, a\n"
+    "                      pipe or the REPL are never cached\n"
+    "  --stats[=OUT]       Print time of each phase, counts of tokens, nodes,\n"
+    "                      scopes, calls and allocations, and peak RSS on exit;\n"
+    "                      with OUT, write them to OUT as JSON\n"
+    "  --profile=OUT       Sample where FILE spends time, write folded stacks\n"
+    "                      to OUT (tree engine only)\n"
+    "  --ui-testing        Normalize error messages (use when testing error output)\n"
     "\n"
     "Commands:\n"
+    "    bench    Time programs, compare with a baseline\n"
     "    lex      Print tokens found by lexer, one per line\n"
     "    parse    Print abstract syntax tree in sexp form\n"
+    "    profile  Run FILE, sampling where it spends time\n"
     "\n"
     "See '" << argv0 << " <command> -h' for information on a specific command.\n";
     std::exit(error);
@@ -72,6 +110,39 @@ static std::list<std::string> repl_sources;
     std::exit(error);
 }
 
+[[noreturn]] static void profile_usage(bool error = false)
+{
+    (error ? std::cerr : std::cout) <<
+    "Usage: " << argv0 << " profile [OPTIONS] FILE\n"
+    "Run FILE, sampling its call stack every millisecond of CPU time. Write\n"
+    "samples as folded stacks of 'file:line function' frames, one stack per\n"
+    "line followed by its sample count, as read by flamegraph tools.\n"
+    "\n"
+    "Options:\n"
+    "  -h, --help        Print help\n"
+    "  -o, --output=OUT  Write folded stacks to OUT (default: lox.folded)\n";
+    std::exit(error);
+}
+
+[[noreturn]] static void bench_usage(bool error = false)
+{
+    (error ? std::cerr : std::cout) <<
+    "Usage: " << argv0 << " bench [OPTIONS] FILE...\n"
+    "Run each FILE a number of times, each time in a fresh process with output\n"
+    "discarded. Print a JSON report of median and 95th percentile wall time,\n"
+    "peak RSS and heap allocations of each FILE. With a baseline, compare\n"
+    "median times against it and fail if any of them regressed.\n"
+    "\n"
+    "Options:\n"
+    "  -h, --help          Print help\n"
+    "  -n, --runs=N        Run each FILE N times (default: 10)\n"
+    "  --baseline=REPORT   Compare with REPORT printed by a previous run of\n"
+    "                      the same engine\n"
+    "  --threshold=PCT     Median slower than baseline by more than PCT\n"
+    "                      percent is a regression (default: 10)\n";
+    std::exit(error);
+}
+
 class Formatter {
 public:
     void set_color(bool on) { m_has_color = on; }
@@ -178,32 +249,123 @@ static void print_errors(const std::vector<Lox::Error>& errors,
     }
 }
 
-static bool eval(std::string_view source, std::string_view path,
-                 Lox::Interpreter& interp, bool repl_mode)
+// what --stats reports, summed over all evals
+struct RunStats {
+    struct Phase {
+        const char* name { nullptr };
+        std::chrono::nanoseconds wall { 0 };
+        std::chrono::nanoseconds cpu { 0 };
+    };
+
+    // loading or storing a cached program
+    Phase cache { "cache" };
+    // lexing is streamed into parsing, so it's part of that phase
+    Phase parse { "parse" };
+    Phase check { "check" };
+    Phase interpret { "interpret" };
+    std::size_t tokens { 0 };
+    std::size_t nodes { 0 };
+    std::size_t scopes { 0 };
+    std::size_t calls { 0 };
+};
+
+static RunStats run_stats;
+
+static std::chrono::nanoseconds cpu_time()
 {
-    Lox::Lexer lexer(source);
-    auto tokens = lexer.lex();
-    if (lexer.has_errors()) {
-        print_errors(lexer.errors(), path);
-        return false;
+    struct timespec ts = {};
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+// adds the time of its lifetime to a phase, if stats are on
+class PhaseTimer {
+public:
+    explicit PhaseTimer(RunStats::Phase& phase) : m_phase(phase)
+    {
+        if (run_stats_on) {
+            m_wall_start = std::chrono::steady_clock::now();
+            m_cpu_start = cpu_time();
+        }
     }
 
-    Lox::Parser parser(std::move(tokens), source);
-    parser.repl_mode(repl_mode);
-    auto program = parser.parse();
-    if (parser.has_errors()) {
-        print_errors(parser.errors(), path);
-        return false;
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+    ~PhaseTimer()
+    {
+        if (run_stats_on) {
+            m_phase.wall += std::chrono::steady_clock::now() - m_wall_start;
+            m_phase.cpu += cpu_time() - m_cpu_start;
+        }
     }
 
+private:
+    RunStats::Phase& m_phase;
+    std::chrono::steady_clock::time_point m_wall_start;
+    std::chrono::nanoseconds m_cpu_start { 0 };
+};
+
+// return empty on errors
+static std::shared_ptr<Lox::Program> compile(std::string_view source,
+    std::string_view path, bool repl_mode)
+{
+    std::shared_ptr<Lox::Program> program;
+    {
+        PhaseTimer timer(run_stats.parse);
+        Lox::Lexer lexer(source);
+        Lox::Parser parser(lexer);
+        parser.repl_mode(repl_mode);
+        program = parser.parse();
+        run_stats.tokens += lexer.token_count();
+        // the parser saw eof where the lexer failed, so its errors are bogus
+        if (lexer.has_errors()) {
+            print_errors(lexer.errors(), path);
+            return {};
+        }
+        if (parser.has_errors()) {
+            print_errors(parser.errors(), path);
+            return {};
+        }
+    }
+
+    PhaseTimer timer(run_stats.check);
     Lox::Checker checker;
     checker.check(program);
+    run_stats.scopes += checker.scope_count();
     if (checker.has_errors()) {
         print_errors(checker.errors(), path);
-        return false;
+        return {};
+    }
+    return program;
+}
+
+static bool eval(std::string_view source, std::string_view path,
+                 Lox::Interpreter& interp, bool repl_mode,
+                 std::shared_ptr<const Lox::SourceFile> file = {},
+                 const Lox::ProgramCache* cache = nullptr)
+{
+    std::shared_ptr<Lox::Program> program;
+    if (cache) {
+        PhaseTimer timer(run_stats.cache);
+        program = cache->load(source);
+    }
+    if (!program) {
+        program = compile(source, path, repl_mode);
+        if (!program)
+            return false;
+        if (cache) {
+            PhaseTimer timer(run_stats.cache);
+            cache->store(*program, source);
+        }
     }
+    program->set_source_file(std::move(file));
+    run_stats.nodes += program->arena().object_count();
 
+    PhaseTimer timer(run_stats.interpret);
+    auto calls = interp.call_count();
     interp.interpret(program);
+    run_stats.calls += interp.call_count() - calls;
     if (interp.has_errors()) {
         print_errors(interp.errors(), path);
         return false;
@@ -212,6 +374,106 @@ static bool eval(std::string_view source, std::string_view path,
     return true;
 }
 
+static void print_gc_stats()
+{
+    auto& stats = Lox::heap().stats();
+    auto ms = [](std::chrono::nanoseconds ns) {
+        return std::chrono::duration<double, std::milli>(ns).count();
+    };
+    std::cerr << std::fixed << std::setprecision(3) <<
+        "gc collections: " << stats.collections << "\n"
+        "gc total pause: " << ms(stats.total_pause) << " ms\n"
+        "gc max pause: " << ms(stats.max_pause) << " ms\n"
+        "gc live after last collection: " << stats.live_objects <<
+            " objects, " << stats.live_bytes << " bytes\n"
+        "gc allocated: " << stats.allocated_objects << " objects, " <<
+            stats.allocated_bytes << " bytes\n";
+}
+
+static long peak_rss_kb()
+{
+    struct rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss; // in kB on linux
+}
+
+static void write_run_stats_json(std::ostream& out)
+{
+    auto ms = [](std::chrono::nanoseconds ns) {
+        return std::chrono::duration<double, std::milli>(ns).count();
+    };
+    auto& heap_stats = Lox::heap().stats();
+    out << std::fixed << std::setprecision(3) << "{\n  \"phases\": {";
+    bool first = true;
+    for (auto& phase : { run_stats.cache, run_stats.parse, run_stats.check,
+             run_stats.interpret }) {
+        out << (first ? "" : ",") << "\n    \"" << phase.name <<
+            "\": { \"wall_ms\": " << ms(phase.wall) <<
+            ", \"cpu_ms\": " << ms(phase.cpu) << " }";
+        first = false;
+    }
+    out << "\n  },\n"
+        "  \"tokens\": " << run_stats.tokens << ",\n"
+        "  \"nodes\": " << run_stats.nodes << ",\n"
+        "  \"scopes\": " << run_stats.scopes << ",\n"
+        "  \"calls\": " << run_stats.calls << ",\n"
+        "  \"allocated_objects\": " << heap_stats.allocated_objects << ",\n"
+        "  \"allocated_bytes\": " << heap_stats.allocated_bytes << ",\n"
+        "  \"allocated_by_type\": {";
+    first = true;
+    for (auto& [type, count] : heap_stats.allocated_by_type) {
+        out << (first ? "" : ",") << "\n    " << Lox::escape(std::string(type)) <<
+            ": " << count;
+        first = false;
+    }
+    out << (first ? "" : "\n  ") << "},\n"
+        "  \"peak_rss_kb\": " << peak_rss_kb() << "\n"
+        "}\n";
+}
+
+static void print_run_stats()
+{
+    if (!run_stats_path.empty()) {
+        std::ofstream fout(run_stats_path);
+        if (!fout.is_open())
+            die_with_perror("cannot open '" + run_stats_path + "'");
+        write_run_stats_json(fout);
+        fout.close();
+        if (!fout)
+            die_with_perror("cannot write to '" + run_stats_path + "'");
+        return;
+    }
+
+    auto ms = [](std::chrono::nanoseconds ns) {
+        return std::chrono::duration<double, std::milli>(ns).count();
+    };
+    auto& heap_stats = Lox::heap().stats();
+    auto print_phase = [&](const RunStats::Phase& phase) {
+        std::cerr << std::left << std::setw(10) << phase.name << std::right <<
+            std::setw(12) << ms(phase.wall) << std::setw(12) << ms(phase.cpu) << '\n';
+    };
+    RunStats::Phase total { "total" };
+    std::cerr << std::fixed << std::setprecision(3) <<
+        "phase          wall ms      cpu ms\n";
+    for (auto& phase : { run_stats.cache, run_stats.parse, run_stats.check,
+             run_stats.interpret }) {
+        print_phase(phase);
+        total.wall += phase.wall;
+        total.cpu += phase.cpu;
+    }
+    print_phase(total);
+    std::cerr <<
+        "tokens: " << run_stats.tokens << "\n"
+        "syntax tree nodes: " << run_stats.nodes << "\n"
+        "scopes: " << run_stats.scopes << "\n"
+        "calls: " << run_stats.calls << "\n"
+        "allocated: " << heap_stats.allocated_objects << " objects, " <<
+            heap_stats.allocated_bytes << " bytes\n";
+    for (auto& [type, count] : heap_stats.allocated_by_type)
+        std::cerr << "  " << type << ": " << count << '\n';
+    std::cerr << "peak rss: " << peak_rss_kb() << " kB\n";
+}
+
 static void sigint_handler(int)
 {
     Lox::g_interrupt = 1; // checked by interpreter
@@ -266,6 +528,8 @@ static int repl()
 {
     setup_signals();
     repl_interp = std::make_unique<Lox::Interpreter>();
+    repl_interp->set_engine(engine);
+    repl_interp->output().set_capacity(output_buffer_size);
     repl_interp->print_expr_statements_mode(true);
     Lox::prelude(*repl_interp);
 
@@ -301,6 +565,10 @@ static int repl()
                 die("terminal error");
         }
     }
+    if (gc_stats)
+        print_gc_stats();
+    if (run_stats_on)
+        print_run_stats();
     return 0;
 }
 
@@ -314,36 +582,76 @@ static fs::path normalize_path(const fs::path& path)
     return ui_testing ? fs::path("$DIR") / path.filename() : path;
 }
 
-static std::ostringstream read_file(const fs::path& path)
+static std::shared_ptr<Lox::SourceFile> read_file(const fs::path& path)
 {
-    std::ostringstream buf;
-    if (path == "-") {
-        while (buf << std::cin.rdbuf())
-            ;
-        if (buf.bad())
-            die_with_perror("cannot read from '" + path_repr(path) + "'");
-    } else {
-        std::ifstream fin(path);
-        if (!fin.is_open())
+    int fd = STDIN_FILENO;
+    if (path != "-") {
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
             die_with_perror("cannot open '" + path_repr(path) + "'");
-        while (buf << fin.rdbuf())
-            ;
-        if (buf.bad())
-            die_with_perror("cannot read from '" + path_repr(path) + "'");
-        fin.close();
     }
-    return buf;
+    auto file = std::make_shared<Lox::SourceFile>();
+    if (!file->load(fd))
+        die_with_perror("cannot read from '" + path_repr(path) + "'");
+    if (fd != STDIN_FILENO)
+        close(fd);
+    return file;
+}
+
+static void write_profile(const Lox::Profiler& profiler)
+{
+    std::ofstream fout(profile_path);
+    if (!fout.is_open())
+        die_with_perror("cannot open '" + profile_path + "'");
+    profiler.write_folded(fout);
+    fout.close();
+    if (!fout)
+        die_with_perror("cannot write to '" + profile_path + "'");
+    if (profiler.dropped_count() > 0)
+        std::cerr << "profile: dropped " << profiler.dropped_count() <<
+            " samples, storage is full\n";
 }
 
 static int run(const fs::path& path)
 {
-    std::ostringstream buf = read_file(path);
+    auto file = read_file(path);
     Lox::Interpreter interp;
+    interp.set_engine(engine);
+    interp.output().set_capacity(output_buffer_size);
     interp.print_expr_statements_mode(ui_testing);
     Lox::prelude(interp);
-    if (eval(buf.view(), path_repr(normalize_path(path)), interp, false))
-        return 0;
-    return 1;
+    auto path_out = path_repr(normalize_path(path));
+
+    std::optional<Lox::Profiler> profiler;
+    if (!profile_path.empty()) {
+        if (engine != Lox::Interpreter::Engine::Tree)
+            die("profiling is only supported by the tree engine");
+        profiler.emplace();
+        profiler->add_source(file->text(), path_out);
+        interp.set_profiler(&*profiler);
+        if (!profiler->start())
+            die_with_perror("cannot start profiler");
+    }
+
+    // a program from stdin or a pipe is likely never run again
+    std::optional<Lox::ProgramCache> cache;
+    std::error_code ec;
+    if (use_cache && path != "-" && fs::is_regular_file(path, ec)) {
+        if (auto dir = Lox::ProgramCache::default_dir(); !dir.empty())
+            cache.emplace(std::move(dir));
+    }
+
+    auto ok = eval(file->text(), path_out, interp, false, file,
+        cache ? &*cache : nullptr);
+    if (profiler) {
+        profiler->stop();
+        write_profile(*profiler);
+    }
+    if (gc_stats)
+        print_gc_stats();
+    if (run_stats_on)
+        print_run_stats();
+    return ok ? 0 : 1;
 }
 
 static int lex_command(int argc, char* argv[])
@@ -364,15 +672,15 @@ static int lex_command(int argc, char* argv[])
             lex_usage(true);
     }
 
-    std::ostringstream source = read_file(path);
-    Lox::Lexer lexer(source.view());
+    auto file = read_file(path);
+    Lox::Lexer lexer(file->text());
     auto tokens = lexer.lex();
     if (lexer.has_errors()) {
         print_errors(lexer.errors(), path_repr(normalize_path(path)));
         return 1;
     }
     for (auto& token : tokens)
-        std::cout << token.dump() << '\n';
+        std::cout << token.dump(lexer.table()) << '\n';
     return 0;
 }
 
@@ -394,17 +702,15 @@ static int parse_command(int argc, char* argv[])
             parse_usage(true);
     }
 
-    std::ostringstream source = read_file(path);
+    auto file = read_file(path);
     auto path_out = path_repr(normalize_path(path));
-    Lox::Lexer lexer(source.view());
-    auto tokens = lexer.lex();
+    Lox::Lexer lexer(file->text());
+    Lox::Parser parser(lexer);
+    auto program = parser.parse();
     if (lexer.has_errors()) {
         print_errors(lexer.errors(), path_out);
         return 1;
     }
-
-    Lox::Parser parser(std::move(tokens), source.view());
-    auto program = parser.parse();
     if (parser.has_errors()) {
         print_errors(parser.errors(), path_out);
         return 1;
@@ -421,6 +727,157 @@ static int parse_command(int argc, char* argv[])
     return 0;
 }
 
+static int profile_command(int argc, char* argv[])
+{
+    profile_path = "lox.folded";
+    // process options
+    int arg = 1;
+    for (char* argp; arg < argc && (argp = argv[arg]) && argp[0] == '-'; ++arg) {
+        if (argp == "-h"sv || argp == "--help"sv)
+            profile_usage(); // no return
+        else if (argp == "-o"sv) {
+            if (++arg == argc)
+                profile_usage(true);
+            profile_path = argv[arg];
+        } else if (std::string_view(argp).starts_with("--output="))
+            profile_path = argp + "--output="sv.size();
+        else
+            break;
+    }
+
+    if (arg + 1 != argc || profile_path.empty())
+        profile_usage(true);
+    return run(fs::path(argv[arg]));
+}
+
+// what a benchmark run reports back to the parent
+struct BenchSample {
+    double wall_ms { 0 };
+    std::size_t allocated_objects { 0 };
+    std::size_t allocated_bytes { 0 };
+};
+
+// run path once in a child process, so that peak rss and heap stats
+// belong to this run alone
+static bool bench_run(const fs::path& path, Lox::BenchResult& result)
+{
+    int fds[2];
+    if (pipe(fds))
+        die_with_perror("pipe");
+    // don't let the child flush buffered output a second time
+    std::cout.flush();
+    std::cerr.flush();
+    auto pid = fork();
+    if (pid < 0)
+        die_with_perror("fork");
+
+    if (pid == 0) {
+        close(fds[0]);
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd < 0 || dup2(null_fd, STDOUT_FILENO) < 0)
+            die_with_perror("cannot discard output");
+        close(null_fd);
+
+        auto file = read_file(path);
+        Lox::Interpreter interp;
+        interp.set_engine(engine);
+        Lox::prelude(interp);
+        auto start = std::chrono::steady_clock::now();
+        auto ok = eval(file->text(), path_repr(path), interp, false, file);
+        std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        std::cout.flush();
+
+        auto& stats = Lox::heap().stats();
+        BenchSample sample { elapsed.count(), stats.allocated_objects,
+            stats.allocated_bytes };
+        if (write(fds[1], &sample, sizeof(sample)) != sizeof(sample))
+            ok = false;
+        _exit(ok ? 0 : 1);
+    }
+
+    close(fds[1]);
+    BenchSample sample;
+    auto nread = read(fds[0], &sample, sizeof(sample));
+    close(fds[0]);
+    int status = 0;
+    struct rusage usage = {};
+    if (wait4(pid, &status, 0, &usage) < 0)
+        die_with_perror("wait4");
+    if (nread != sizeof(sample) || !WIFEXITED(status) || WEXITSTATUS(status))
+        return false;
+
+    result.wall_ms.push_back(sample.wall_ms);
+    result.peak_rss_kb = std::max(result.peak_rss_kb, usage.ru_maxrss);
+    result.allocated_objects = std::max(result.allocated_objects,
+        sample.allocated_objects);
+    result.allocated_bytes = std::max(result.allocated_bytes,
+        sample.allocated_bytes);
+    return true;
+}
+
+static int bench_command(int argc, char* argv[])
+{
+    std::size_t runs = 10;
+    double threshold = 10;
+    fs::path baseline_path;
+    auto parse_number = [](std::string_view str, auto& num) {
+        auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), num);
+        if (ec != std::errc() || ptr != str.data() + str.size())
+            bench_usage(true);
+    };
+
+    // process options
+    int arg = 1;
+    for (char* argp; arg < argc && (argp = argv[arg]) && argp[0] == '-'; ++arg) {
+        std::string_view opt(argp);
+        if (opt == "-h"sv || opt == "--help"sv)
+            bench_usage(); // no return
+        else if (opt == "-n"sv) {
+            if (++arg == argc)
+                bench_usage(true);
+            parse_number(argv[arg], runs);
+        } else if (opt.starts_with("--runs="))
+            parse_number(opt.substr("--runs="sv.size()), runs);
+        else if (opt.starts_with("--baseline="))
+            baseline_path = opt.substr("--baseline="sv.size());
+        else if (opt.starts_with("--threshold="))
+            parse_number(opt.substr("--threshold="sv.size()), threshold);
+        else
+            break;
+    }
+    if (arg == argc || runs == 0 || threshold < 0)
+        bench_usage(true);
+
+    std::optional<Lox::BenchBaseline> baseline;
+    if (!baseline_path.empty()) {
+        std::istringstream in(std::string(read_file(baseline_path)->text()));
+        baseline = Lox::read_bench_baseline(in);
+        if (!baseline)
+            die("'" + path_repr(baseline_path) + "' is not a bench report");
+    }
+
+    Lox::BenchReport report;
+    report.engine = engine == Lox::Interpreter::Engine::Tree ? "tree" : "vm";
+    report.runs = runs;
+    report.baseline = baseline ? &*baseline : nullptr;
+    report.threshold = threshold / 100;
+    bool ok = true;
+    for (; arg < argc; ++arg) {
+        fs::path path = argv[arg];
+        auto& result = report.results.emplace_back();
+        result.name = path.stem();
+        for (std::size_t i = 0; i < runs && result.ok; ++i)
+            result.ok = bench_run(path, result);
+        if (!result.ok || report.is_regression(result))
+            ok = false;
+    }
+
+    report.write_json(std::cout);
+    report.write_summary(std::cerr);
+    return ok ? 0 : 1;
+}
+
 int main(int argc, char* argv[])
 {
     argv0 = fs::path(argv[0]).filename();
@@ -433,10 +890,42 @@ int main(int argc, char* argv[])
             usage(); // no return
         else if (argp == "--ui-testing"sv)
             ui_testing = true;
+        else if (argp == "--gc-stats"sv)
+            gc_stats = true;
+        else if (argp == "--no-cache"sv)
+            use_cache = false;
+        else if (argp == "--stats"sv)
+            run_stats_on = true;
+        else if (std::string_view(argp).starts_with("--stats=")) {
+            run_stats_on = true;
+            run_stats_path = argp + "--stats="sv.size();
+            if (run_stats_path.empty())
+                usage(true);
+        }
+        else if (argp == "--engine=tree"sv)
+            engine = Lox::Interpreter::Engine::Tree;
+        else if (argp == "--engine=vm"sv)
+            engine = Lox::Interpreter::Engine::VM;
+        else if (std::string_view(argp).starts_with("--engine="))
+            usage(true);
+        else if (std::string_view(argp).starts_with("--output-buffer=")) {
+            std::string_view size = argp + "--output-buffer="sv.size();
+            auto [ptr, ec] = std::from_chars(size.data(),
+                size.data() + size.size(), output_buffer_size);
+            if (ec != std::errc() || ptr != size.data() + size.size())
+                usage(true);
+        }
+        else if (std::string_view(argp).starts_with("--profile=")) {
+            profile_path = argp + "--profile="sv.size();
+            if (profile_path.empty())
+                usage(true);
+        }
         else
             break;
     }
 
+    Lox::heap().count_types(run_stats_on);
+
     if (arg == argc)
         return isatty(STDIN_FILENO) ? repl() : run("-");
 
@@ -444,10 +933,14 @@ int main(int argc, char* argv[])
     std::string name = argv[arg];
     char** restv = &argv[arg];
     int restc = argc - arg; // argc > arg here
+    if (name == "bench")
+        return bench_command(restc, restv);
     if (name == "lex")
         return lex_command(restc, restv);
     if (name == "parse")
         return parse_command(restc, restv);
+    if (name == "profile")
+        return profile_command(restc, restv);
     else if (restc != 1)
         usage(true);
     else
@@ -4,6 +4,7 @@
 #include <filesystem>
 #include <cstdio>
 #include <cctype>
+#include <cstdlib>
 #include <sys/wait.h>
 
 namespace fs = std::filesystem;
@@ -13,17 +14,31 @@ static fs::path lox_path;
 class Test : public testing::Test {
 public:
     Test(std::string_view command, const fs::path& source_path,
-        const fs::path& output_path)
+        const fs::path& output_path, int runs)
         : m_command(command)
         , m_source_path(source_path)
         , m_output_path(output_path)
+        , m_runs(runs)
     {
         // command and output_path can be empty
         assert(!source_path.empty());
+        assert(runs > 0);
     }
 
     void TestBody() override
     {
+        // runs after the first load the program that it cached
+        for (int i = 0; i < m_runs && !HasFatalFailure(); ++i)
+            run_lox();
+    }
+
+private:
+    void run_lox()
+    {
+        // lox reads the test's .stdin file, if any, as its stdin
+        auto stdin_path = fs::path(m_source_path).replace_extension(".stdin");
+        if (!fs::is_regular_file(stdin_path))
+            stdin_path = "/dev/null";
         errno = 0; // popen does not always set errno on error
         FILE* pipe = popen(std::string(lox_path)
             .append(" ")
@@ -36,7 +51,8 @@ public:
             .append(" ")
             .append(m_source_path)
             .append(" ")
-            .append("</dev/null") // no stdin
+            .append("<")
+            .append(stdin_path)
             .append(" ")
             .append(redirects())
             .c_str(), "r");
@@ -71,28 +87,28 @@ public:
         EXPECT_EQ(mustbe_out.view(), real_out.view());
     }
 
-private:
     virtual std::string redirects() const { return ""; }
     virtual int retcode() const { return 0; }
 
     std::string_view m_command;
     fs::path m_source_path;
     fs::path m_output_path;
+    int m_runs;
 };
 
 class PassingTest : public Test {
 public:
     PassingTest(std::string_view command, const fs::path& source_path,
-        const fs::path& output_path)
-        : Test(command, source_path, output_path)
+        const fs::path& output_path, int runs)
+        : Test(command, source_path, output_path, runs)
     {}
 };
 
 class FailingTest : public Test {
 public:
     FailingTest(std::string_view command, const fs::path& source_path,
-        const fs::path& output_path)
-        : Test(command, source_path, output_path)
+        const fs::path& output_path, int runs)
+        : Test(command, source_path, output_path, runs)
     {
         assert(!output_path.empty());
     }
@@ -150,15 +166,20 @@ static std::string test_path_to_name(const fs::path& path)
     return base;
 }
 
-static void register_tests(std::string_view suite, std::string_view command)
+// Register tests for .lox files in dir, running lox with command runs
+// times. Test suite names are prefixed with suite or, if empty, with dir.
+static void register_tests(std::string_view dir, std::string_view command,
+    std::string_view suite = {}, int runs = 1)
 {
+    if (suite.empty())
+        suite = dir;
     assert(!suite.empty());
     for (char c : suite)
         assert(is_alpha(c));
     std::string prefix { suite };
     prefix[0] = std::toupper(prefix[0]);
 
-    for (const auto& entry : fs::directory_iterator(suite)) {
+    for (const auto& entry : fs::directory_iterator(dir)) {
         if (entry.is_regular_file() && entry.path().extension() == ".lox") {
             auto source_path = entry.path();
             if (auto stdout_path = fs::path(source_path)
@@ -168,7 +189,7 @@ static void register_tests(std::string_view suite, std::string_view command)
                     test_path_to_name(source_path).c_str(),
                     nullptr, nullptr, __FILE__, __LINE__,
                     [=]() { return new PassingTest(command, source_path,
-                                stdout_path); });
+                                stdout_path, runs); });
             } else if (auto stderr_path = fs::path(source_path)
                     .replace_extension(".stderr");
                 fs::is_regular_file(stderr_path)) {
@@ -176,13 +197,13 @@ static void register_tests(std::string_view suite, std::string_view command)
                     test_path_to_name(source_path).c_str(),
                     nullptr, nullptr, __FILE__, __LINE__,
                     [=]() { return new FailingTest(command, source_path,
-                                stderr_path); });
+                                stderr_path, runs); });
             } else {
                 testing::RegisterTest((prefix + "Pass").c_str(),
                     test_path_to_name(source_path).c_str(),
                     nullptr, nullptr, __FILE__, __LINE__,
                     [=]() { return new PassingTest(command, source_path,
-                                {}); });
+                                {}, runs); });
             }
         }
     }
@@ -195,5 +216,17 @@ int main(int argc, char **argv)
     register_tests("lexer", "lex");
     register_tests("parser", "parse");
     register_tests("interpreter", "");
-    return RUN_ALL_TESTS();
+    register_tests("interpreter", "--engine=vm", "vm");
+    register_tests("interpreter", "", "cache", 2);
+
+    // lox caches checked programs, keep them away from the user's cache
+    char cache_dir[] = "/tmp/lox-test-cache-XXXXXX";
+    if (!mkdtemp(cache_dir)) {
+        std::perror("cannot create cache dir");
+        return 1;
+    }
+    setenv("LOX_CACHE_DIR", cache_dir, 1);
+    auto ret = RUN_ALL_TESTS();
+    fs::remove_all(cache_dir);
+    return ret;
 }